@@ -0,0 +1,43 @@
+#include "AllocationCounter.h"
+
+#include <cstddef>
+
+namespace
+{
+// Zero-initialized, so that it can be used before any constructor runs
+thread_local std::uint64_t t_allocations = 0;
+} // namespace
+
+extern "C"
+{
+    // Entry points of the glibc allocator, which the definitions below wrap
+    void* __libc_malloc(size_t size);               // NOLINT
+    void* __libc_calloc(size_t count, size_t size); // NOLINT
+    void* __libc_realloc(void* ptr, size_t size);   // NOLINT
+
+    void* malloc(size_t size) // NOLINT
+    {
+        ++t_allocations;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) // NOLINT
+    {
+        ++t_allocations;
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size) // NOLINT
+    {
+        if (ptr == nullptr)
+        {
+            ++t_allocations;
+        }
+        return __libc_realloc(ptr, size);
+    }
+}
+
+std::uint64_t get_allocation_count() noexcept
+{
+    return t_allocations;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations (malloc, calloc and realloc of a null pointer) made so far
+// by the calling thread, counted by wrapping the glibc allocator. GLib slices
+// are only counted when allocated with malloc (G_SLICE=always-malloc, set by
+// the benchmarks main).
+std::uint64_t get_allocation_count() noexcept;
@@ -0,0 +1,138 @@
+#include "LoopbackHarness.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <thread>
+
+// Bitrate of a mount followed by a UDP client losing 10% of its RTP packets,
+// then none: the bitrate must go down under loss and rise again once the
+// loss stops. The manual time is the delay of the decrease plus the one of
+// the recovery, both bound by the receiver report interval (5 s) and the
+// adaptation intervals (2 s down, 10 s up).
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+constexpr unsigned int INITIAL_BITRATE = 1024;
+constexpr unsigned int MIN_BITRATE = 256;
+constexpr unsigned int MAX_BITRATE = 2048;
+constexpr double LOSS = 0.1;
+constexpr GstClockTime FIRST_FRAME_TIMEOUT = 5 * GST_SECOND;
+constexpr GstClockTime DECREASE_TIMEOUT = 30 * GST_SECOND;
+constexpr GstClockTime RECOVERY_TIMEOUT = 60 * GST_SECOND;
+constexpr auto POLL_PERIOD = std::chrono::milliseconds(100);
+
+// Waits for the bitrate to drop below the initial one, giving the delay
+// (GST_CLOCK_TIME_NONE on timeout)
+GstClockTime wait_for_decrease(const StreamControllerStub& controller) noexcept
+{
+    gint64 start_time = g_get_monotonic_time();
+    GstClockTime delay = 0;
+    for (; delay < DECREASE_TIMEOUT; delay = (g_get_monotonic_time() - start_time) * GST_USECOND)
+    {
+        unsigned int bitrate = controller.get_bitrate();
+        if ((bitrate != 0) && (bitrate < INITIAL_BITRATE))
+        {
+            return delay;
+        }
+        std::this_thread::sleep_for(POLL_PERIOD);
+    }
+    return GST_CLOCK_TIME_NONE;
+}
+
+// Waits for the bitrate to rise above the lowest one it reaches, giving the
+// delay (GST_CLOCK_TIME_NONE on timeout)
+GstClockTime wait_for_recovery(const StreamControllerStub& controller, unsigned int& lowest_bitrate) noexcept
+{
+    gint64 start_time = g_get_monotonic_time();
+    GstClockTime delay = 0;
+    lowest_bitrate = controller.get_bitrate();
+    for (; delay < RECOVERY_TIMEOUT; delay = (g_get_monotonic_time() - start_time) * GST_USECOND)
+    {
+        unsigned int bitrate = controller.get_bitrate();
+        if (bitrate > lowest_bitrate)
+        {
+            return delay;
+        }
+        lowest_bitrate = std::min(lowest_bitrate, bitrate);
+        std::this_thread::sleep_for(POLL_PERIOD);
+    }
+    return GST_CLOCK_TIME_NONE;
+}
+
+void BM_BitrateAdaptation(benchmark::State& state)
+{
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    Configuration configuration = create_loopback_configuration(1, FRAMERATE);
+    configuration.renditions[0].bitrate = INITIAL_BITRATE;
+    configuration.renditions[0].bitrate_min = MIN_BITRATE;
+    configuration.renditions[0].bitrate_max = MAX_BITRATE;
+    LoopbackServer loopback;
+    if (!loopback.start(configuration))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+    StreamPusher pusher;
+    pusher.start(loopback.get_server(), clip, FRAMERATE, loopback.get_base_time());
+
+    const StreamControllerStub& controller = loopback.get_controller(0);
+    GstClockTime total_decrease_delay = 0;
+    GstClockTime total_recovery_delay = 0;
+    unsigned int total_lowest_bitrate = 0;
+    for (auto _ : state)
+    {
+        // Without receivers, the server goes back to the initial bitrate
+        while ((controller.get_bitrate() != 0) && (controller.get_bitrate() != INITIAL_BITRATE))
+        {
+            std::this_thread::sleep_for(POLL_PERIOD);
+        }
+
+        RtspClient client;
+        client.set_loss(LOSS);
+        if (!client.start(loopback.get_url(0), "udp") ||
+            !GST_CLOCK_TIME_IS_VALID(client.wait_first_frame(FIRST_FRAME_TIMEOUT)))
+        {
+            state.SkipWithError("cannot receive the stream");
+            break;
+        }
+
+        GstClockTime decrease_delay = wait_for_decrease(controller);
+        if (!GST_CLOCK_TIME_IS_VALID(decrease_delay))
+        {
+            state.SkipWithError("bitrate not decreased under loss");
+            break;
+        }
+
+        client.set_loss(0.0);
+        unsigned int lowest_bitrate = 0;
+        GstClockTime recovery_delay = wait_for_recovery(controller, lowest_bitrate);
+        if (!GST_CLOCK_TIME_IS_VALID(recovery_delay))
+        {
+            state.SkipWithError("bitrate not recovered without loss");
+            break;
+        }
+        client.stop();
+
+        state.SetIterationTime(static_cast<double>(decrease_delay + recovery_delay) / GST_SECOND);
+        total_decrease_delay += decrease_delay;
+        total_recovery_delay += recovery_delay;
+        total_lowest_bitrate += lowest_bitrate;
+    }
+
+    pusher.stop();
+    state.counters["decrease_s"] = benchmark::Counter(static_cast<double>(total_decrease_delay) / GST_SECOND,
+                                                      benchmark::Counter::kAvgIterations);
+    state.counters["recovery_s"] = benchmark::Counter(static_cast<double>(total_recovery_delay) / GST_SECOND,
+                                                      benchmark::Counter::kAvgIterations);
+    state.counters["lowest_kbps"] = benchmark::Counter(total_lowest_bitrate, benchmark::Counter::kAvgIterations);
+}
+} // namespace
+
+BENCHMARK(BM_BitrateAdaptation)->Iterations(3)->UseManualTime()->Unit(benchmark::kSecond);
@@ -0,0 +1,109 @@
+#include "AllocationCounter.h"
+#include "BufferShellPool.h"
+#include "CaptureTimeMeta.h"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// Hand-off of an encoded access unit to a consumer appsrc, the consumer
+// pipeline holding the given number of buffers in flight (released in
+// order). Compares the former per-frame copy with the shell pool, counting
+// the heap allocations of each push and of the release of the oldest buffer.
+namespace
+{
+GstBuffer* create_access_unit()
+{
+    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, 16 * 1024, nullptr);
+    GST_BUFFER_PTS(buffer) = GST_SECOND;
+    GST_BUFFER_DTS(buffer) = GST_SECOND;
+    set_capture_time(buffer, GST_SECOND);
+    return buffer;
+}
+
+class InFlightBuffers
+{
+  public:
+    explicit InFlightBuffers(size_t size) : m_buffers(size, nullptr)
+    {
+    }
+
+    InFlightBuffers(InFlightBuffers&&) = delete;
+    InFlightBuffers& operator=(InFlightBuffers&&) = delete;
+    InFlightBuffers(const InFlightBuffers&) = delete;
+    InFlightBuffers& operator=(const InFlightBuffers&) = delete;
+
+    ~InFlightBuffers()
+    {
+        for (GstBuffer* buffer : m_buffers)
+        {
+            if (buffer != nullptr)
+            {
+                gst_buffer_unref(buffer);
+            }
+        }
+    }
+
+    // Takes ownership of the buffer, releasing the oldest one
+    void push(GstBuffer* buffer)
+    {
+        if (m_buffers.empty())
+        {
+            gst_buffer_unref(buffer);
+            return;
+        }
+
+        if (m_buffers[m_next] != nullptr)
+        {
+            gst_buffer_unref(m_buffers[m_next]);
+        }
+        m_buffers[m_next] = buffer;
+        m_next = (m_next + 1) % m_buffers.size();
+    }
+
+  private:
+    std::vector<GstBuffer*> m_buffers;
+    size_t m_next = 0;
+};
+
+void BM_CopyBuffer(benchmark::State& state)
+{
+    GstBuffer* buffer = create_access_unit();
+    InFlightBuffers in_flight(static_cast<size_t>(state.range(0)));
+
+    std::uint64_t allocations = get_allocation_count();
+    for (auto _ : state)
+    {
+        GstBuffer* copy = gst_buffer_copy(buffer);
+        GST_BUFFER_PTS(copy) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DTS(copy) = GST_CLOCK_TIME_NONE;
+        in_flight.push(copy);
+    }
+    allocations = get_allocation_count() - allocations;
+
+    state.counters["allocations_per_push"] =
+        benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+    gst_buffer_unref(buffer);
+}
+
+void BM_WrapBuffer(benchmark::State& state)
+{
+    GstBuffer* buffer = create_access_unit();
+    InFlightBuffers in_flight(static_cast<size_t>(state.range(0)));
+    BufferShellPool pool;
+
+    // Includes the allocation of the shells while the pool fills up
+    std::uint64_t allocations = get_allocation_count();
+    for (auto _ : state)
+    {
+        in_flight.push(pool.wrap(buffer));
+    }
+    allocations = get_allocation_count() - allocations;
+
+    state.counters["allocations_per_push"] =
+        benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+    gst_buffer_unref(buffer);
+}
+} // namespace
+
+BENCHMARK(BM_CopyBuffer)->Arg(0)->Arg(8)->Arg(32);
+BENCHMARK(BM_WrapBuffer)->Arg(0)->Arg(8)->Arg(32);
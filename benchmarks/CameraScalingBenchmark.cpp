@@ -0,0 +1,107 @@
+#include "EncodingPipeline.h"
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <thread>
+
+// CPU time of the process and encoded frame rate with 1 to 4 cameras, each
+// one a test source encoding the default rendition ladder, all renditions
+// subscribed: the frame rate of each stream must stay at 30 fps. The
+// encoders need VA-API.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+constexpr unsigned int MAX_CAMERAS = 4;
+// Until every pipeline produces its streams
+constexpr unsigned int WARM_UP_IN_SECONDS = 2;
+
+class FrameCounter final : public IStreamConsumer
+{
+  public:
+    bool push_caps(unsigned int /*stream_idx*/, GstCaps* /*caps*/) noexcept override
+    {
+        return true;
+    }
+
+    bool push_buffer(unsigned int /*stream_idx*/, GstBuffer* /*buffer*/) noexcept override
+    {
+        m_frames.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    guint64 frames() const noexcept
+    {
+        return m_frames.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<guint64> m_frames{0};
+};
+
+void BM_Cameras(benchmark::State& state)
+{
+    if (!has_element_factory("vaapih264enc"))
+    {
+        state.SkipWithError("vaapih264enc not available");
+        return;
+    }
+
+    const auto nb_cameras = static_cast<unsigned int>(state.range(0));
+    Configuration configuration = create_loopback_configuration(nb_cameras, FRAMERATE);
+    configuration.renditions = Configuration().renditions;
+
+    FrameCounter counter;
+    EncodingPipeline pipelines[MAX_CAMERAS];
+    for (unsigned int i = 0; i < nb_cameras; ++i)
+    {
+        if (!pipelines[i].configure(configuration, i))
+        {
+            state.SkipWithError("cannot configure the camera pipeline");
+            return;
+        }
+        for (unsigned int j = 0; j < configuration.renditions.size(); ++j)
+        {
+            pipelines[i].subscribe(j);
+        }
+        if (!pipelines[i].start(configuration, {&counter}, {}))
+        {
+            state.SkipWithError("cannot start the camera pipeline");
+            return;
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(WARM_UP_IN_SECONDS));
+
+    guint64 nb_frames = 0;
+    GstClockTime total_cpu_time = 0;
+    for (auto _ : state)
+    {
+        GstClockTime cpu_time = get_process_cpu_time();
+        guint64 frames = counter.frames();
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        cpu_time = get_process_cpu_time() - cpu_time;
+        state.SetIterationTime(static_cast<double>(cpu_time) / GST_SECOND);
+        total_cpu_time += cpu_time;
+        nb_frames += counter.frames() - frames;
+    }
+
+    for (unsigned int i = 0; i < nb_cameras; ++i)
+    {
+        pipelines[i].stop();
+    }
+    const auto nb_streams = static_cast<double>(nb_cameras * configuration.renditions.size());
+    state.counters["encoded_fps"] =
+        benchmark::Counter(static_cast<double>(nb_frames), benchmark::Counter::kAvgIterations);
+    state.counters["fps_per_stream"] =
+        benchmark::Counter(static_cast<double>(nb_frames) / nb_streams, benchmark::Counter::kAvgIterations);
+    state.counters["cpu_per_camera"] = benchmark::Counter(
+        static_cast<double>(total_cpu_time) / GST_SECOND / nb_cameras, benchmark::Counter::kAvgIterations);
+}
+} // namespace
+
+// The manual time is the CPU time of the process over one second
+BENCHMARK(BM_Cameras)
+    ->DenseRange(1, MAX_CAMERAS)
+    ->Iterations(5)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,75 @@
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Time to the first keyframe of a client joining a mount fed at 30 fps with
+// one GOP per second, each join at another point of the GOP: without a key
+// frame request nor the replay of the last GOP it would average half a
+// second.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+// Coprime with the frame rate, so that the joins cover every point of the GOP
+constexpr unsigned int JOIN_STRIDE = 7;
+constexpr GstClockTime FIRST_FRAME_TARGET = 200 * GST_MSECOND;
+constexpr GstClockTime FIRST_FRAME_TIMEOUT = 5 * GST_SECOND;
+
+void BM_ClientJoin(benchmark::State& state)
+{
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    LoopbackServer loopback;
+    if (!loopback.start(create_loopback_configuration(1, FRAMERATE)))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+    StreamPusher pusher;
+    pusher.start(loopback.get_server(), clip, FRAMERATE, loopback.get_base_time());
+
+    const std::chrono::nanoseconds period(GST_SECOND / FRAMERATE);
+    unsigned int nb_joins = 0;
+    unsigned int nb_under_target = 0;
+    std::vector<double> delays;
+    for (auto _ : state)
+    {
+        std::this_thread::sleep_for(period * ((nb_joins++ * JOIN_STRIDE) % FRAMERATE));
+
+        RtspClient client;
+        GstClockTime delay = GST_CLOCK_TIME_NONE;
+        if (client.start(loopback.get_url(0)))
+        {
+            delay = client.wait_first_frame(FIRST_FRAME_TIMEOUT);
+        }
+        client.stop();
+        if (!GST_CLOCK_TIME_IS_VALID(delay))
+        {
+            delay = FIRST_FRAME_TIMEOUT;
+        }
+        else if (delay < FIRST_FRAME_TARGET)
+        {
+            ++nb_under_target;
+        }
+        state.SetIterationTime(static_cast<double>(delay) / GST_SECOND);
+        delays.push_back(static_cast<double>(delay) / GST_MSECOND);
+    }
+
+    pusher.stop();
+    state.counters["under_200ms"] = benchmark::Counter(nb_under_target, benchmark::Counter::kAvgIterations);
+    state.counters["p50_ms"] = get_percentile(delays, 0.5);
+    state.counters["p90_ms"] = get_percentile(delays, 0.9);
+    state.counters["key_frame_requests"] =
+        benchmark::Counter(loopback.get_controller(0).key_frame_requests(), benchmark::Counter::kAvgIterations);
+}
+} // namespace
+
+// The manual time is the delay to the first keyframe
+BENCHMARK(BM_ClientJoin)->Iterations(60)->UseManualTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,162 @@
+#include "CameraManager.h"
+#include "ControlServer.h"
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <future>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Round trip of control requests from concurrent clients, each one keeping
+// a few ping and status requests in flight on its own socket, from the
+// write of a request to the read of its reply. Both commands are answered
+// at once, so that only the control thread and the coalesced writes are
+// measured (the camera manager is not even initialized).
+namespace
+{
+constexpr unsigned int PIPELINE_DEPTH = 8;
+constexpr unsigned int REQUESTS_PER_CLIENT = 2000;
+constexpr gsize READ_SIZE = 4096;
+
+bool write_all(int fd, const std::string& data) noexcept
+{
+    gsize offset = 0;
+    while (offset < data.size())
+    {
+        ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+        if (written <= 0)
+        {
+            return false;
+        }
+        offset += static_cast<gsize>(written);
+    }
+    return true;
+}
+
+// Round trips of the requests of a client in microseconds, empty on failure
+std::vector<double> run_client(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    g_strlcpy(address.sun_path, path.c_str(), sizeof(address.sun_path));
+    if ((fd < 0) || (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return {};
+    }
+
+    std::vector<gint64> send_times(REQUESTS_PER_CLIENT);
+    unsigned int nb_sent = 0;
+    auto send_next = [fd, &send_times, &nb_sent]() {
+        std::string line = std::to_string(nb_sent) + (((nb_sent % 2) == 0) ? " ping\n" : " status\n");
+        send_times[nb_sent++] = g_get_monotonic_time();
+        return write_all(fd, line);
+    };
+
+    bool success = true;
+    while (success && (nb_sent < PIPELINE_DEPTH))
+    {
+        success = send_next();
+    }
+
+    std::vector<double> round_trips;
+    std::string input;
+    char data[READ_SIZE]; // NOLINT
+    while (success && (round_trips.size() < REQUESTS_PER_CLIENT))
+    {
+        ssize_t read_size = read(fd, data, sizeof(data));
+        gint64 now = g_get_monotonic_time();
+        if (read_size <= 0)
+        {
+            success = false;
+            break;
+        }
+
+        // Replies are "<id> ok [<detail>]"
+        input.append(data, static_cast<size_t>(read_size));
+        size_t line_end = 0;
+        while (success && ((line_end = input.find('\n')) != std::string::npos))
+        {
+            auto id = static_cast<unsigned int>(std::strtoul(input.c_str(), nullptr, 10));
+            input.erase(0, line_end + 1);
+            if (id >= nb_sent)
+            {
+                success = false;
+                break;
+            }
+
+            round_trips.push_back(static_cast<double>(now - send_times[id]));
+            if (nb_sent < REQUESTS_PER_CLIENT)
+            {
+                success = send_next();
+            }
+        }
+    }
+
+    close(fd);
+    return success ? round_trips : std::vector<double>();
+}
+
+void BM_ControlRoundTrip(benchmark::State& state)
+{
+    const auto nb_clients = static_cast<unsigned int>(state.range(0));
+
+    gchar* path = g_build_filename(g_get_tmp_dir(), "rtsp-cam-benchmark.sock", nullptr);
+    CameraManager manager;
+    ControlServer control_server;
+    if (!control_server.start(path, manager))
+    {
+        g_free(path);
+        state.SkipWithError("cannot start the control server");
+        return;
+    }
+
+    std::vector<double> round_trips;
+    for (auto _ : state)
+    {
+        std::vector<std::future<std::vector<double>>> clients;
+        for (unsigned int i = 0; i < nb_clients; ++i)
+        {
+            clients.push_back(std::async(std::launch::async, run_client, std::string(path)));
+        }
+
+        bool success = true;
+        for (auto& client : clients)
+        {
+            std::vector<double> client_round_trips = client.get();
+            success = success && !client_round_trips.empty();
+            round_trips.insert(round_trips.end(), client_round_trips.begin(), client_round_trips.end());
+        }
+        if (!success)
+        {
+            state.SkipWithError("control request failed");
+            break;
+        }
+    }
+
+    control_server.stop();
+    g_free(path);
+    if (round_trips.empty())
+    {
+        return;
+    }
+
+    state.counters["requests"] = benchmark::Counter(static_cast<double>(round_trips.size()),
+                                                    benchmark::Counter::kIsRate);
+    state.counters["p50_us"] = get_percentile(round_trips, 0.5);
+    state.counters["p90_us"] = get_percentile(round_trips, 0.9);
+    state.counters["p99_us"] = get_percentile(round_trips, 0.99);
+    state.counters["max_us"] = get_percentile(round_trips, 1.0);
+}
+} // namespace
+
+// Number of concurrent clients
+BENCHMARK(BM_ControlRoundTrip)->Arg(1)->Arg(4)->Arg(16)->UseRealTime()->Unit(benchmark::kMillisecond);
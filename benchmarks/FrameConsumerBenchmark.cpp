@@ -0,0 +1,188 @@
+#include "FrameExporter.h"
+#include "FrameRingReader.h"
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// CPU time per frame of a local consumer of the 640x480 frames of a camera
+// at 30 fps: reading the raw frames exported to the shared memory ring, as
+// opposed to playing the RTSP stream and decoding it (rtspsrc !
+// rtph264depay ! avdec_h264). Only the consumer side is measured: the ring
+// reader thread, or the whole gst-launch-1.0 client process.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+constexpr gint FRAME_WIDTH = 640;
+constexpr gint FRAME_HEIGHT = 480;
+constexpr gsize FRAME_SIZE = FRAME_WIDTH * FRAME_HEIGHT * 3 / 2;
+constexpr gsize CACHE_LINE_SIZE = 64;
+// Until the client plays the stream
+constexpr unsigned int WARM_UP_IN_SECONDS = 2;
+
+GstClockTime get_thread_cpu_time() noexcept
+{
+    struct timespec cpu_time = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time);
+    return GST_TIMESPEC_TO_TIME(cpu_time);
+}
+
+void BM_FrameRingConsumer(benchmark::State& state)
+{
+    Configuration configuration;
+    configuration.capture.width = FRAME_WIDTH;
+    configuration.capture.height = FRAME_HEIGHT;
+    configuration.capture.framerate = FRAMERATE;
+    configuration.frame_export.name = "rtsp-cam-benchmark-" + std::to_string(getpid());
+    FrameExporter exporter;
+    GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", "width", G_TYPE_INT,
+                                        FRAME_WIDTH, "height", G_TYPE_INT, FRAME_HEIGHT, "framerate",
+                                        GST_TYPE_FRACTION, FRAMERATE, 1, nullptr);
+    bool started = exporter.start(configuration) && exporter.push_caps(0, caps);
+    gst_caps_unref(caps);
+    if (!started)
+    {
+        state.SkipWithError("cannot export the frames");
+        return;
+    }
+
+    // Raw frames pushed at the frame rate, as by the encoding pipeline
+    std::atomic<bool> running{true};
+    std::thread producer([&exporter, &running]() {
+        GstBuffer* frame = gst_buffer_new_allocate(nullptr, FRAME_SIZE, nullptr);
+        gst_buffer_memset(frame, 0, 0x80, FRAME_SIZE);
+        const std::chrono::nanoseconds period(GST_SECOND / FRAMERATE);
+        auto next_push = std::chrono::steady_clock::now();
+        for (guint64 i = 0; running.load(); ++i)
+        {
+            GstBuffer* buffer = gst_buffer_copy(frame);
+            GST_BUFFER_PTS(buffer) = i * period.count();
+            exporter.push_buffer(0, buffer);
+            gst_buffer_unref(buffer);
+
+            next_push += period;
+            std::this_thread::sleep_until(next_push);
+        }
+        gst_buffer_unref(frame);
+    });
+
+    // Every frame is read in place, touching each of its cache lines, the
+    // ring being polled at the frame rate
+    bool opened = false;
+    guint64 nb_frames = 0;
+    guint64 nb_lost_frames = 0;
+    GstClockTime cpu_time = 0;
+    std::thread consumer([&]() {
+        FrameRingReader reader;
+        opened = reader.open(configuration.frame_export.name.c_str());
+        GstClockTime start_cpu_time = get_thread_cpu_time();
+        const std::chrono::nanoseconds period(GST_SECOND / FRAMERATE);
+        FrameRingReader::Frame frame;
+        guint64 checksum = 0;
+        while (opened && running.load())
+        {
+            while (reader.next_frame(frame))
+            {
+                for (size_t i = 0; i < frame.size; i += CACHE_LINE_SIZE)
+                {
+                    checksum += frame.data[i];
+                }
+                nb_frames += reader.is_valid(frame) ? 1 : 0;
+            }
+            std::this_thread::sleep_for(period);
+        }
+        benchmark::DoNotOptimize(checksum);
+        cpu_time = get_thread_cpu_time() - start_cpu_time;
+        nb_lost_frames = reader.lost_frames();
+    });
+
+    for (auto _ : state)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    running.store(false);
+    consumer.join();
+    producer.join();
+    exporter.stop();
+    if (!opened || (nb_frames == 0))
+    {
+        state.SkipWithError("no frame read from the ring");
+        return;
+    }
+
+    state.counters["frames"] = static_cast<double>(nb_frames);
+    state.counters["lost_frames"] = static_cast<double>(nb_lost_frames);
+    state.counters["cpu_per_frame_us"] = static_cast<double>(cpu_time) / GST_USECOND / nb_frames;
+}
+
+void BM_RtspDecodeConsumer(benchmark::State& state)
+{
+    if (!has_element_factory("avdec_h264"))
+    {
+        state.SkipWithError("avdec_h264 not available");
+        return;
+    }
+
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    LoopbackServer loopback;
+    if (!loopback.start(create_loopback_configuration(1, FRAMERATE)))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+    StreamPusher pusher;
+    pusher.start(loopback.get_server(), clip, FRAMERATE, loopback.get_base_time());
+
+    ClientProcess client;
+    if (!client.start(loopback.get_url(0), "tcp", nullptr, "avdec_h264"))
+    {
+        pusher.stop();
+        state.SkipWithError("cannot start the client");
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(WARM_UP_IN_SECONDS));
+
+    // The client plays every frame while it runs, a stalled one exiting
+    GstClockTime start_cpu_time = client.get_cpu_time();
+    gint64 start_time = g_get_monotonic_time();
+    bool playing = GST_CLOCK_TIME_IS_VALID(start_cpu_time);
+    for (auto _ : state)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (!playing || !client.is_running())
+        {
+            playing = false;
+            state.SkipWithError("client not playing the stream");
+            break;
+        }
+    }
+    GstClockTime cpu_time = client.get_cpu_time();
+    gint64 elapsed_time = g_get_monotonic_time() - start_time;
+
+    client.stop();
+    pusher.stop();
+    if (!playing || !GST_CLOCK_TIME_IS_VALID(cpu_time))
+    {
+        return;
+    }
+
+    double nb_frames = static_cast<double>(elapsed_time) * FRAMERATE / G_TIME_SPAN_SECOND;
+    state.counters["frames"] = nb_frames;
+    state.counters["cpu_per_frame_us"] = static_cast<double>(cpu_time - start_cpu_time) / GST_USECOND / nb_frames;
+}
+} // namespace
+
+// Each iteration lasts one second of the stream
+BENCHMARK(BM_FrameRingConsumer)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RtspDecodeConsumer)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
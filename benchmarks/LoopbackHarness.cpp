@@ -0,0 +1,467 @@
+#include "LoopbackHarness.h"
+
+#include "CaptureTimeMeta.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <gst/app/app.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+
+namespace
+{
+constexpr char LOOPBACK_PORT[] = "18554";
+constexpr unsigned int CLIP_DURATION_IN_SECONDS = 2;
+constexpr guint STALL_MONITOR_PERIOD_IN_MS = 1;
+constexpr auto RECORDER_TIMEOUT = std::chrono::seconds(5);
+} // namespace
+
+Configuration create_loopback_configuration(unsigned int nb_cameras, unsigned int framerate)
+{
+    Configuration configuration;
+    configuration.port = LOOPBACK_PORT;
+    configuration.control_socket.clear();
+    configuration.capture.framerate = framerate;
+    configuration.cameras.assign(nb_cameras, CameraConfiguration());
+    for (CameraConfiguration& camera : configuration.cameras)
+    {
+        camera.source = "test";
+    }
+
+    RenditionConfiguration rendition;
+    rendition.framerate = framerate;
+    configuration.renditions = {rendition};
+    return configuration;
+}
+
+GstClockTime get_process_cpu_time() noexcept
+{
+    struct timespec cpu_time = {};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+    return GST_TIMESPEC_TO_TIME(cpu_time);
+}
+
+GstClockTime get_running_time(GstClockTime base_time) noexcept
+{
+    GstClock* clock = gst_system_clock_obtain();
+    GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    return now - base_time;
+}
+
+double get_percentile(std::vector<double>& values, double percentile) noexcept
+{
+    assert(!values.empty());
+
+    auto idx = static_cast<size_t>(percentile * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(idx), values.end());
+    return values[idx];
+}
+
+bool has_element_factory(const char* factory_name) noexcept
+{
+    GstElementFactory* factory = gst_element_factory_find(factory_name);
+    if (factory == nullptr)
+    {
+        return false;
+    }
+
+    gst_object_unref(factory);
+    return true;
+}
+
+EncodedClip::~EncodedClip()
+{
+    for (GstBuffer* access_unit : m_access_units)
+    {
+        gst_buffer_unref(access_unit);
+    }
+
+    if (m_caps != nullptr)
+    {
+        gst_caps_unref(m_caps);
+    }
+}
+
+bool EncodedClip::encode(unsigned int framerate) noexcept
+{
+    assert(m_access_units.empty());
+    assert(framerate > 0);
+
+    // A whole number of GOP, so that the loop starts again on a keyframe
+    gchar* desc = g_strdup_printf("videotestsrc num-buffers=%u pattern=ball ! "
+                                  "video/x-raw,width=640,height=480,framerate=%u/1 ! "
+                                  "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=%u bitrate=1024 ! "
+                                  "video/x-h264,profile=main,stream-format=byte-stream,alignment=au ! "
+                                  "appsink name=sink sync=false",
+                                  CLIP_DURATION_IN_SECONDS * framerate, framerate, framerate);
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc, &error);
+    g_free(desc);
+    g_clear_error(&error);
+    if (pipeline == nullptr)
+    {
+        return false;
+    }
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    assert(sink != nullptr);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Until the end of stream (or an error)
+    GstSample* sample = nullptr;
+    while ((sample = gst_app_sink_pull_sample(GST_APP_SINK(sink))) != nullptr)
+    {
+        if (m_caps == nullptr)
+        {
+            m_caps = gst_caps_ref(gst_sample_get_caps(sample));
+        }
+        m_access_units.push_back(gst_buffer_ref(gst_sample_get_buffer(sample)));
+        gst_sample_unref(sample);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+
+    m_frame_duration = GST_SECOND / framerate;
+    return (m_caps != nullptr) && (m_access_units.size() == CLIP_DURATION_IN_SECONDS * framerate);
+}
+
+GstBuffer* EncodedClip::get_access_unit(guint64 frame, GstClockTime pts) const noexcept
+{
+    assert(!m_access_units.empty());
+
+    GstBuffer* access_unit = gst_buffer_copy(m_access_units[frame % m_access_units.size()]);
+    GST_BUFFER_PTS(access_unit) = pts;
+    GST_BUFFER_DTS(access_unit) = pts;
+    GST_BUFFER_DURATION(access_unit) = m_frame_duration;
+    return access_unit;
+}
+
+LoopbackServer::LoopbackServer()
+{
+    GstClock* clock = gst_system_clock_obtain();
+    m_base_time = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+}
+
+bool LoopbackServer::start(const Configuration& configuration) noexcept
+{
+    StreamingServer::StreamControllers stream_controllers;
+    for (size_t i = 0; i < configuration.cameras.size(); ++i)
+    {
+        m_controllers.push_back(std::make_unique<StreamControllerStub>(m_base_time));
+        stream_controllers.push_back(m_controllers.back().get());
+    }
+
+    m_port = configuration.port;
+    return m_server.configure(configuration, stream_controllers, m_server_thread.context()) &&
+           m_server_thread.start("rtsp-server") && m_server.start();
+}
+
+void LoopbackServer::stop() noexcept
+{
+    // As CameraManager::shut, once no source of the server can be dispatched
+    m_server_thread.stop();
+    m_server.stop();
+}
+
+std::string LoopbackServer::get_url(unsigned int camera_idx, const std::string& address) const
+{
+    return "rtsp://" + address + ":" + m_port + "/cam" + std::to_string(camera_idx) + "/video0";
+}
+
+void StreamPusher::start(IStreamConsumer& consumer, const EncodedClip& clip, unsigned int framerate,
+                         GstClockTime base_time) noexcept
+{
+    assert(!m_running.load());
+
+    consumer.push_caps(0, clip.get_caps());
+    m_running.store(true);
+    m_thread = std::thread([this, &consumer, &clip, framerate, base_time]() {
+        const std::chrono::nanoseconds period(GST_SECOND / framerate);
+        auto next_push = std::chrono::steady_clock::now();
+        for (guint64 frame = 0; m_running.load(); ++frame)
+        {
+            GstBuffer* access_unit = clip.get_access_unit(frame, get_running_time(base_time));
+            set_capture_time(access_unit, gst_util_get_timestamp());
+            consumer.push_buffer(0, access_unit);
+            gst_buffer_unref(access_unit);
+
+            next_push += period;
+            std::this_thread::sleep_until(next_push);
+        }
+    });
+}
+
+void StreamPusher::stop() noexcept
+{
+    m_running.store(false);
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void StallMonitor::start(GMainContext* context) noexcept
+{
+    assert(m_source == nullptr);
+
+    m_last_tick = g_get_monotonic_time();
+    m_max_stall.store(0);
+    m_source = g_timeout_source_new(STALL_MONITOR_PERIOD_IN_MS);
+    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(on_tick), this, nullptr);
+    g_source_attach(m_source, context);
+}
+
+void StallMonitor::stop() noexcept
+{
+    if (m_source != nullptr)
+    {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+        m_source = nullptr;
+    }
+}
+
+gboolean StallMonitor::on_tick(StallMonitor* monitor) noexcept
+{
+    // Dispatched from the monitored context, only the maximum being shared
+    gint64 now = g_get_monotonic_time();
+    gint64 stall = now - monitor->m_last_tick - STALL_MONITOR_PERIOD_IN_MS * 1000;
+    monitor->m_last_tick = now;
+    if ((stall > 0) && (static_cast<GstClockTime>(stall) * GST_USECOND > monitor->m_max_stall.load()))
+    {
+        monitor->m_max_stall.store(static_cast<GstClockTime>(stall) * GST_USECOND);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+bool wait_for_recorder(MainContextThread& recorder_thread, std::function<void(RecordingCallback)> request,
+                       std::string& filename)
+{
+    using Completion = std::pair<bool, std::string>;
+    auto completion = std::make_shared<std::promise<Completion>>();
+    std::future<Completion> completed = completion->get_future();
+    recorder_thread.invoke([request, completion]() {
+        request([completion](bool success, const char* recorded) {
+            completion->set_value({success, (recorded != nullptr) ? recorded : ""});
+        });
+    });
+    if (completed.wait_for(RECORDER_TIMEOUT) != std::future_status::ready)
+    {
+        return false;
+    }
+
+    Completion result = completed.get();
+    filename = result.second;
+    return result.first;
+}
+
+bool ClientProcess::start(const std::string& url, const char* protocols, const char* netns,
+                          const char* decoder) noexcept
+{
+    assert(m_pid == 0);
+
+    std::string location = "location=" + url;
+    std::string lower_transports = std::string("protocols=") + protocols;
+    std::vector<const gchar*> argv;
+    if (netns != nullptr)
+    {
+        argv.insert(argv.end(), {"ip", "netns", "exec", netns});
+    }
+    // Without TCP among the lower transports, rtspsrc fails on UDP timeout
+    argv.insert(argv.end(), {"gst-launch-1.0", "-q", "rtspsrc", location.c_str(), lower_transports.c_str(),
+                             "latency=0", "timeout=1000000", "!"});
+    if (decoder != nullptr)
+    {
+        argv.insert(argv.end(), {"rtph264depay", "!", decoder, "!"});
+    }
+    argv.insert(argv.end(), {"fakesink", "sync=false", nullptr});
+    auto flags = static_cast<GSpawnFlags>(G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD |
+                                          G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL);
+    GError* error = nullptr;
+    if (!g_spawn_async(nullptr, const_cast<gchar**>(argv.data()), nullptr, flags, nullptr, nullptr, &m_pid, &error))
+    {
+        g_clear_error(&error);
+        m_pid = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool ClientProcess::is_running() noexcept
+{
+    if (m_pid == 0)
+    {
+        return false;
+    }
+
+    if (waitpid(m_pid, nullptr, WNOHANG) == 0)
+    {
+        return true;
+    }
+
+    g_spawn_close_pid(m_pid);
+    m_pid = 0;
+    return false;
+}
+
+GstClockTime ClientProcess::get_cpu_time() const noexcept
+{
+    if (m_pid == 0)
+    {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    gchar* path = g_strdup_printf("/proc/%d/stat", static_cast<int>(m_pid));
+    gchar* stat = nullptr;
+    bool read = g_file_get_contents(path, &stat, nullptr, nullptr);
+    g_free(path);
+    if (!read)
+    {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    // Fields following the command name, which may hold spaces, up to the
+    // user and system times
+    unsigned long user_ticks = 0;
+    unsigned long system_ticks = 0;
+    const char* fields = std::strrchr(stat, ')');
+    bool parsed = (fields != nullptr) &&
+                  (std::sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user_ticks,
+                               &system_ticks) == 2);
+    g_free(stat);
+    if (!parsed)
+    {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    return gst_util_uint64_scale(user_ticks + system_ticks, GST_SECOND, static_cast<guint64>(sysconf(_SC_CLK_TCK)));
+}
+
+void ClientProcess::stop() noexcept
+{
+    if (m_pid != 0)
+    {
+        kill(m_pid, SIGTERM);
+        waitpid(m_pid, nullptr, 0);
+        g_spawn_close_pid(m_pid);
+        m_pid = 0;
+    }
+}
+
+bool RtspClient::start(const std::string& url, const char* protocols) noexcept
+{
+    assert(m_pipeline == nullptr);
+
+    gchar* desc = g_strdup_printf("rtspsrc name=src location=%s protocols=%s latency=0 ! rtph264depay ! "
+                                  "fakesink name=sink sync=false",
+                                  url.c_str(), protocols);
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc, &error);
+    g_free(desc);
+    g_clear_error(&error);
+    if (pipeline == nullptr)
+    {
+        return false;
+    }
+    m_pipeline = GST_ELEMENT(gst_object_ref_sink(pipeline));
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(m_pipeline), "sink");
+    assert(sink != nullptr);
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    assert(pad != nullptr);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, reinterpret_cast<GstPadProbeCallback>(on_buffer), this,
+                      nullptr);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+
+    GstElement* source = gst_bin_get_by_name(GST_BIN(m_pipeline), "src");
+    assert(source != nullptr);
+    g_signal_connect(source, "new-manager", G_CALLBACK(on_new_manager), this);
+    gst_object_unref(source);
+
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_start_time = g_get_monotonic_time();
+        m_first_frame_time = 0;
+    }
+    return (gst_element_set_state(m_pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+}
+
+void RtspClient::stop() noexcept
+{
+    if (m_pipeline != nullptr)
+    {
+        gst_element_set_state(m_pipeline, GST_STATE_NULL);
+        gst_object_unref(m_pipeline);
+        m_pipeline = nullptr;
+    }
+}
+
+GstClockTime RtspClient::wait_first_frame(GstClockTime timeout) noexcept
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_first_frame.wait_for(lock, std::chrono::nanoseconds(timeout),
+                                [this]() { return (m_first_frame_time != 0); }))
+    {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    return (m_first_frame_time - m_start_time) * GST_USECOND;
+}
+
+GstPadProbeReturn RtspClient::on_buffer(GstPad* /*pad*/, GstPadProbeInfo* info, RtspClient* client) noexcept
+{
+    assert(info != nullptr);
+    assert(client != nullptr);
+
+    if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    std::lock_guard<std::mutex> guard(client->m_mutex);
+    client->m_first_frame_time = g_get_monotonic_time();
+    client->m_first_frame.notify_all();
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void RtspClient::on_new_manager(GstElement* /*source*/, GstElement* manager, RtspClient* client) noexcept
+{
+    assert(manager != nullptr);
+
+    // The RTP sink pads of the rtpbin are requested once the stream is set up
+    g_signal_connect(manager, "pad-added", G_CALLBACK(on_manager_pad_added), client);
+}
+
+void RtspClient::on_manager_pad_added(GstElement* /*manager*/, GstPad* pad, RtspClient* client) noexcept
+{
+    assert(pad != nullptr);
+
+    gchar* name = gst_pad_get_name(pad);
+    if (g_str_has_prefix(name, "recv_rtp_sink_"))
+    {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, reinterpret_cast<GstPadProbeCallback>(on_rtp_packet),
+                          client, nullptr);
+    }
+    g_free(name);
+}
+
+GstPadProbeReturn RtspClient::on_rtp_packet(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, RtspClient* client) noexcept
+{
+    assert(client != nullptr);
+
+    double loss = client->m_loss.load();
+    return ((loss > 0.0) && (g_random_double() < loss)) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include "Configuration.h"
+#include "IStreamConsumer.h"
+#include "IStreamController.h"
+#include "MainContextThread.h"
+#include "StreamRecorder.h"
+#include "StreamingServer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loopback fixtures of the streaming benchmarks: an encoded clip is pushed to
+// a StreamingServer as an encoding pipeline would push it, and served to RTSP
+// clients on 127.0.0.1. Clients need the rtsp and rtp plugins, the clip the
+// x264 one; benchmarks are skipped without them.
+
+// Configuration of a server of test cameras with a single rendition, on a
+// port of its own
+Configuration create_loopback_configuration(unsigned int nb_cameras, unsigned int framerate);
+
+// CPU time of the whole process (all its threads)
+GstClockTime get_process_cpu_time() noexcept;
+
+// Running time of the system clock against the given base time
+GstClockTime get_running_time(GstClockTime base_time) noexcept;
+
+// Percentile (between 0 and 1) of a non-empty series of measures, reordering
+// them
+double get_percentile(std::vector<double>& values, double percentile) noexcept;
+
+// Whether the element can be created (e.g. vaapih264enc, missing without a
+// VA-API driver)
+bool has_element_factory(const char* factory_name) noexcept;
+
+// Controller of the cameras of a loopback server, which grants every request
+// at once and remembers the last bitrate set
+class StreamControllerStub final : public IStreamController
+{
+  public:
+    explicit StreamControllerStub(GstClockTime base_time) : m_base_time(base_time)
+    {
+    }
+
+    bool request_key_frame(unsigned int /*stream_idx*/) noexcept override
+    {
+        m_key_frame_requests.fetch_add(1);
+        return true;
+    }
+
+    bool set_bitrate(unsigned int /*stream_idx*/, unsigned int bitrate) noexcept override
+    {
+        m_bitrate.store(bitrate);
+        return true;
+    }
+
+    bool subscribe(unsigned int /*stream_idx*/) noexcept override
+    {
+        return true;
+    }
+
+    void unsubscribe(unsigned int /*stream_idx*/) noexcept override
+    {
+    }
+
+    GstClockTime get_base_time() const noexcept override
+    {
+        return m_base_time;
+    }
+
+    unsigned int key_frame_requests() const noexcept
+    {
+        return m_key_frame_requests.load();
+    }
+
+    // In kbit/s, 0 until the server sets one
+    unsigned int get_bitrate() const noexcept
+    {
+        return m_bitrate.load();
+    }
+
+  private:
+    GstClockTime m_base_time;
+    std::atomic<unsigned int> m_key_frame_requests{0};
+    std::atomic<unsigned int> m_bitrate{0};
+};
+
+// Access units of a test pattern encoded with one GOP per second (without
+// B-frames), pushed in a loop
+class EncodedClip final
+{
+  public:
+    EncodedClip() = default;
+
+    EncodedClip(EncodedClip&&) = delete;
+    EncodedClip& operator=(EncodedClip&&) = delete;
+    EncodedClip(const EncodedClip&) = delete;
+    EncodedClip& operator=(const EncodedClip&) = delete;
+
+    ~EncodedClip();
+
+    bool encode(unsigned int framerate) noexcept;
+
+    GstCaps* get_caps() const noexcept
+    {
+        return m_caps;
+    }
+
+    // Access unit of the given frame of the loop, sharing the memory of the
+    // encoded one
+    GstBuffer* get_access_unit(guint64 frame, GstClockTime pts) const noexcept;
+
+  private:
+    GstCaps* m_caps = nullptr;
+    std::vector<GstBuffer*> m_access_units;
+    GstClockTime m_frame_duration = 0;
+};
+
+class LoopbackServer final
+{
+  public:
+    LoopbackServer();
+
+    LoopbackServer(LoopbackServer&&) = delete;
+    LoopbackServer& operator=(LoopbackServer&&) = delete;
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    ~LoopbackServer()
+    {
+        stop();
+    }
+
+    bool start(const Configuration& configuration) noexcept;
+    void stop() noexcept;
+
+    StreamingServer& get_server() noexcept
+    {
+        return m_server;
+    }
+
+    const StreamControllerStub& get_controller(unsigned int camera_idx) const noexcept
+    {
+        return *m_controllers[camera_idx];
+    }
+
+    // Base time given by the controllers, against which the pushed streams
+    // are timestamped
+    GstClockTime get_base_time() const noexcept
+    {
+        return m_base_time;
+    }
+
+    GstClockTime get_running_time() const noexcept
+    {
+        return ::get_running_time(m_base_time);
+    }
+    // URL of the first rendition of a camera, through the given address of
+    // the server host
+    std::string get_url(unsigned int camera_idx, const std::string& address = "127.0.0.1") const;
+
+  private:
+    GstClockTime m_base_time = 0;
+    std::string m_port;
+    std::vector<std::unique_ptr<StreamControllerStub>> m_controllers;
+    MainContextThread m_server_thread;
+    StreamingServer m_server;
+};
+
+// Pushes a clip as the first stream of a consumer (e.g. a loopback server)
+// at its frame rate, from a thread of its own, each access unit being
+// stamped with its push time as capture time
+class StreamPusher final
+{
+  public:
+    StreamPusher() = default;
+
+    StreamPusher(StreamPusher&&) = delete;
+    StreamPusher& operator=(StreamPusher&&) = delete;
+    StreamPusher(const StreamPusher&) = delete;
+    StreamPusher& operator=(const StreamPusher&) = delete;
+
+    ~StreamPusher()
+    {
+        stop();
+    }
+
+    void start(IStreamConsumer& consumer, const EncodedClip& clip, unsigned int framerate,
+               GstClockTime base_time) noexcept;
+    void stop() noexcept;
+
+  private:
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+};
+
+// Delays of the dispatch of a periodic source of a main context behind the
+// other sources of the context: the longest one is its worst stall
+class StallMonitor final
+{
+  public:
+    StallMonitor() = default;
+
+    StallMonitor(StallMonitor&&) = delete;
+    StallMonitor& operator=(StallMonitor&&) = delete;
+    StallMonitor(const StallMonitor&) = delete;
+    StallMonitor& operator=(const StallMonitor&) = delete;
+
+    ~StallMonitor()
+    {
+        stop();
+    }
+
+    void start(GMainContext* context) noexcept;
+    void stop() noexcept;
+
+    GstClockTime get_max_stall() const noexcept
+    {
+        return m_max_stall.load();
+    }
+
+    void reset() noexcept
+    {
+        m_max_stall.store(0);
+    }
+
+  private:
+    static gboolean on_tick(StallMonitor* monitor) noexcept;
+
+    GSource* m_source = nullptr;
+    gint64 m_last_tick = 0;
+    std::atomic<GstClockTime> m_max_stall{0};
+};
+
+// Issues a start or stop request to a recorder from its context thread and
+// waits for its completion, giving the recorded filename (false on failure
+// or timeout)
+bool wait_for_recorder(MainContextThread& recorder_thread, std::function<void(RecordingCallback)> request,
+                       std::string& filename);
+
+// RTSP client of a loopback server run as a gst-launch-1.0 process, so that
+// its CPU time is not accounted to the server, optionally in another network
+// namespace. A client receiving no packet for a second fails and exits.
+class ClientProcess final
+{
+  public:
+    ClientProcess() = default;
+
+    ClientProcess(ClientProcess&&) = delete;
+    ClientProcess& operator=(ClientProcess&&) = delete;
+    ClientProcess(const ClientProcess&) = delete;
+    ClientProcess& operator=(const ClientProcess&) = delete;
+
+    ~ClientProcess()
+    {
+        stop();
+    }
+
+    // The depayloaded stream is decoded by the given element (e.g.
+    // avdec_h264) when set
+    bool start(const std::string& url, const char* protocols, const char* netns = nullptr,
+               const char* decoder = nullptr) noexcept;
+    void stop() noexcept;
+
+    // Whether the client still plays the stream
+    bool is_running() noexcept;
+
+    // CPU time of the client process (all its threads), with the resolution
+    // of the clock ticks (GST_CLOCK_TIME_NONE once exited)
+    GstClockTime get_cpu_time() const noexcept;
+
+  private:
+    GPid m_pid = 0;
+};
+
+// RTSP client of a loopback server, receiving the stream in-process
+class RtspClient final
+{
+  public:
+    RtspClient() = default;
+
+    RtspClient(RtspClient&&) = delete;
+    RtspClient& operator=(RtspClient&&) = delete;
+    RtspClient(const RtspClient&) = delete;
+    RtspClient& operator=(const RtspClient&) = delete;
+
+    ~RtspClient()
+    {
+        stop();
+    }
+
+    // Lower transports as for rtspsrc (e.g. "tcp" or "udp-mcast")
+    bool start(const std::string& url, const char* protocols = "tcp") noexcept;
+    void stop() noexcept;
+
+    // Fraction (between 0 and 1) of the received RTP packets dropped at
+    // random before the jitter buffer, as by netsim drop-probability, so that
+    // the receiver reports show the loss. Can be changed while playing.
+    void set_loss(double loss) noexcept
+    {
+        m_loss.store(loss);
+    }
+
+    // Delay between the start and the first keyframe received, once its
+    // decoding could begin (GST_CLOCK_TIME_NONE on timeout)
+    GstClockTime wait_first_frame(GstClockTime timeout) noexcept;
+
+  private:
+    static GstPadProbeReturn on_buffer(GstPad* pad, GstPadProbeInfo* info, RtspClient* client) noexcept;
+    static void on_new_manager(GstElement* source, GstElement* manager, RtspClient* client) noexcept;
+    static void on_manager_pad_added(GstElement* manager, GstPad* pad, RtspClient* client) noexcept;
+    static GstPadProbeReturn on_rtp_packet(GstPad* pad, GstPadProbeInfo* info, RtspClient* client) noexcept;
+
+    GstElement* m_pipeline = nullptr;
+    std::atomic<double> m_loss{0.0};
+    gint64 m_start_time = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_first_frame;
+    gint64 m_first_frame_time = 0;
+};
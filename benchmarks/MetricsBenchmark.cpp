@@ -0,0 +1,59 @@
+#include "Metrics.h"
+
+#include <benchmark/benchmark.h>
+
+// Metric updates made by the streaming threads for each captured frame of a
+// camera with two renditions, each one served to a client and the first one
+// recorded: the captured frame counter, then per rendition the encoded
+// frame, byte and latency updates of the encoder branch and the pushed
+// buffer and latency updates of the mount, and the recorded buffer and queue
+// level updates. The CPU share of a core at 30 fps (as a fraction) is derived
+// from the time per frame.
+namespace
+{
+constexpr unsigned int NB_RENDITIONS = 2;
+constexpr double FRAMERATE = 30.0;
+
+struct StreamMetrics
+{
+    Counter frames;
+    Counter bytes;
+    Histogram encoding_latency;
+    Counter buffers;
+    Histogram serving_latency;
+};
+
+void BM_MetricsPerFrame(benchmark::State& state)
+{
+    Counter captured_frames;
+    StreamMetrics stream_metrics[NB_RENDITIONS];
+    Counter recorded_buffers;
+    Gauge queued_buffers;
+
+    GstClockTime latency = 0;
+    for (auto _ : state)
+    {
+        // Latencies spread over the sub-millisecond buckets
+        latency = (latency + 37 * GST_USECOND) % (2 * GST_MSECOND);
+        captured_frames.add();
+        for (StreamMetrics& metrics : stream_metrics)
+        {
+            metrics.frames.add();
+            metrics.bytes.add(16 * 1024);
+            metrics.encoding_latency.observe(latency);
+            metrics.buffers.add();
+            metrics.serving_latency.observe(latency + GST_MSECOND);
+        }
+        recorded_buffers.add();
+        queued_buffers.set(static_cast<gint64>(latency % 30));
+    }
+
+    benchmark::DoNotOptimize(captured_frames.value());
+    // Seconds per frame times the frame rate
+    state.counters["cpu_share_at_30fps"] =
+        benchmark::Counter(static_cast<double>(state.iterations()) / FRAMERATE,
+                           benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+} // namespace
+
+BENCHMARK(BM_MetricsPerFrame);
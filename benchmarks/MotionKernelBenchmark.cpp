@@ -0,0 +1,47 @@
+#include "MotionKernel.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// Frame difference of the motion detector with each implementation supported
+// by the CPU, on sampling grids of 640x480 and 1920x1080 captures
+namespace
+{
+std::vector<uint8_t> create_noise(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> samples(size);
+    for (uint8_t& sample : samples)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        sample = static_cast<uint8_t>(seed >> 24);
+    }
+    return samples;
+}
+
+void count_changed_samples(benchmark::State& state, MotionKernelImplementation implementation)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const std::vector<uint8_t> current = create_noise(size, 1);
+    const std::vector<uint8_t> previous = create_noise(size, 2);
+
+    for (auto _ : state)
+    {
+        size_t count = implementation.count_changed_samples(current.data(), previous.data(), size, 32);
+        benchmark::DoNotOptimize(count);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size * 2));
+}
+
+const bool registered = [] {
+    for (const MotionKernelImplementation& implementation : motion_kernel_implementations())
+    {
+        std::string name = std::string("BM_CountChangedSamples/") + implementation.name;
+        benchmark::RegisterBenchmark(name.c_str(), count_changed_samples, implementation)
+            ->Arg(320 * 240)
+            ->Arg(960 * 540);
+    }
+    return true;
+}();
+} // namespace
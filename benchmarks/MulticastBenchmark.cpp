@@ -0,0 +1,96 @@
+#include "LoopbackHarness.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// CPU time of the server per second of stream, with a growing number of
+// clients (each one a process of its own) receiving the rendition through
+// unicast UDP or through its multicast group.
+//
+// The server does not loop multicast packets back to its own host (its
+// udpsinks have loop=false), so multicast clients have to run in another
+// network namespace, e.g. behind a veth pair:
+//   RTSPCAM_CLIENT_NETNS    namespace of the clients (ip netns exec)
+//   RTSPCAM_SERVER_ADDRESS  address of the server from that namespace
+// with a route for the multicast range through the veth on the server side.
+// Runs where any client stops receiving the stream are failed.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+// Longer than the UDP timeout of the clients, so that the ones receiving
+// nothing have exited
+constexpr unsigned int WARM_UP_IN_SECONDS = 3;
+
+void BM_ServerCpu(benchmark::State& state)
+{
+    const bool multicast = (state.range(0) != 0);
+    const auto nb_clients = static_cast<unsigned int>(state.range(1));
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    Configuration configuration = create_loopback_configuration(1, FRAMERATE);
+    configuration.renditions[0].multicast = multicast;
+    LoopbackServer loopback;
+    if (!loopback.start(configuration))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+
+    StreamPusher pusher;
+    pusher.start(loopback.get_server(), clip, FRAMERATE, loopback.get_base_time());
+    const char* netns = std::getenv("RTSPCAM_CLIENT_NETNS");
+    const char* address = std::getenv("RTSPCAM_SERVER_ADDRESS");
+    std::string url = loopback.get_url(0, (address != nullptr) ? address : "127.0.0.1");
+    std::vector<std::unique_ptr<ClientProcess>> clients;
+    for (unsigned int i = 0; i < nb_clients; ++i)
+    {
+        clients.push_back(std::make_unique<ClientProcess>());
+        if (!clients.back()->start(url, multicast ? "udp-mcast" : "udp", netns))
+        {
+            state.SkipWithError("cannot run gst-launch-1.0");
+            return;
+        }
+    }
+    auto all_clients_running = [&clients]() {
+        return std::all_of(clients.begin(), clients.end(),
+                            [](const std::unique_ptr<ClientProcess>& client) { return client->is_running(); });
+    };
+    std::this_thread::sleep_for(std::chrono::seconds(WARM_UP_IN_SECONDS));
+    if (!all_clients_running())
+    {
+        state.SkipWithError("a client receives no stream (see RTSPCAM_CLIENT_NETNS for multicast)");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        GstClockTime cpu_time = get_process_cpu_time();
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        state.SetIterationTime(static_cast<double>(get_process_cpu_time() - cpu_time) / GST_SECOND);
+
+        if (!all_clients_running())
+        {
+            state.SkipWithError("a client stopped receiving the stream");
+            break;
+        }
+    }
+}
+} // namespace
+
+// The manual time is the CPU time of the server process over one second
+BENCHMARK(BM_ServerCpu)
+    ->ArgsProduct({{0, 1}, {1, 4, 16}})
+    ->ArgNames({"multicast", "clients"})
+    ->Iterations(5)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,83 @@
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <glib/gstdio.h>
+#include <string>
+#include <thread>
+
+// Worst stall of the recorder context while passthrough recordings are
+// started, run for a second and stopped in a loop, the encoded stream being
+// pushed at 30 fps: the start and stop requests must return without waiting
+// for the recording pipeline. Recordings are written to the current
+// directory and removed once stopped.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+constexpr auto RECORDING_DURATION = std::chrono::seconds(1);
+
+void BM_RecordingToggle(benchmark::State& state)
+{
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    GstClockTime base_time = get_running_time(0);
+    StreamControllerStub controller(base_time);
+    MainContextThread recorder_thread;
+    StreamRecorder recorder;
+    if (!recorder_thread.start("recorder") ||
+        !recorder_thread.invoke_async([&]() { return recorder.init(recorder_thread.context(), controller); }).get())
+    {
+        state.SkipWithError("cannot initialize the recorder");
+        return;
+    }
+
+    StreamPusher pusher;
+    pusher.start(recorder, clip, FRAMERATE, base_time);
+    StallMonitor monitor;
+    monitor.start(recorder_thread.context());
+    for (auto _ : state)
+    {
+        monitor.reset();
+        std::string filename;
+        bool recorded = wait_for_recorder(
+            recorder_thread,
+            [&recorder](RecordingCallback callback) { recorder.start_recording(RecordingOptions(), callback); },
+            filename);
+        if (recorded)
+        {
+            std::this_thread::sleep_for(RECORDING_DURATION);
+            recorded = wait_for_recorder(
+                recorder_thread, [&recorder](RecordingCallback callback) { recorder.stop_recording(callback); },
+                filename);
+        }
+        state.SetIterationTime(static_cast<double>(monitor.get_max_stall()) / GST_SECOND);
+
+        if (!filename.empty())
+        {
+            g_remove(filename.c_str());
+        }
+        if (!recorded)
+        {
+            state.SkipWithError("cannot record the stream");
+            break;
+        }
+    }
+
+    monitor.stop();
+    pusher.stop();
+    recorder_thread.invoke_async([&recorder]() {
+        recorder.shut();
+        return true;
+    }).get();
+    recorder_thread.stop();
+}
+} // namespace
+
+// The manual time is the longest stall of the recorder context during a
+// start/stop cycle
+BENCHMARK(BM_RecordingToggle)->Iterations(10)->UseManualTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,100 @@
+#include "EncodingPipeline.h"
+#include "LoopbackHarness.h"
+#include "StreamRecorder.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <glib/gstdio.h>
+#include <string>
+#include <thread>
+
+// CPU time of the process per second of a camera encoding the default
+// rendition ladder from a test source, without recording and while recording
+// in each mode: the difference is the cost of the recording. The encoders
+// need VA-API; the load of the GPU itself is not sampled (see intel_gpu_top
+// or radeontop while the benchmark runs). Recordings are written to the
+// current directory and removed once stopped.
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+// Until the pipeline produces its streams and the recording is started
+constexpr unsigned int WARM_UP_IN_SECONDS = 2;
+
+enum RecordingCase
+{
+    NO_RECORDING,
+    PASSTHROUGH_RECORDING,
+    REENCODE_RECORDING
+};
+
+void BM_Recording(benchmark::State& state)
+{
+    if (!has_element_factory("vaapih264enc"))
+    {
+        state.SkipWithError("vaapih264enc not available");
+        return;
+    }
+
+    const auto recording_case = static_cast<RecordingCase>(state.range(0));
+    Configuration configuration = create_loopback_configuration(1, FRAMERATE);
+    configuration.renditions = Configuration().renditions;
+
+    MainContextThread recorder_thread;
+    StreamRecorder recorder;
+    EncodingPipeline pipeline;
+    pipeline.configure(configuration, 0);
+    bool ready = recorder_thread.start("recorder") &&
+                 recorder_thread.invoke_async([&]() { return recorder.init(recorder_thread.context(), pipeline); })
+                     .get() &&
+                 pipeline.start(configuration, {&recorder}, {&recorder.raw_stream_consumer()});
+
+    std::string filename;
+    if (ready && (recording_case != NO_RECORDING))
+    {
+        RecordingOptions options;
+        options.mode = (recording_case == REENCODE_RECORDING) ? RecordingMode::REENCODE : RecordingMode::PASSTHROUGH;
+        ready = wait_for_recorder(
+            recorder_thread,
+            [&recorder, options](RecordingCallback callback) { recorder.start_recording(options, callback); },
+            filename);
+    }
+
+    if (ready)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(WARM_UP_IN_SECONDS));
+        for (auto _ : state)
+        {
+            GstClockTime cpu_time = get_process_cpu_time();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            state.SetIterationTime(static_cast<double>(get_process_cpu_time() - cpu_time) / GST_SECOND);
+        }
+    }
+    else
+    {
+        state.SkipWithError("cannot start the camera pipeline or the recording");
+    }
+
+    if (!filename.empty())
+    {
+        wait_for_recorder(
+            recorder_thread, [&recorder](RecordingCallback callback) { recorder.stop_recording(callback); }, filename);
+        g_remove(filename.c_str());
+    }
+    pipeline.stop();
+    recorder_thread.invoke_async([&recorder]() {
+        recorder.shut();
+        return true;
+    }).get();
+    recorder_thread.stop();
+}
+} // namespace
+
+// The manual time is the CPU time of the process over one second
+BENCHMARK(BM_Recording)
+    ->Arg(NO_RECORDING)
+    ->Arg(PASSTHROUGH_RECORDING)
+    ->Arg(REENCODE_RECORDING)
+    ->ArgName("mode")
+    ->Iterations(5)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
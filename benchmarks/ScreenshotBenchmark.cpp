@@ -0,0 +1,164 @@
+#include "IFrameProducer.h"
+#include "ImageWriter.h"
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <future>
+#include <glib/gstdio.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Bursts of JPEG snapshots or screenshots of distinct 640x480 frames, as many
+// as the writer accepts in flight, issued at once from the writer context:
+// reports the snapshot throughput and the worst stall of the context.
+// Screenshots are written to the current directory and removed afterwards.
+namespace
+{
+constexpr unsigned int BURST_SIZE = 8;
+constexpr gint FRAME_WIDTH = 640;
+constexpr gint FRAME_HEIGHT = 480;
+constexpr gsize FRAME_SIZE = FRAME_WIDTH * FRAME_HEIGHT * 3 / 2;
+constexpr GstClockTime FRAME_DURATION = GST_SECOND / 30;
+constexpr auto BURST_TIMEOUT = std::chrono::seconds(5);
+
+enum SnapshotCase
+{
+    JPEG_SNAPSHOT,
+    SCREENSHOT
+};
+
+// Gives a new gray I420 frame on each call, so that requests are neither
+// coalesced nor served from the cache
+class TestFrameProducer final : public IFrameProducer
+{
+  public:
+    TestFrameProducer()
+        : m_caps(gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", "width", G_TYPE_INT, FRAME_WIDTH,
+                                     "height", G_TYPE_INT, FRAME_HEIGHT, "framerate", GST_TYPE_FRACTION, 30, 1,
+                                     nullptr))
+    {
+    }
+
+    TestFrameProducer(TestFrameProducer&&) = delete;
+    TestFrameProducer& operator=(TestFrameProducer&&) = delete;
+    TestFrameProducer(const TestFrameProducer&) = delete;
+    TestFrameProducer& operator=(const TestFrameProducer&) = delete;
+
+    ~TestFrameProducer() override
+    {
+        gst_caps_unref(m_caps);
+    }
+
+    GstSample* get_last_sample() const noexcept override
+    {
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, FRAME_SIZE, nullptr);
+        gst_buffer_memset(buffer, 0, 0x80, FRAME_SIZE);
+        GST_BUFFER_PTS(buffer) = m_next_pts.fetch_add(FRAME_DURATION);
+        GstSample* sample = gst_sample_new(buffer, m_caps, nullptr, nullptr);
+        gst_buffer_unref(buffer);
+        return sample;
+    }
+
+  private:
+    GstCaps* m_caps;
+    mutable std::atomic<GstClockTime> m_next_pts{0};
+};
+
+// Completions of a burst, counted down from the writer context
+struct Burst
+{
+    std::mutex mutex;
+    unsigned int nb_pending = BURST_SIZE;
+    bool success = true;
+    std::vector<std::string> filenames;
+    std::promise<bool> completed;
+
+    void complete(bool succeeded, const char* filename)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        success = success && succeeded;
+        if (filename != nullptr)
+        {
+            filenames.emplace_back(filename);
+        }
+        if (--nb_pending == 0)
+        {
+            completed.set_value(success);
+        }
+    }
+};
+
+void BM_SnapshotBurst(benchmark::State& state)
+{
+    const auto snapshot_case = static_cast<SnapshotCase>(state.range(0));
+    MainContextThread writer_thread;
+    ImageWriter writer;
+    if (!writer_thread.start("image-writer") ||
+        !writer_thread.invoke_async([&]() { return writer.start(writer_thread.context()); }).get())
+    {
+        state.SkipWithError("cannot start the image writer");
+        return;
+    }
+
+    TestFrameProducer producer;
+    StallMonitor monitor;
+    monitor.start(writer_thread.context());
+    for (auto _ : state)
+    {
+        auto burst = std::make_shared<Burst>();
+        std::future<bool> completed = burst->completed.get_future();
+        auto start = std::chrono::steady_clock::now();
+        writer_thread.invoke([&writer, &producer, snapshot_case, burst]() {
+            ScreenshotCallback on_screenshot = [burst](bool success, const char* filename) {
+                burst->complete(success, filename);
+            };
+            JpegCallback on_jpeg = [burst](GBytes* jpeg) { burst->complete(jpeg != nullptr, nullptr); };
+            for (unsigned int i = 0; i < BURST_SIZE; ++i)
+            {
+                bool requested = (snapshot_case == SCREENSHOT) ? writer.take_screenshot(producer, on_screenshot)
+                                                               : writer.take_jpeg(producer, on_jpeg);
+                if (!requested)
+                {
+                    burst->complete(false, nullptr);
+                }
+            }
+        });
+
+        bool success = (completed.wait_for(BURST_TIMEOUT) == std::future_status::ready) && completed.get();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        state.SetIterationTime(elapsed.count());
+        if (!success)
+        {
+            state.SkipWithError("cannot take the snapshots");
+            break;
+        }
+
+        for (const std::string& filename : burst->filenames)
+        {
+            g_remove(filename.c_str());
+        }
+    }
+
+    monitor.stop();
+    state.counters["snapshots_per_second"] =
+        benchmark::Counter(static_cast<double>(state.iterations() * BURST_SIZE), benchmark::Counter::kIsRate);
+    state.counters["max_stall_ms"] = static_cast<double>(monitor.get_max_stall()) / GST_MSECOND;
+    writer_thread.invoke_async([&writer]() {
+        writer.stop();
+        return true;
+    }).get();
+    writer_thread.stop();
+}
+} // namespace
+
+// The manual time is the duration of a burst
+BENCHMARK(BM_SnapshotBurst)
+    ->Arg(JPEG_SNAPSHOT)
+    ->Arg(SCREENSHOT)
+    ->ArgName("screenshot")
+    ->Iterations(20)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
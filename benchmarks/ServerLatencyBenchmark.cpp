@@ -0,0 +1,187 @@
+#include "EncodingPipeline.h"
+#include "LoopbackHarness.h"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Capture to RTP payloader latency of a 30 fps mount played by a client,
+// from the rtspcam_server_latency_seconds histogram over the measured
+// period: percentiles are the upper bounds of their buckets. Either from a
+// loopback server fed with an encoded clip (the hand-off from the encoder
+// output to the payloader), or from a test camera through its encoding
+// pipeline (the whole path, VA-API being needed).
+namespace
+{
+constexpr unsigned int FRAMERATE = 30;
+constexpr GstClockTime FIRST_FRAME_TIMEOUT = 5 * GST_SECOND;
+constexpr char SERVER_LATENCY[] = "rtspcam_server_latency_seconds";
+constexpr char MOUNT_LABELS[] = "mount=\"/cam0/video0\"";
+constexpr char ENCODING_LATENCY[] = "rtspcam_encoding_latency_seconds";
+constexpr char STREAM_LABELS[] = "camera=\"0\",stream=\"0\"";
+
+struct HistogramSnapshot
+{
+    std::vector<double> bounds; // in seconds, the last one being infinite
+    std::vector<double> counts; // cumulative
+    double sum = 0.0;
+};
+
+// Samples of a published histogram, from the Prometheus exposition of the
+// metrics registry
+HistogramSnapshot get_histogram(const std::string& name, const std::string& labels)
+{
+    const std::string bucket_prefix = name + "_bucket{" + labels + ",le=\"";
+    const std::string sum_prefix = name + "_sum{" + labels + "} ";
+
+    HistogramSnapshot snapshot;
+    gchar* metrics = Metric::format_all();
+    gchar** lines = g_strsplit(metrics, "\n", -1);
+    for (gchar** line = lines; *line != nullptr; ++line)
+    {
+        const std::string sample(*line);
+        if (sample.compare(0, bucket_prefix.size(), bucket_prefix) == 0)
+        {
+            size_t bound_end = sample.find('"', bucket_prefix.size());
+            std::string bound = sample.substr(bucket_prefix.size(), bound_end - bucket_prefix.size());
+            snapshot.bounds.push_back((bound == "+Inf") ? HUGE_VAL : g_ascii_strtod(bound.c_str(), nullptr));
+            snapshot.counts.push_back(g_ascii_strtod(sample.c_str() + sample.rfind(' ') + 1, nullptr));
+        }
+        else if (sample.compare(0, sum_prefix.size(), sum_prefix) == 0)
+        {
+            snapshot.sum = g_ascii_strtod(sample.c_str() + sum_prefix.size(), nullptr);
+        }
+    }
+    g_strfreev(lines);
+    g_free(metrics);
+    return snapshot;
+}
+
+// Bucket bound of the percentile (between 0 and 1) of the samples observed
+// between two snapshots, in ms
+double get_bucket_percentile(const HistogramSnapshot& start, const HistogramSnapshot& end, double percentile)
+{
+    double count = end.counts.back() - start.counts.back();
+    for (size_t i = 0; i < end.counts.size(); ++i)
+    {
+        if (end.counts[i] - start.counts[i] >= percentile * count)
+        {
+            return end.bounds[i] * 1000.0;
+        }
+    }
+    return HUGE_VAL;
+}
+
+void report_latency(benchmark::State& state, const char* prefix, const HistogramSnapshot& start,
+                    const HistogramSnapshot& end)
+{
+    if (end.counts.empty() || (start.counts.size() != end.counts.size()) ||
+        (end.counts.back() <= start.counts.back()))
+    {
+        state.SkipWithError("no latency observed");
+        return;
+    }
+
+    const std::string name(prefix);
+    double count = end.counts.back() - start.counts.back();
+    state.counters[name + "_frames"] = count;
+    state.counters[name + "_mean_ms"] = (end.sum - start.sum) * 1000.0 / count;
+    state.counters[name + "_p50_ms"] = get_bucket_percentile(start, end, 0.5);
+    state.counters[name + "_p99_ms"] = get_bucket_percentile(start, end, 0.99);
+}
+
+// Plays the first mount of the first camera, each iteration lasting one
+// second of the stream
+bool play(benchmark::State& state, const std::string& url, HistogramSnapshot& server_start,
+          HistogramSnapshot& server_end)
+{
+    RtspClient client;
+    if (!client.start(url) || !GST_CLOCK_TIME_IS_VALID(client.wait_first_frame(FIRST_FRAME_TIMEOUT)))
+    {
+        state.SkipWithError("cannot receive the stream");
+        return false;
+    }
+
+    server_start = get_histogram(SERVER_LATENCY, MOUNT_LABELS);
+    for (auto _ : state)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    server_end = get_histogram(SERVER_LATENCY, MOUNT_LABELS);
+    client.stop();
+    return true;
+}
+
+void BM_ServerLatency(benchmark::State& state)
+{
+    EncodedClip clip;
+    if (!clip.encode(FRAMERATE))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    LoopbackServer loopback;
+    if (!loopback.start(create_loopback_configuration(1, FRAMERATE)))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+    StreamPusher pusher;
+    pusher.start(loopback.get_server(), clip, FRAMERATE, loopback.get_base_time());
+
+    HistogramSnapshot start;
+    HistogramSnapshot end;
+    bool played = play(state, loopback.get_url(0), start, end);
+    pusher.stop();
+    if (played)
+    {
+        report_latency(state, "server", start, end);
+    }
+}
+
+void BM_CaptureToPayloaderLatency(benchmark::State& state)
+{
+    if (!has_element_factory("vaapih264enc"))
+    {
+        state.SkipWithError("vaapih264enc not available");
+        return;
+    }
+
+    // Wired as by CameraManager, the server being fed by the pipeline
+    Configuration configuration = create_loopback_configuration(1, FRAMERATE);
+    EncodingPipeline pipeline;
+    pipeline.configure(configuration, 0);
+    MainContextThread server_thread;
+    StreamingServer server;
+    bool started = server.configure(configuration, {&pipeline}, server_thread.context()) &&
+                   server_thread.start("rtsp-server") && pipeline.start(configuration, {&server}, {}) &&
+                   server.start();
+
+    HistogramSnapshot server_start;
+    HistogramSnapshot server_end;
+    HistogramSnapshot encoding_start = get_histogram(ENCODING_LATENCY, STREAM_LABELS);
+    bool played = started && play(state, "rtsp://127.0.0.1:" + configuration.port + "/cam0/video0", server_start,
+                                  server_end);
+    HistogramSnapshot encoding_end = get_histogram(ENCODING_LATENCY, STREAM_LABELS);
+
+    server_thread.stop();
+    server.stop();
+    pipeline.stop();
+    if (!started)
+    {
+        state.SkipWithError("cannot start the camera");
+    }
+    else if (played)
+    {
+        report_latency(state, "encoder", encoding_start, encoding_end);
+        report_latency(state, "server", server_start, server_end);
+    }
+}
+} // namespace
+
+BENCHMARK(BM_ServerLatency)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CaptureToPayloaderLatency)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,99 @@
+#include "LoopbackHarness.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encoded buffers pushed to a mount at the camera frame rate while clients
+// keep joining and leaving it, each join and leave changing its list of
+// appsrc: the push durations measure the contention of the streaming thread
+// with the RTSP threads. Each client thread requests the mount with a query
+// of its own, so that it gets a media of its own instead of sharing one.
+namespace
+{
+constexpr GstClockTime JOIN_TIMEOUT = 2 * GST_SECOND;
+
+void BM_PushWithReconfiguration(benchmark::State& state)
+{
+    const auto framerate = static_cast<unsigned int>(state.range(0));
+    const auto nb_clients = static_cast<unsigned int>(state.range(1));
+    EncodedClip clip;
+    if (!clip.encode(framerate))
+    {
+        state.SkipWithError("cannot encode the test clip");
+        return;
+    }
+
+    LoopbackServer loopback;
+    if (!loopback.start(create_loopback_configuration(1, framerate)))
+    {
+        state.SkipWithError("cannot start the RTSP server");
+        return;
+    }
+    StreamingServer& server = loopback.get_server();
+    server.push_caps(0, clip.get_caps());
+
+    // Clients join and leave as fast as they can, once they got a picture
+    // (at once from the replayed GOP)
+    std::atomic<bool> running{true};
+    std::atomic<unsigned int> nb_reconfigurations{0};
+    std::vector<std::thread> clients;
+    for (unsigned int i = 0; i < nb_clients; ++i)
+    {
+        std::string url = loopback.get_url(0) + "?client=" + std::to_string(i);
+        clients.emplace_back([url, &running, &nb_reconfigurations]() {
+            while (running.load())
+            {
+                RtspClient client;
+                if (client.start(url))
+                {
+                    client.wait_first_frame(JOIN_TIMEOUT);
+                }
+                client.stop();
+                nb_reconfigurations.fetch_add(2);
+            }
+        });
+    }
+
+    const std::chrono::nanoseconds period(GST_SECOND / framerate);
+    auto next_push = std::chrono::steady_clock::now();
+    guint64 frame = 0;
+    std::vector<double> push_durations;
+    push_durations.reserve(static_cast<size_t>(state.max_iterations));
+    for (auto _ : state)
+    {
+        GstBuffer* access_unit = clip.get_access_unit(frame++, loopback.get_running_time());
+        auto start = std::chrono::steady_clock::now();
+        server.push_buffer(0, access_unit);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        state.SetIterationTime(elapsed.count());
+        push_durations.push_back(elapsed.count() * 1e6);
+        gst_buffer_unref(access_unit);
+
+        next_push += period;
+        std::this_thread::sleep_until(next_push);
+    }
+
+    running.store(false);
+    for (std::thread& client : clients)
+    {
+        client.join();
+    }
+    state.counters["reconfigurations"] = nb_reconfigurations.load();
+    state.counters["p50_us"] = get_percentile(push_durations, 0.5);
+    state.counters["p99_us"] = get_percentile(push_durations, 0.99);
+    state.counters["max_us"] = *std::max_element(push_durations.begin(), push_durations.end());
+}
+} // namespace
+
+// 600 frames at each frame rate, from 20 s down to 5 s of stream, with one
+// client or 8 concurrent ones
+BENCHMARK(BM_PushWithReconfiguration)
+    ->ArgsProduct({{30, 60, 120}, {1, 8}})
+    ->ArgNames({"fps", "clients"})
+    ->Iterations(600)
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
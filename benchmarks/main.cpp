@@ -0,0 +1,20 @@
+#include <benchmark/benchmark.h>
+#include <gst/gst.h>
+
+int main(int argc, char** argv)
+{
+    // Buffers and their metas are allocated from GLib slices, only counted
+    // by AllocationCounter when they come from malloc (the default from GLib
+    // 2.76)
+    g_setenv("G_SLICE", "always-malloc", TRUE);
+    gst_init(&argc, &argv);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
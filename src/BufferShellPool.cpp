@@ -0,0 +1,79 @@
+#include "BufferShellPool.h"
+
+#include "CaptureTimeMeta.h"
+
+#include <cassert>
+
+GstBuffer* BufferShellPool::wrap(GstBuffer* buffer, ShellHook hook) noexcept
+{
+    assert(buffer != nullptr);
+
+    // A shell can be reused as soon as the consumer pipeline released it,
+    // that is when the pool holds the only remaining reference.
+    GstBuffer* shell = nullptr;
+    for (unsigned int i = 0; (i < NB_SHELLS) && (shell == nullptr); ++i)
+    {
+        unsigned int shell_idx = (m_next_shell + i) % NB_SHELLS;
+        if (m_shells[shell_idx] == nullptr)
+        {
+            m_shells[shell_idx] = gst_buffer_new();
+        }
+        else if (!gst_buffer_is_writable(m_shells[shell_idx]))
+        {
+            continue;
+        }
+
+        shell = m_shells[shell_idx];
+        m_next_shell = (shell_idx + 1) % NB_SHELLS;
+    }
+
+    bool recycled = (shell != nullptr);
+    if (!recycled)
+    {
+        // All shells are still in use downstream, fallback on a regular copy
+        // (capture time meta included)
+        shell = gst_buffer_copy(buffer);
+    }
+    else
+    {
+        // Memories are shared, not copied
+        gst_buffer_remove_all_memory(shell);
+        GST_BUFFER_FLAGS(shell) = 0;
+        auto copy_flags = static_cast<GstBufferCopyFlags>(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+                                                          GST_BUFFER_COPY_MEMORY);
+        gst_buffer_copy_into(shell, buffer, copy_flags, 0, static_cast<gsize>(-1));
+
+        // The meta of a recycled shell is updated in place
+        GstClockTime capture_time = get_capture_time(buffer);
+        if (GST_CLOCK_TIME_IS_VALID(capture_time))
+        {
+            set_capture_time(shell, capture_time);
+        }
+        else
+        {
+            remove_capture_time(shell);
+        }
+    }
+
+    if (hook != nullptr)
+    {
+        hook(shell);
+    }
+
+    // The pool keeps its own reference on recycled shells
+    return recycled ? gst_buffer_ref(shell) : shell;
+}
+
+void BufferShellPool::clear() noexcept
+{
+    for (GstBuffer*& shell : m_shells)
+    {
+        if (shell != nullptr)
+        {
+            gst_buffer_unref(shell);
+            shell = nullptr;
+        }
+    }
+
+    m_next_shell = 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Recycles GstBuffer shells sharing the memory of the buffers handed off to
+// a consumer pipeline, so that their metadata (timestamps, capture time SEI)
+// can be rewritten without allocating a new buffer for each frame.
+//
+// A pool is not thread-safe: it must only be used from a single streaming
+// thread at a time.
+class BufferShellPool final
+{
+  public:
+    BufferShellPool() = default;
+
+    BufferShellPool(BufferShellPool&&) = delete;
+    BufferShellPool& operator=(BufferShellPool&&) = delete;
+    BufferShellPool(const BufferShellPool&) = delete;
+    BufferShellPool& operator=(const BufferShellPool&) = delete;
+
+    ~BufferShellPool()
+    {
+        clear();
+    }
+
+    // Called on the shell while it is still writable
+    using ShellHook = bool (*)(GstBuffer* shell);
+
+    // Return a new reference to a buffer sharing the memory, the flags, the
+    // timestamps and the capture time of the given one.
+    GstBuffer* wrap(GstBuffer* buffer, ShellHook hook = nullptr) noexcept;
+    void clear() noexcept;
+
+  private:
+    static constexpr unsigned int NB_SHELLS = 16;
+
+    GstBuffer* m_shells[NB_SHELLS] = {nullptr};
+    unsigned int m_next_shell = 0;
+};
@@ -1,33 +1,138 @@
 #include "CameraManager.h"
 
-bool CameraManager::init(const char* port) noexcept
+#include "StartupTimeline.h"
+
+#include <future>
+#include <utility>
+
+bool CameraManager::init(const Configuration& configuration) noexcept
 {
-    if (!m_streaming_server.configure(port))
+    if (!validate_configuration(configuration))
+    {
+        g_printerr("Invalid configuration\n");
+        return false;
+    }
+
+    m_configuration = configuration;
+    m_nb_cameras = static_cast<unsigned int>(m_configuration.cameras.size());
+    m_encoding_pipelines = std::make_unique<EncodingPipeline[]>(m_nb_cameras);
+
+    // Encoded streams can be subscribed to before the pipelines are started
+    StreamingServer::StreamControllers stream_controllers;
+    for (unsigned int i = 0; i < m_nb_cameras; ++i)
+    {
+        m_encoding_pipelines[i].configure(m_configuration, i);
+        stream_controllers.push_back(&m_encoding_pipelines[i]);
+    }
+
+    if (!m_streaming_server.configure(m_configuration, stream_controllers, m_server_thread.context()))
     {
         g_printerr("Cannot configure streaming server\n");
         return false;
     }
+    mark_startup_milestone(StartupMilestone::SERVER_CONFIGURED);
+
+    if ((m_configuration.metrics_port != 0) && !m_metrics_server.start(m_configuration.metrics_port))
+    {
+        g_printerr("Cannot start metrics server\n");
+        return false;
+    }
+
+    if (!m_configuration.control_socket.empty() && !m_control_server.start(m_configuration.control_socket, *this))
+    {
+        g_printerr("Cannot start control server\n");
+        return false;
+    }
 
     return true;
 }
 
 bool CameraManager::run_and_wait() noexcept
 {
-    if (!m_stream_recorder.init())
+    // Sources of the subsystems are only dispatched from their own threads,
+    // which can hence be started first to bring the subsystems up in parallel
+    if (!m_server_thread.start("rtsp-server") || !m_recorder_thread.start("recorder") ||
+        !m_writer_thread.start("image-writer"))
+    {
+        shut();
+        g_printerr("Cannot start worker threads\n");
+        return false;
+    }
+
+    // The recorder and image writer pipelines are built from their threads
+    // while the encoding pipelines (the longest to start) are built from here.
+    // Buffers pushed to the recorder before it is ready are simply dropped.
+    std::future<bool> recorder_ready = m_recorder_thread.invoke_async([this]() {
+        bool ready =
+            m_stream_recorder.init(m_recorder_thread.context(), m_encoding_pipelines[0], m_configuration.recording);
+        if (ready)
+        {
+            mark_startup_milestone(StartupMilestone::RECORDER_READY);
+        }
+        return ready;
+    });
+    std::future<bool> writer_ready = m_writer_thread.invoke_async([this]() {
+        bool ready = m_img_writer.start(m_writer_thread.context());
+        if (ready)
+        {
+            mark_startup_milestone(StartupMilestone::IMAGE_WRITER_READY);
+        }
+        return ready;
+    });
+
+    EncodingPipeline::StreamConsumers raw_stream_consumers = {&m_stream_recorder.raw_stream_consumer()};
+    if (m_configuration.motion.enabled)
+    {
+        m_motion_detector.configure(m_configuration.motion, [this](bool motion) { on_motion(motion); });
+        raw_stream_consumers.push_back(&m_motion_detector);
+    }
+
+    bool exporter_started = true;
+    if (!m_configuration.frame_export.name.empty())
+    {
+        exporter_started = m_frame_exporter.start(m_configuration);
+        raw_stream_consumers.push_back(&m_frame_exporter);
+    }
+
+    bool pipeline_started =
+        exporter_started &&
+        m_encoding_pipelines[0].start(m_configuration, {&m_streaming_server, &m_stream_recorder}, raw_stream_consumers);
+    for (unsigned int i = 1; pipeline_started && (i < m_nb_cameras); ++i)
+    {
+        pipeline_started = m_encoding_pipelines[i].start(m_configuration, {&m_streaming_server}, {});
+    }
+
+    if (pipeline_started)
+    {
+        mark_startup_milestone(StartupMilestone::PIPELINE_STARTED);
+    }
+
+    // Both futures are waited for before shutting anything down
+    bool recorder_initialized = recorder_ready.get();
+    bool writer_started = writer_ready.get();
+
+    if (!recorder_initialized)
     {
         shut();
         g_printerr("Cannot initialize stream recorder\n");
         return false;
     }
 
-    if (!m_encoding_pipeline.start(m_streaming_server, m_stream_recorder))
+    if (!exporter_started)
+    {
+        shut();
+        g_printerr("Cannot start raw frame exporter\n");
+        return false;
+    }
+
+    if (!pipeline_started)
     {
         shut();
         g_printerr("Cannot start encoding pipeline\n");
         return false;
     }
 
-    if (!m_img_writer.start())
+    if (!writer_started)
     {
         shut();
         g_printerr("Cannot start image writer pipeline\n");
@@ -40,26 +145,56 @@ bool CameraManager::run_and_wait() noexcept
         g_printerr("Cannot start streaming server\n");
         return false;
     }
+    mark_startup_milestone(StartupMilestone::SERVER_STARTED);
 
+    // Until shut
+    m_loop = g_main_loop_new(nullptr, FALSE);
+    g_main_loop_run(m_loop);
     return true;
 }
 
 void CameraManager::shut() noexcept
 {
+    m_control_server.stop();
+    m_metrics_server.stop();
+
+    // Subsystems are shut from here once their threads are joined, so that
+    // none of their sources can be dispatched in the meantime
+    m_server_thread.stop();
+    m_recorder_thread.stop();
+    m_writer_thread.stop();
+
     m_streaming_server.stop();
     m_img_writer.stop();
-    m_encoding_pipeline.stop();
+    for (unsigned int i = 0; i < m_nb_cameras; ++i)
+    {
+        m_encoding_pipelines[i].stop();
+    }
+    m_frame_exporter.stop();
     m_stream_recorder.shut();
+
+    if (m_loop != nullptr)
+    {
+        g_main_loop_quit(m_loop);
+        g_main_loop_unref(m_loop);
+        m_loop = nullptr;
+    }
 }
 
-bool CameraManager::start_recording() noexcept
+bool CameraManager::start_recording(const RecordingOptions& options, RecordingCallback callback) noexcept
 {
-    return m_stream_recorder.start_recording();
+    // A request which cannot be issued is reported as failed
+    return m_recorder_thread.invoke([this, options, callback = std::move(callback)]() {
+        if (!m_stream_recorder.start_recording(options, callback) && callback)
+        {
+            callback(false, nullptr);
+        }
+    });
 }
 
-void CameraManager::stop_recording() noexcept
+void CameraManager::stop_recording(RecordingCallback callback) noexcept
 {
-    m_stream_recorder.stop_recording();
+    m_recorder_thread.invoke([this, callback = std::move(callback)]() { m_stream_recorder.stop_recording(callback); });
 }
 
 bool CameraManager::is_recording() const noexcept
@@ -67,7 +202,49 @@ bool CameraManager::is_recording() const noexcept
     return m_stream_recorder.is_recording();
 }
 
-bool CameraManager::take_screenshot() noexcept
+void CameraManager::on_motion(bool motion) noexcept
+{
+    // Recordings already running are left alone, only the one started on
+    // motion being stopped once it ends. It is forgotten when stopped by
+    // someone else, motion then starting a new one.
+    m_recorder_thread.invoke([this, motion]() {
+        if ((m_motion_recording_id != 0) &&
+            (!m_stream_recorder.is_recording() || (m_stream_recorder.get_recording_id() != m_motion_recording_id)))
+        {
+            m_motion_recording_id = 0;
+        }
+
+        if (motion && !m_stream_recorder.is_recording())
+        {
+            if (m_stream_recorder.start_recording())
+            {
+                m_motion_recording_id = m_stream_recorder.get_recording_id();
+            }
+        }
+        else if (!motion && (m_motion_recording_id != 0))
+        {
+            m_motion_recording_id = 0;
+            m_stream_recorder.stop_recording();
+        }
+    });
+}
+
+bool CameraManager::take_screenshot(ScreenshotCallback callback) noexcept
+{
+    return m_writer_thread.invoke([this, callback = std::move(callback)]() {
+        if (!m_img_writer.take_screenshot(m_encoding_pipelines[0], callback) && callback)
+        {
+            callback(false, nullptr);
+        }
+    });
+}
+
+bool CameraManager::take_jpeg(JpegCallback callback) noexcept
 {
-    return m_img_writer.take_screenshot(m_encoding_pipeline);
+    return m_writer_thread.invoke([this, callback = std::move(callback)]() {
+        if (!m_img_writer.take_jpeg(m_encoding_pipelines[0], callback) && callback)
+        {
+            callback(nullptr);
+        }
+    });
 }
@@ -1,10 +1,32 @@
 #pragma once
 
+#include "Configuration.h"
+#include "ControlServer.h"
 #include "EncodingPipeline.h"
+#include "FrameExporter.h"
 #include "ImageWriter.h"
+#include "MainContextThread.h"
+#include "MetricsServer.h"
+#include "MotionDetector.h"
 #include "StreamRecorder.h"
 #include "StreamingServer.h"
 
+#include <memory>
+
+// Each camera has its own encoding pipeline, whose streaming threads are
+// pinned to the CPUs of the camera, all of them being served by the same
+// RTSP server. Recordings and snapshots are taken from the first camera,
+// whose raw frames may also drive the recorder through a motion detector and
+// be exported to local processes.
+//
+// Each subsystem runs from its own context thread: the RTSP server (clients
+// being served by its thread pool), the recorder and the image writer, so
+// that slow recording or snapshot operations never delay the RTSP requests.
+// The default main context is left to the application signals.
+//
+// Recording and snapshot methods can be called from any thread, the
+// requests being forwarded to the context of their subsystem, from which
+// the callbacks are then called.
 class CameraManager final
 {
   public:
@@ -20,19 +42,34 @@ class CameraManager final
         shut();
     }
 
-    bool init(const char* port = nullptr) noexcept;
+    bool init(const Configuration& configuration = Configuration()) noexcept;
     bool run_and_wait() noexcept;
     void shut() noexcept;
 
-    bool start_recording() noexcept;
-    void stop_recording() noexcept;
+    bool start_recording(const RecordingOptions& options = RecordingOptions(),
+                         RecordingCallback callback = nullptr) noexcept;
+    void stop_recording(RecordingCallback callback = nullptr) noexcept;
     bool is_recording() const noexcept;
 
-    bool take_screenshot() noexcept;
+    bool take_screenshot(ScreenshotCallback callback = nullptr) noexcept;
+    bool take_jpeg(JpegCallback callback) noexcept;
 
   private:
+    void on_motion(bool motion) noexcept;
+
+    Configuration m_configuration;
+    GMainLoop* m_loop = nullptr;
+    MainContextThread m_server_thread;
+    MainContextThread m_recorder_thread;
+    MainContextThread m_writer_thread;
     StreamingServer m_streaming_server;
-    EncodingPipeline m_encoding_pipeline;
+    std::unique_ptr<EncodingPipeline[]> m_encoding_pipelines;
+    unsigned int m_nb_cameras = 0;
     StreamRecorder m_stream_recorder;
+    MotionDetector m_motion_detector;
+    FrameExporter m_frame_exporter;
+    unsigned int m_motion_recording_id = 0; // 0 when none, only used from the recorder context
     ImageWriter m_img_writer;
+    MetricsServer m_metrics_server;
+    ControlServer m_control_server;
 };
@@ -0,0 +1,241 @@
+#include "CaptureTimeMeta.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+constexpr guint8 NAL_TYPE_MASK = 0x1f;
+constexpr guint8 NAL_SLICE = 1;
+constexpr guint8 NAL_IDR_SLICE = 5;
+constexpr guint8 NAL_SEI = 6;
+constexpr guint8 SEI_USER_DATA_UNREGISTERED = 5;
+constexpr guint8 RBSP_STOP_BIT = 0x80;
+
+// Identifies the capture time SEI payload
+constexpr guint8 CAPTURE_TIME_UUID[16] = {0x7a, 0x3c, 0x51, 0x0e, 0x92, 0x4b, 0x4d, 0x1f,
+                                          0xa8, 0x36, 0x5e, 0xc2, 0x10, 0x9d, 0x6b, 0xf4};
+constexpr gsize CAPTURE_TIME_SIZE = 8;
+constexpr gsize SEI_PAYLOAD_SIZE = sizeof(CAPTURE_TIME_UUID) + CAPTURE_TIME_SIZE;
+
+gboolean capture_time_meta_init(GstMeta* meta, gpointer /*params*/, GstBuffer* /*buffer*/)
+{
+    reinterpret_cast<CaptureTimeMeta*>(meta)->capture_time = GST_CLOCK_TIME_NONE;
+    return TRUE;
+}
+
+gboolean capture_time_meta_transform(GstBuffer* dest, GstMeta* meta, GstBuffer* /*buffer*/, GQuark /*type*/,
+                                     gpointer /*data*/)
+{
+    // Copied as is whatever the transformation, the frame capture time
+    // doesn't change
+    set_capture_time(dest, reinterpret_cast<CaptureTimeMeta*>(meta)->capture_time);
+    return TRUE;
+}
+
+// Start code search in an H.264 byte-stream
+gsize find_start_code(const guint8* data, gsize size, gsize pos)
+{
+    for (; pos + 3 <= size; ++pos)
+    {
+        if ((data[pos] == 0) && (data[pos + 1] == 0) && (data[pos + 2] == 1))
+        {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+// Offset of the start code of the first slice, size if there is none
+gsize find_first_slice(const guint8* data, gsize size)
+{
+    gsize start = find_start_code(data, size, 0);
+    while (start < size)
+    {
+        gsize nal = start + 3;
+        if (nal < size)
+        {
+            guint8 nal_type = data[nal] & NAL_TYPE_MASK;
+            if ((nal_type == NAL_SLICE) || (nal_type == NAL_IDR_SLICE))
+            {
+                // Include the leading zero of a 4 bytes start code
+                return ((start > 0) && (data[start - 1] == 0)) ? start - 1 : start;
+            }
+        }
+        start = find_start_code(data, size, nal);
+    }
+
+    return size;
+}
+} // namespace
+
+GType capture_time_meta_api_get_type() noexcept
+{
+    static GType type = 0;
+    static const gchar* tags[] = {nullptr};
+
+    if (g_once_init_enter(&type))
+    {
+        GType api_type = gst_meta_api_type_register("CaptureTimeMetaAPI", tags);
+        g_once_init_leave(&type, api_type);
+    }
+
+    return type;
+}
+
+const GstMetaInfo* capture_time_meta_get_info() noexcept
+{
+    static const GstMetaInfo* meta_info = nullptr;
+
+    if (g_once_init_enter(&meta_info))
+    {
+        const GstMetaInfo* info =
+            gst_meta_register(capture_time_meta_api_get_type(), "CaptureTimeMeta", sizeof(CaptureTimeMeta),
+                              capture_time_meta_init, nullptr, capture_time_meta_transform);
+        g_once_init_leave(&meta_info, info);
+    }
+
+    return meta_info;
+}
+
+void set_capture_time(GstBuffer* buffer, GstClockTime capture_time) noexcept
+{
+    assert(buffer != nullptr);
+
+    auto* meta = reinterpret_cast<CaptureTimeMeta*>(gst_buffer_get_meta(buffer, capture_time_meta_api_get_type()));
+    if (meta == nullptr)
+    {
+        meta = reinterpret_cast<CaptureTimeMeta*>(gst_buffer_add_meta(buffer, capture_time_meta_get_info(), nullptr));
+    }
+
+    if (meta != nullptr)
+    {
+        meta->capture_time = capture_time;
+    }
+}
+
+void remove_capture_time(GstBuffer* buffer) noexcept
+{
+    assert(buffer != nullptr);
+
+    GstMeta* meta = gst_buffer_get_meta(buffer, capture_time_meta_api_get_type());
+    if (meta != nullptr)
+    {
+        gst_buffer_remove_meta(buffer, meta);
+    }
+}
+
+GstClockTime get_capture_time(GstBuffer* buffer) noexcept
+{
+    assert(buffer != nullptr);
+
+    auto* meta = reinterpret_cast<CaptureTimeMeta*>(gst_buffer_get_meta(buffer, capture_time_meta_api_get_type()));
+    return (meta != nullptr) ? meta->capture_time : GST_CLOCK_TIME_NONE;
+}
+
+GstClockTime get_capture_latency(GstBuffer* buffer) noexcept
+{
+    GstClockTime capture_time = get_capture_time(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(capture_time))
+    {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    GstClockTime now = gst_util_get_timestamp();
+    return (now > capture_time) ? now - capture_time : 0;
+}
+
+GstMemory* create_capture_time_sei(GstClockTime capture_time) noexcept
+{
+    // Capture time converted from the monotonic clock to the wall clock
+    GstClockTime age = gst_util_get_timestamp() - capture_time;
+    return create_wall_clock_time_sei(static_cast<guint64>(g_get_real_time()) - GST_TIME_AS_USECONDS(age));
+}
+
+GstMemory* create_wall_clock_time_sei(guint64 wall_clock_time) noexcept
+{
+    guint8 payload[SEI_PAYLOAD_SIZE]; // NOLINT
+    std::memcpy(payload, CAPTURE_TIME_UUID, sizeof(CAPTURE_TIME_UUID));
+    for (gsize i = 0; i < CAPTURE_TIME_SIZE; ++i)
+    {
+        gsize shift = 8 * (CAPTURE_TIME_SIZE - 1 - i);
+        payload[sizeof(CAPTURE_TIME_UUID) + i] = static_cast<guint8>(wall_clock_time >> shift);
+    }
+
+    // Start code, NAL header, payload type and size, escaped payload (at
+    // most one emulation prevention byte every 2 bytes) and stop bit
+    guint8 nal[4 + 1 + 2 + (SEI_PAYLOAD_SIZE * 3 / 2) + 1]; // NOLINT
+    gsize size = 0;
+    nal[size++] = 0;
+    nal[size++] = 0;
+    nal[size++] = 0;
+    nal[size++] = 1;
+    nal[size++] = NAL_SEI;
+    nal[size++] = SEI_USER_DATA_UNREGISTERED;
+    nal[size++] = static_cast<guint8>(SEI_PAYLOAD_SIZE);
+
+    unsigned int nb_zeros = 0;
+    for (guint8 byte : payload)
+    {
+        if ((nb_zeros == 2) && (byte <= 3))
+        {
+            nal[size++] = 3;
+            nb_zeros = 0;
+        }
+        nal[size++] = byte;
+        nb_zeros = (byte == 0) ? nb_zeros + 1 : 0;
+    }
+    nal[size++] = RBSP_STOP_BIT;
+
+    gpointer data = g_memdup2(nal, size);
+    return gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, data, size, 0, size, data, g_free);
+}
+
+bool insert_capture_time_sei(GstBuffer* buffer) noexcept
+{
+    assert(buffer != nullptr);
+    assert(gst_buffer_is_writable(buffer));
+
+    GstClockTime capture_time = get_capture_time(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(capture_time))
+    {
+        return false;
+    }
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        return false;
+    }
+    gsize offset = find_first_slice(map.data, map.size);
+    gsize size = map.size;
+    gst_buffer_unmap(buffer, &map);
+
+    if (offset >= size)
+    {
+        return false;
+    }
+
+    // Split the memory holding the first slice around the SEI, memories
+    // being shared and not copied
+    guint memory_idx = 0;
+    guint length = 0;
+    gsize skip = 0;
+    if (!gst_buffer_find_memory(buffer, offset, 1, &memory_idx, &length, &skip))
+    {
+        return false;
+    }
+
+    GstMemory* memory = gst_buffer_get_memory(buffer, memory_idx);
+    gst_buffer_remove_memory(buffer, memory_idx);
+    gst_buffer_insert_memory(buffer, static_cast<gint>(memory_idx), gst_memory_share(memory, skip, -1));
+    gst_buffer_insert_memory(buffer, static_cast<gint>(memory_idx), create_capture_time_sei(capture_time));
+    if (skip > 0)
+    {
+        gst_buffer_insert_memory(buffer, static_cast<gint>(memory_idx), gst_memory_share(memory, 0, skip));
+    }
+    gst_memory_unref(memory);
+
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Capture time of a raw frame, attached right after the camera source and
+// carried along by every branch: the meta API has no tag, so that converters,
+// scalers, encoders, parsers and payloaders copy it to their output buffers.
+// Times come from gst_util_get_timestamp() (monotonic clock) to be comparable
+// across pipelines, whose running times and timestamps differ.
+struct CaptureTimeMeta
+{
+    GstMeta meta;
+    GstClockTime capture_time;
+};
+
+GType capture_time_meta_api_get_type() noexcept;
+const GstMetaInfo* capture_time_meta_get_info() noexcept;
+
+// Update the meta in place when the buffer already has one, so that recycled
+// buffers don't allocate a new meta for each frame. The buffer must be
+// writable.
+void set_capture_time(GstBuffer* buffer, GstClockTime capture_time) noexcept;
+void remove_capture_time(GstBuffer* buffer) noexcept;
+GstClockTime get_capture_time(GstBuffer* buffer) noexcept;
+
+// Time elapsed since the capture, GST_CLOCK_TIME_NONE without capture time
+GstClockTime get_capture_latency(GstBuffer* buffer) noexcept;
+
+// Byte-stream H.264 SEI NAL unit (user data unregistered) carrying the wall
+// clock capture time, in microseconds since the Epoch as a big-endian 64-bit
+// integer, so that clients can measure the end-to-end latency.
+GstMemory* create_capture_time_sei(GstClockTime capture_time) noexcept;
+// Same SEI for a capture time already converted to the wall clock
+GstMemory* create_wall_clock_time_sei(guint64 wall_clock_time) noexcept;
+// Insert the SEI before the first slice of a writable byte-stream H.264
+// access unit
+bool insert_capture_time_sei(GstBuffer* buffer) noexcept;
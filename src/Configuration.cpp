@@ -0,0 +1,363 @@
+#include "Configuration.h"
+
+#include <cassert>
+#include <glib.h>
+
+namespace
+{
+constexpr char SERVER_GROUP[] = "server";
+constexpr char CONTROL_GROUP[] = "control";
+constexpr char METRICS_GROUP[] = "metrics";
+constexpr char LATENCY_GROUP[] = "latency";
+constexpr char CAPTURE_GROUP[] = "capture";
+constexpr char EXPORT_GROUP[] = "export";
+constexpr char MOTION_GROUP[] = "motion";
+constexpr char RECORDING_GROUP[] = "recording";
+constexpr char MULTICAST_GROUP[] = "multicast";
+constexpr unsigned int MAX_PORT = 65535;
+constexpr unsigned int MAX_TTL = 255;
+constexpr unsigned int MAX_SERVER_THREADS = 64;
+constexpr unsigned int MAX_CPUS = 1024; // CPU_SETSIZE
+constexpr unsigned int MAX_PIXEL_THRESHOLD = 254;
+constexpr unsigned int MAX_PERMILLE = 1000;
+// Within the 2 MiB and 512 access units of the pre-recording ring for the
+// default first rendition
+constexpr unsigned int MAX_PRE_RECORD_IN_SECONDS = 10;
+// A slot is being written while the others can be read
+constexpr unsigned int MIN_EXPORT_SLOTS = 2;
+constexpr unsigned int MAX_EXPORT_SLOTS = 64;
+// NAME_MAX, less the leading slash
+constexpr size_t MAX_EXPORT_NAME_SIZE = 254;
+// Size of sun_path, including the terminating null byte
+constexpr size_t MAX_SOCKET_PATH_SIZE = 108;
+// H.264 profiles of the encoder caps, the only rendition string spliced into
+// the pipeline description
+constexpr const char* H264_PROFILES[] = {"constrained-baseline", "baseline", "main", "high", "multiview-high",
+                                         "stereo-high"};
+
+bool is_h264_profile(const std::string& profile)
+{
+    for (const char* h264_profile : H264_PROFILES)
+    {
+        if (profile == h264_profile)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned int get_uint(GKeyFile* key_file, const char* group, const char* key, unsigned int default_value)
+{
+    GError* error = nullptr;
+    gint value = g_key_file_get_integer(key_file, group, key, &error);
+    if (error != nullptr)
+    {
+        g_error_free(error);
+        return default_value;
+    }
+
+    if (value < 0)
+    {
+        g_printerr("WARNING: ignoring negative value for [%s] %s\n", group, key);
+        return default_value;
+    }
+
+    return static_cast<unsigned int>(value);
+}
+
+bool get_bool(GKeyFile* key_file, const char* group, const char* key, bool default_value)
+{
+    GError* error = nullptr;
+    gboolean value = g_key_file_get_boolean(key_file, group, key, &error);
+    if (error != nullptr)
+    {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return (value != FALSE);
+}
+
+std::vector<unsigned int> get_uint_list(GKeyFile* key_file, const char* group, const char* key,
+                                        const std::vector<unsigned int>& default_value)
+{
+    gsize length = 0;
+    GError* error = nullptr;
+    gint* values = g_key_file_get_integer_list(key_file, group, key, &length, &error);
+    if (error != nullptr)
+    {
+        g_error_free(error);
+        return default_value;
+    }
+
+    std::vector<unsigned int> result;
+    for (gsize i = 0; i < length; ++i)
+    {
+        if (values[i] < 0)
+        {
+            g_printerr("WARNING: ignoring negative value for [%s] %s\n", group, key);
+            g_free(values);
+            return default_value;
+        }
+        result.push_back(static_cast<unsigned int>(values[i]));
+    }
+
+    g_free(values);
+    return result;
+}
+
+std::string get_string(GKeyFile* key_file, const char* group, const char* key, const std::string& default_value)
+{
+    gchar* value = g_key_file_get_string(key_file, group, key, nullptr);
+    if (value == nullptr)
+    {
+        return default_value;
+    }
+
+    std::string result(g_strstrip(value));
+    g_free(value);
+    return result;
+}
+} // namespace
+
+bool load_configuration(const char* filename, Configuration& configuration) noexcept
+{
+    assert(filename != nullptr);
+
+    GKeyFile* key_file = g_key_file_new();
+    GError* error = nullptr;
+    if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, &error))
+    {
+        g_printerr("ERROR: cannot load configuration file %s (%s)\n", filename, error->message);
+        g_error_free(error);
+        g_key_file_free(key_file);
+        return false;
+    }
+
+    configuration.port = get_string(key_file, SERVER_GROUP, "port", configuration.port);
+    configuration.server_threads = get_uint(key_file, SERVER_GROUP, "threads", configuration.server_threads);
+    configuration.control_socket = get_string(key_file, CONTROL_GROUP, "socket", configuration.control_socket);
+    configuration.metrics_port = get_uint(key_file, METRICS_GROUP, "port", configuration.metrics_port);
+    configuration.capture_time_sei = get_bool(key_file, LATENCY_GROUP, "sei", configuration.capture_time_sei);
+
+    CaptureConfiguration& capture = configuration.capture;
+    capture.width = get_uint(key_file, CAPTURE_GROUP, "width", capture.width);
+    capture.height = get_uint(key_file, CAPTURE_GROUP, "height", capture.height);
+    capture.framerate = get_uint(key_file, CAPTURE_GROUP, "framerate", capture.framerate);
+
+    ExportConfiguration& frame_export = configuration.frame_export;
+    frame_export.name = get_string(key_file, EXPORT_GROUP, "name", frame_export.name);
+    frame_export.slots = get_uint(key_file, EXPORT_GROUP, "slots", frame_export.slots);
+
+    MotionConfiguration& motion = configuration.motion;
+    motion.enabled = get_bool(key_file, MOTION_GROUP, "enabled", motion.enabled);
+    motion.pixel_threshold = get_uint(key_file, MOTION_GROUP, "pixel-threshold", motion.pixel_threshold);
+    motion.start_permille = get_uint(key_file, MOTION_GROUP, "start-permille", motion.start_permille);
+    motion.stop_permille = get_uint(key_file, MOTION_GROUP, "stop-permille", motion.stop_permille);
+    motion.start_frames = get_uint(key_file, MOTION_GROUP, "start-frames", motion.start_frames);
+    motion.post_roll = get_uint(key_file, MOTION_GROUP, "post-roll", motion.post_roll);
+
+    RecordingConfiguration& recording = configuration.recording;
+    recording.pre_record = get_uint(key_file, RECORDING_GROUP, "pre-record", recording.pre_record);
+
+    MulticastConfiguration& multicast = configuration.multicast;
+    multicast.address_min = get_string(key_file, MULTICAST_GROUP, "address-min", multicast.address_min);
+    multicast.address_max = get_string(key_file, MULTICAST_GROUP, "address-max", multicast.address_max);
+    multicast.port_min = get_uint(key_file, MULTICAST_GROUP, "port-min", multicast.port_min);
+    multicast.port_max = get_uint(key_file, MULTICAST_GROUP, "port-max", multicast.port_max);
+    multicast.ttl = get_uint(key_file, MULTICAST_GROUP, "ttl", multicast.ttl);
+
+    // The default camera is replaced as soon as one camera is defined
+    std::vector<CameraConfiguration> cameras;
+    char group[24]; // until "rendition4294967295", just in case // NOLINT
+    for (unsigned int i = 0;; ++i)
+    {
+        g_snprintf(group, sizeof(group), "camera%u", i);
+        if (!g_key_file_has_group(key_file, group))
+        {
+            break;
+        }
+
+        CameraConfiguration camera;
+        camera.source = get_string(key_file, group, "source", camera.source);
+        camera.device = get_string(key_file, group, "device", camera.device);
+        camera.cpus = get_uint_list(key_file, group, "cpus", camera.cpus);
+        cameras.push_back(camera);
+    }
+
+    if (!cameras.empty())
+    {
+        configuration.cameras = cameras;
+    }
+
+    // The default ladder is replaced as soon as one rendition is defined
+    std::vector<RenditionConfiguration> renditions;
+    for (unsigned int i = 0;; ++i)
+    {
+        g_snprintf(group, sizeof(group), "rendition%u", i);
+        if (!g_key_file_has_group(key_file, group))
+        {
+            break;
+        }
+
+        RenditionConfiguration rendition;
+        rendition.width = get_uint(key_file, group, "width", rendition.width);
+        rendition.height = get_uint(key_file, group, "height", rendition.height);
+        rendition.framerate = get_uint(key_file, group, "framerate", rendition.framerate);
+        rendition.bitrate = get_uint(key_file, group, "bitrate", rendition.bitrate);
+        rendition.quality_level = get_uint(key_file, group, "quality-level", rendition.quality_level);
+        rendition.profile = get_string(key_file, group, "profile", rendition.profile);
+        rendition.multicast = get_bool(key_file, group, "multicast", rendition.multicast);
+        rendition.bitrate_min = get_uint(key_file, group, "bitrate-min", rendition.bitrate_min);
+        rendition.bitrate_max = get_uint(key_file, group, "bitrate-max", rendition.bitrate_max);
+        rendition.queue_size = get_uint(key_file, group, "queue-size", rendition.queue_size);
+        rendition.queue_duration = get_uint(key_file, group, "queue-duration", rendition.queue_duration);
+        renditions.push_back(rendition);
+    }
+
+    if (!renditions.empty())
+    {
+        configuration.renditions = renditions;
+    }
+
+    g_key_file_free(key_file);
+    return validate_configuration(configuration);
+}
+
+bool validate_configuration(const Configuration& configuration) noexcept
+{
+    const CaptureConfiguration& capture = configuration.capture;
+    if ((capture.width == 0) || (capture.height == 0) || (capture.framerate == 0))
+    {
+        g_printerr("ERROR: invalid capture configuration\n");
+        return false;
+    }
+
+    if (configuration.cameras.empty())
+    {
+        g_printerr("ERROR: at least one camera must be configured\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < configuration.cameras.size(); ++i)
+    {
+        const CameraConfiguration& camera = configuration.cameras[i];
+        if ((camera.source != "v4l2") && (camera.source != "test"))
+        {
+            g_printerr("ERROR: invalid camera #%zu source\n", i);
+            return false;
+        }
+
+        for (unsigned int cpu : camera.cpus)
+        {
+            if (cpu >= MAX_CPUS)
+            {
+                g_printerr("ERROR: invalid camera #%zu cpus\n", i);
+                return false;
+            }
+        }
+    }
+
+    const ExportConfiguration& frame_export = configuration.frame_export;
+    if ((frame_export.name.size() > MAX_EXPORT_NAME_SIZE) || (frame_export.name.find('/') != std::string::npos) ||
+        (frame_export.slots < MIN_EXPORT_SLOTS) || (frame_export.slots > MAX_EXPORT_SLOTS))
+    {
+        g_printerr("ERROR: invalid export configuration\n");
+        return false;
+    }
+
+    // The stop ratio must not exceed the start one for the hysteresis
+    const MotionConfiguration& motion = configuration.motion;
+    if ((motion.pixel_threshold > MAX_PIXEL_THRESHOLD) || (motion.start_permille == 0) ||
+        (motion.start_permille > MAX_PERMILLE) || (motion.stop_permille > motion.start_permille) ||
+        (motion.start_frames == 0))
+    {
+        g_printerr("ERROR: invalid motion configuration\n");
+        return false;
+    }
+
+    if (configuration.recording.pre_record > MAX_PRE_RECORD_IN_SECONDS)
+    {
+        g_printerr("ERROR: invalid recording configuration\n");
+        return false;
+    }
+
+    if (configuration.server_threads > MAX_SERVER_THREADS)
+    {
+        g_printerr("ERROR: invalid number of server threads\n");
+        return false;
+    }
+
+    if (configuration.control_socket.size() >= MAX_SOCKET_PATH_SIZE)
+    {
+        g_printerr("ERROR: control socket path too long\n");
+        return false;
+    }
+
+    if (configuration.metrics_port > MAX_PORT)
+    {
+        g_printerr("ERROR: invalid metrics port\n");
+        return false;
+    }
+
+    // RTP and RTCP use a pair of ports per multicast stream
+    const MulticastConfiguration& multicast = configuration.multicast;
+    if (multicast.address_min.empty() || multicast.address_max.empty() || (multicast.port_min == 0) ||
+        (multicast.port_min + 1 > multicast.port_max) || (multicast.port_max > MAX_PORT) || (multicast.ttl == 0) ||
+        (multicast.ttl > MAX_TTL))
+    {
+        g_printerr("ERROR: invalid multicast configuration\n");
+        return false;
+    }
+
+    if (configuration.renditions.empty())
+    {
+        g_printerr("ERROR: at least one rendition must be configured\n");
+        return false;
+    }
+
+    // Each rendition is scaled from the previous one (from the capture for
+    // the first rendition)
+    unsigned int max_width = capture.width;
+    unsigned int max_height = capture.height;
+    unsigned int max_framerate = capture.framerate;
+    for (size_t i = 0; i < configuration.renditions.size(); ++i)
+    {
+        const RenditionConfiguration& rendition = configuration.renditions[i];
+        if ((rendition.width == 0) || (rendition.height == 0) || (rendition.framerate == 0) ||
+            (rendition.bitrate == 0) || (rendition.queue_size == 0) || (rendition.queue_duration == 0))
+        {
+            g_printerr("ERROR: invalid rendition #%zu configuration\n", i);
+            return false;
+        }
+
+        if (!is_h264_profile(rendition.profile))
+        {
+            g_printerr("ERROR: invalid rendition #%zu profile\n", i);
+            return false;
+        }
+
+        // Both bounds are needed, the configured bitrate being the initial one
+        if (((rendition.bitrate_min != 0) || (rendition.bitrate_max != 0)) &&
+            ((rendition.bitrate_min == 0) || (rendition.bitrate_min > rendition.bitrate) ||
+             (rendition.bitrate > rendition.bitrate_max)))
+        {
+            g_printerr("ERROR: invalid rendition #%zu bitrate bounds\n", i);
+            return false;
+        }
+
+        if ((rendition.width > max_width) || (rendition.height > max_height) || (rendition.framerate > max_framerate))
+        {
+            g_printerr("ERROR: rendition #%zu must not be larger or faster than the previous one\n", i);
+            return false;
+        }
+
+        max_width = rendition.width;
+        max_height = rendition.height;
+        max_framerate = rendition.framerate;
+    }
+
+    return true;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Application configuration, optionally loaded from a key file:
+//
+//   [server]
+//   port=8554
+//   threads=2
+//
+//   [control]
+//   socket=rtspcam.sock
+//
+//   [metrics]
+//   port=9464
+//
+//   [latency]
+//   sei=false
+//
+//   [capture]
+//   width=640
+//   height=480
+//   framerate=30
+//
+//   [camera0]
+//   source=v4l2
+//   device=/dev/video0
+//   cpus=0;1
+//
+//   [camera1]
+//   ...
+//
+//   [export]
+//   name=rtspcam-frames
+//   slots=4
+//
+//   [motion]
+//   enabled=false
+//   pixel-threshold=24
+//   start-permille=20
+//   stop-permille=10
+//   start-frames=3
+//   post-roll=10
+//
+//   [recording]
+//   pre-record=5
+//
+//   [multicast]
+//   address-min=224.3.0.1
+//   address-max=224.3.0.10
+//   port-min=5000
+//   port-max=5019
+//   ttl=16
+//
+//   [rendition0]
+//   width=640
+//   height=480
+//   framerate=30
+//   bitrate=1024
+//   bitrate-min=256
+//   bitrate-max=2048
+//   quality-level=6
+//   profile=main
+//   multicast=false
+//   queue-size=512
+//   queue-duration=1000
+//
+//   [rendition1]
+//   ...
+//
+// Cameras are numbered from 0 without gap, each of them being captured with
+// the [capture] parameters by its own encoding pipeline, from a V4L2 device
+// (/dev/videoN by default) or from a test pattern (source=test). The
+// streaming threads of a camera pipeline are pinned to its cpus, the online
+// CPUs being shared out between the cameras when not set.
+//
+// Renditions are numbered from 0 without gap and the ladder is produced for
+// each camera, rendition M of camera N being served on the /camN/videoM mount
+// (and on /videoM for the first camera). They must be sorted by decreasing
+// size and frame rate, as each rendition is scaled from the previous one.
+//
+// Recordings and snapshots are taken from the first camera.
+//
+// With an export name set, the raw frames of the first camera are written to
+// the POSIX shared memory object of this name, as a ring of slots (see
+// FrameRing.h), for local readers (disabled by default).
+//
+// With motion enabled, a recording of the first camera is started once the
+// luma of at least start-permille of its sampled pixels changes by more than
+// pixel-threshold between frames, for start-frames frames in a row. It is
+// stopped once less than stop-permille of them change for post-roll seconds.
+//
+// Recordings of the first rendition of the first camera begin with the last
+// pre-record seconds preceding the request, kept in memory. This rendition is
+// then encoded all along, hence only while watched or recorded once disabled
+// (pre-record=0).
+//
+// RTSP clients are served by a pool of up to [server] threads threads, the
+// server context serving them itself when set to 0.
+//
+// Control requests are served on the Unix domain socket at the given path
+// (relative to the working directory), disabled when empty.
+//
+// Metrics are served at http://127.0.0.1:<port>/metrics when a metrics port
+// is set (disabled by default).
+//
+// With latency sei set, the capture time of each frame is embedded in the
+// served H.264 streams as a user data unregistered SEI message.
+//
+// When bitrate bounds are set, the encoder bitrate of a rendition follows
+// the loss and jitter reported by the RTCP receivers of its mount, within
+// these bounds (disabled by default).
+//
+// Each media of a mount queues at most queue-size KiB and queue-duration ms
+// of its rendition for a slow client or network. Once over budget, the
+// frames of a media are dropped until the next keyframe that fits.
+//
+// Mounts of multicast renditions offer RTP multicast from the [multicast]
+// address pool, unicast UDP and TCP remaining available as fallbacks for
+// clients that cannot join the group.
+
+struct CaptureConfiguration
+{
+    unsigned int width = 640;
+    unsigned int height = 480;
+    unsigned int framerate = 30;
+};
+
+struct CameraConfiguration
+{
+    std::string source = "v4l2"; // "v4l2" or "test"
+    std::string device;          // /dev/videoN when empty
+    std::vector<unsigned int> cpus;
+};
+
+struct ExportConfiguration
+{
+    std::string name;
+    unsigned int slots = 4;
+};
+
+struct MotionConfiguration
+{
+    bool enabled = false;
+    unsigned int pixel_threshold = 24;
+    unsigned int start_permille = 20;
+    unsigned int stop_permille = 10;
+    unsigned int start_frames = 3;
+    unsigned int post_roll = 10; // in seconds
+};
+
+struct RecordingConfiguration
+{
+    unsigned int pre_record = 5; // in seconds, 0 when disabled
+};
+
+struct MulticastConfiguration
+{
+    std::string address_min = "224.3.0.1";
+    std::string address_max = "224.3.0.10";
+    unsigned int port_min = 5000;
+    unsigned int port_max = 5019;
+    unsigned int ttl = 16;
+};
+
+struct RenditionConfiguration
+{
+    unsigned int width = 640;
+    unsigned int height = 480;
+    unsigned int framerate = 30;
+    unsigned int bitrate = 1024; // in kbit/s
+    unsigned int quality_level = 6;
+    std::string profile = "main"; // H.264 profile, e.g. constrained-baseline, main or high
+    bool multicast = false;
+    // Bounds of the adaptive bitrate, in kbit/s (0 when not adaptive)
+    unsigned int bitrate_min = 0;
+    unsigned int bitrate_max = 0;
+    // Budget of the queue of each media of the mount
+    unsigned int queue_size = 512;      // in KiB
+    unsigned int queue_duration = 1000; // in ms
+};
+
+struct Configuration
+{
+    std::string port;
+    unsigned int server_threads = 2;
+    std::string control_socket = "rtspcam.sock";
+    unsigned int metrics_port = 0;
+    bool capture_time_sei = false;
+    CaptureConfiguration capture;
+    std::vector<CameraConfiguration> cameras = {CameraConfiguration()};
+    ExportConfiguration frame_export;
+    MotionConfiguration motion;
+    RecordingConfiguration recording;
+    MulticastConfiguration multicast;
+    std::vector<RenditionConfiguration> renditions = {{640, 480, 30, 1024, 6, "main", false},
+                                                      {320, 240, 30, 512, 7, "main", false}};
+};
+
+bool load_configuration(const char* filename, Configuration& configuration) noexcept;
+bool validate_configuration(const Configuration& configuration) noexcept;
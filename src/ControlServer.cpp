@@ -0,0 +1,507 @@
+#include "ControlServer.h"
+
+#include "CameraManager.h"
+
+#include <cassert>
+#include <cstring>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+namespace
+{
+constexpr gsize READ_SIZE = 4096;
+// Longer requests are malformed, their client is disconnected
+constexpr gsize MAX_REQUEST_SIZE = 1024;
+
+// Next space separated token of a request line
+std::string next_token(const std::string& line, size_t& pos)
+{
+    size_t start = line.find_first_not_of(' ', pos);
+    if (start == std::string::npos)
+    {
+        pos = line.size();
+        return std::string();
+    }
+
+    size_t end = line.find(' ', start);
+    if (end == std::string::npos)
+    {
+        end = line.size();
+    }
+    pos = end;
+    return line.substr(start, end - start);
+}
+} // namespace
+
+ControlServer::Client::~Client()
+{
+    if (input_source != nullptr)
+    {
+        g_source_destroy(input_source);
+        g_source_unref(input_source);
+    }
+    if (output_source != nullptr)
+    {
+        g_source_destroy(output_source);
+        g_source_unref(output_source);
+    }
+    if (connection != nullptr)
+    {
+        g_io_stream_close(G_IO_STREAM(connection), nullptr, nullptr);
+        g_object_unref(connection);
+    }
+    if (input != nullptr)
+    {
+        g_string_free(input, TRUE);
+    }
+    if (output != nullptr)
+    {
+        g_string_free(output, TRUE);
+    }
+}
+
+gboolean ControlServer::on_incoming(GSocketService* service, GSocketConnection* connection, GObject* /*source_object*/,
+                                    ControlServer* control_server) noexcept
+{
+    assert(service != nullptr);
+    assert(connection != nullptr);
+    assert(control_server != nullptr);
+
+    auto client = std::make_unique<Client>();
+    client->server = control_server;
+    client->id = control_server->m_next_client_id++;
+    client->connection = G_SOCKET_CONNECTION(g_object_ref(connection));
+    client->input = g_string_new(nullptr);
+    client->output = g_string_new(nullptr);
+
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    client->input_source = g_pollable_input_stream_create_source(G_POLLABLE_INPUT_STREAM(input), nullptr);
+    g_source_set_callback(client->input_source, G_SOURCE_FUNC(on_readable), client.get(), nullptr);
+    g_source_attach(client->input_source, control_server->m_thread.context());
+
+    control_server->m_clients.emplace(client->id, std::move(client));
+    return TRUE;
+}
+
+gboolean ControlServer::on_readable(GObject* stream, Client* client) noexcept
+{
+    assert(stream != nullptr);
+    assert(client != nullptr);
+
+    ControlServer* control_server = client->server;
+    char data[READ_SIZE]; // NOLINT
+    GError* error = nullptr;
+    gssize read =
+        g_pollable_input_stream_read_nonblocking(G_POLLABLE_INPUT_STREAM(stream), data, sizeof(data), nullptr, &error);
+    if (read < 0)
+    {
+        bool would_block = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+        g_error_free(error);
+        if (would_block)
+        {
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    if ((read <= 0) || !control_server->parse_requests(*client, data, static_cast<gsize>(read)))
+    {
+        // Also destroys this source
+        control_server->close_client(client->id);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean ControlServer::on_writable(GObject* stream, Client* client) noexcept
+{
+    assert(stream != nullptr);
+    assert(client != nullptr);
+
+    ControlServer* control_server = client->server;
+    if (!control_server->flush(*client))
+    {
+        control_server->close_client(client->id);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (client->output->len > 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_source_unref(client->output_source);
+    client->output_source = nullptr;
+    return G_SOURCE_REMOVE;
+}
+
+gboolean ControlServer::on_flush(ControlServer* control_server) noexcept
+{
+    assert(control_server != nullptr);
+
+    g_source_unref(control_server->m_flush_source);
+    control_server->m_flush_source = nullptr;
+
+    // Clients already waiting to be writable are flushed from their source
+    std::vector<guint64> failed_clients;
+    for (auto& entry : control_server->m_clients)
+    {
+        Client& client = *entry.second;
+        if ((client.output->len > 0) && (client.output_source == nullptr) && !control_server->flush(client))
+        {
+            failed_clients.push_back(client.id);
+        }
+    }
+
+    for (guint64 client_id : failed_clients)
+    {
+        control_server->close_client(client_id);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+gboolean ControlServer::on_reply(Reply* reply) noexcept
+{
+    assert(reply != nullptr);
+    assert(reply->server != nullptr);
+
+    // The client may have left in the meantime
+    auto client = reply->server->m_clients.find(reply->client_id);
+    if (client != reply->server->m_clients.end())
+    {
+        reply->server->queue_reply(*client->second, reply->line, reply->receive_time);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void ControlServer::delete_reply(Reply* reply) noexcept
+{
+    delete reply;
+}
+
+bool ControlServer::parse_requests(Client& client, const char* data, gsize size) noexcept
+{
+    g_string_append_len(client.input, data, static_cast<gssize>(size));
+
+    GstClockTime receive_time = gst_util_get_timestamp();
+    gsize start = 0;
+    for (;;)
+    {
+        const char* line_start = client.input->str + start;
+        const auto* line_end = static_cast<const char*>(std::memchr(line_start, '\n', client.input->len - start));
+        if (line_end == nullptr)
+        {
+            break;
+        }
+        start = static_cast<gsize>(line_end - client.input->str) + 1;
+
+        std::string line(line_start, line_end);
+        if (!line.empty() && (line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+
+        Request request;
+        size_t pos = 0;
+        request.id = next_token(line, pos);
+        request.command = next_token(line, pos);
+        request.argument = next_token(line, pos);
+        request.receive_time = receive_time;
+        if (request.id.empty())
+        {
+            continue;
+        }
+
+        m_requests.add();
+        execute(client, request);
+    }
+    g_string_erase(client.input, 0, static_cast<gssize>(start));
+
+    if (client.input->len > MAX_REQUEST_SIZE)
+    {
+        g_printerr("WARNING: control request too long, closing connection\n");
+        return false;
+    }
+
+    return true;
+}
+
+void ControlServer::queue_reply(Client& client, const std::string& line, GstClockTime receive_time) noexcept
+{
+    g_string_append_len(client.output, line.data(), static_cast<gssize>(line.size()));
+    g_string_append_c(client.output, '\n');
+    client.queued_size += line.size() + 1;
+    client.pending_replies.push_back({client.queued_size, receive_time});
+
+    // Replies queued during the same main context iteration are written
+    // together on the next one
+    if (m_flush_source == nullptr)
+    {
+        m_flush_source = g_idle_source_new();
+        g_source_set_priority(m_flush_source, G_PRIORITY_DEFAULT);
+        g_source_set_callback(m_flush_source, reinterpret_cast<GSourceFunc>(on_flush), this, nullptr);
+        g_source_attach(m_flush_source, m_thread.context());
+    }
+}
+
+bool ControlServer::flush(Client& client) noexcept
+{
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(client.connection));
+    while (client.output->len > 0)
+    {
+        GError* error = nullptr;
+        gssize written = g_pollable_output_stream_write_nonblocking(
+            G_POLLABLE_OUTPUT_STREAM(output), client.output->str, client.output->len, nullptr, &error);
+        if (written < 0)
+        {
+            bool would_block = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+            g_error_free(error);
+            if (!would_block)
+            {
+                return false;
+            }
+
+            // The remaining replies are written once the client reads
+            if (client.output_source == nullptr)
+            {
+                client.output_source =
+                    g_pollable_output_stream_create_source(G_POLLABLE_OUTPUT_STREAM(output), nullptr);
+                g_source_set_callback(client.output_source, G_SOURCE_FUNC(on_writable), &client, nullptr);
+                g_source_attach(client.output_source, m_thread.context());
+            }
+            return true;
+        }
+
+        g_string_erase(client.output, 0, written);
+        client.written_size += static_cast<guint64>(written);
+
+        GstClockTime now = gst_util_get_timestamp();
+        while (!client.pending_replies.empty() && (client.pending_replies.front().end <= client.written_size))
+        {
+            m_latency.observe(now - client.pending_replies.front().receive_time);
+            client.pending_replies.pop_front();
+        }
+    }
+
+    return true;
+}
+
+void ControlServer::close_client(guint64 client_id) noexcept
+{
+    m_clients.erase(client_id);
+}
+
+void ControlServer::execute(Client& client, const Request& request) noexcept
+{
+    assert(m_manager != nullptr);
+
+    // Commands completing at once are answered right away, the others from
+    // the completion callbacks
+    const guint64 client_id = client.id;
+    auto reply = [this, &client, &request](bool success, const char* detail) {
+        if (!success)
+        {
+            m_failed_requests.add();
+        }
+        std::string line = request.id + (success ? " ok" : " error");
+        if (detail != nullptr)
+        {
+            line += ' ';
+            line += detail;
+        }
+        queue_reply(client, line, request.receive_time);
+    };
+
+    if (request.command.empty())
+    {
+        reply(false, "missing command");
+    }
+    else if (request.command == "ping")
+    {
+        reply(true, nullptr);
+    }
+    else if (request.command == "screenshot")
+    {
+        bool issued = m_manager->take_screenshot([this, client_id, request](bool success, const char* filename) {
+            post_reply(client_id, request, success, success ? filename : "screenshot failed");
+        });
+        if (!issued)
+        {
+            reply(false, "screenshot not available");
+        }
+    }
+    else if (request.command == "record-start")
+    {
+        RecordingOptions options;
+        if (request.argument == "reencode")
+        {
+            options.mode = RecordingMode::REENCODE;
+        }
+        else if (!request.argument.empty() && (request.argument != "passthrough"))
+        {
+            reply(false, "unknown recording mode");
+            return;
+        }
+
+        auto callback = [this, client_id, request](bool success, const char* filename) {
+            post_reply(client_id, request, success, success ? filename : "recording failed");
+        };
+        bool issued = m_manager->start_recording(options, callback);
+        if (!issued)
+        {
+            reply(false, "recording not available");
+        }
+    }
+    else if (request.command == "record-stop")
+    {
+        // Always completed, without filename when there was nothing to stop
+        m_manager->stop_recording([this, client_id, request](bool success, const char* filename) {
+            if (filename == nullptr)
+            {
+                post_reply(client_id, request, false, "not recording");
+                return;
+            }
+
+            post_reply(client_id, request, success, success ? filename : "recording failed");
+        });
+    }
+    else if (request.command == "status")
+    {
+        reply(true, m_manager->is_recording() ? "recording" : "idle");
+    }
+    else
+    {
+        reply(false, "unknown command");
+    }
+}
+
+void ControlServer::post_reply(guint64 client_id, const Request& request, bool success, const char* detail) noexcept
+{
+    // Completions may come after the server is stopped
+    std::lock_guard<std::mutex> guard(m_reply_mutex);
+    if (!m_accepting_replies)
+    {
+        return;
+    }
+
+    if (!success)
+    {
+        m_failed_requests.add();
+    }
+
+    auto* reply = new Reply();
+    reply->server = this;
+    reply->client_id = client_id;
+    reply->line = request.id + (success ? " ok" : " error");
+    if ((detail != nullptr) && (*detail != 0))
+    {
+        reply->line += ' ';
+        reply->line += detail;
+    }
+    reply->receive_time = request.receive_time;
+    g_main_context_invoke_full(m_thread.context(), G_PRIORITY_DEFAULT, reinterpret_cast<GSourceFunc>(on_reply), reply,
+                               reinterpret_cast<GDestroyNotify>(delete_reply));
+}
+
+bool ControlServer::start(const std::string& path, CameraManager& manager) noexcept
+{
+    if (m_service != nullptr)
+    {
+        return true;
+    }
+
+    assert(!path.empty());
+
+    // A socket left by a previous run would prevent binding
+    g_unlink(path.c_str());
+
+    // The listener accepts from the thread default context at the time the
+    // address is added, hence from the control context (not iterated yet)
+    GMainContext* context = m_thread.context();
+    g_main_context_push_thread_default(context);
+    GSocketService* service = g_socket_service_new();
+    GSocketAddress* address = g_unix_socket_address_new(path.c_str());
+    GError* error = nullptr;
+    gboolean added = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM,
+                                                   G_SOCKET_PROTOCOL_DEFAULT, nullptr, nullptr, &error);
+    g_object_unref(address);
+    if (!added)
+    {
+        g_printerr("ERROR: cannot listen for control requests on %s (%s)\n", path.c_str(), error->message);
+        g_error_free(error);
+        g_object_unref(service);
+        g_main_context_pop_thread_default(context);
+        return false;
+    }
+
+    if (g_signal_connect(service, "incoming", reinterpret_cast<GCallback>(ControlServer::on_incoming), this) == 0)
+    {
+        g_printerr("ERROR: cannot connect signal to control service\n");
+        g_socket_listener_close(G_SOCKET_LISTENER(service));
+        g_object_unref(service);
+        g_main_context_pop_thread_default(context);
+        return false;
+    }
+
+    g_socket_service_start(service);
+    g_main_context_pop_thread_default(context);
+
+    m_manager = &manager;
+    m_path = path;
+    m_service = service;
+    {
+        std::lock_guard<std::mutex> guard(m_reply_mutex);
+        m_accepting_replies = true;
+    }
+
+    if (!m_thread.start("control"))
+    {
+        stop();
+        return false;
+    }
+
+    m_requests.publish("rtspcam_control_requests_total", "Requests received on the control socket");
+    m_failed_requests.publish("rtspcam_control_failed_requests_total", "Control requests answered by an error");
+    m_latency.publish("rtspcam_control_latency_seconds",
+                      "Delay between the reception of a request and the write of its reply");
+
+    g_print("Control requests served on %s\n", path.c_str());
+    return true;
+}
+
+void ControlServer::stop() noexcept
+{
+    if (m_service == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_reply_mutex);
+        m_accepting_replies = false;
+    }
+    m_thread.stop();
+
+    // The context is not iterated anymore, the replies already posted to it
+    // will find no client
+    GMainContext* context = m_thread.context();
+    g_main_context_push_thread_default(context);
+    m_clients.clear();
+    if (m_flush_source != nullptr)
+    {
+        g_source_destroy(m_flush_source);
+        g_source_unref(m_flush_source);
+        m_flush_source = nullptr;
+    }
+    g_socket_service_stop(m_service);
+    g_socket_listener_close(G_SOCKET_LISTENER(m_service));
+    g_object_unref(m_service);
+    m_service = nullptr;
+    g_main_context_pop_thread_default(context);
+
+    m_manager = nullptr;
+    g_unlink(m_path.c_str());
+    g_print("Control server stopped\n");
+}
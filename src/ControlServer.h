@@ -0,0 +1,130 @@
+#pragma once
+
+#include "MainContextThread.h"
+#include "Metrics.h"
+
+#include <deque>
+#include <gio/gio.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class CameraManager;
+
+// Local control plane on a Unix domain socket, with a line based protocol:
+//
+//   <id> ping
+//   <id> screenshot
+//   <id> record-start [reencode]
+//   <id> record-stop
+//   <id> status
+//
+// Each request is answered by "<id> ok [<detail>]" or "<id> error <reason>",
+// the id being chosen by the client. Requests can be pipelined without
+// waiting for the replies, which come as soon as each command completes and
+// hence possibly out of order.
+//
+// Sockets are served by a dedicated context thread, from which the commands
+// are issued to the camera manager (which forwards them to the context of
+// their subsystem). Completions are posted back to the control thread, the
+// replies being coalesced into as few writes as possible.
+class ControlServer final
+{
+  public:
+    ControlServer() = default;
+
+    ControlServer(ControlServer&&) = delete;
+    ControlServer& operator=(ControlServer&&) = delete;
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    ~ControlServer()
+    {
+        stop();
+    }
+
+    bool start(const std::string& path, CameraManager& manager) noexcept;
+    void stop() noexcept;
+
+  private:
+    // Reply waiting in the output of its client, the round trip being
+    // observed once its last byte is written
+    struct PendingReply
+    {
+        guint64 end = 0; // Offset in the whole output of the client
+        GstClockTime receive_time = GST_CLOCK_TIME_NONE;
+    };
+
+    struct Client
+    {
+        Client() = default;
+        Client(Client&&) = delete;
+        Client& operator=(Client&&) = delete;
+        Client(const Client&) = delete;
+        Client& operator=(const Client&) = delete;
+        ~Client();
+
+        ControlServer* server = nullptr;
+        guint64 id = 0;
+        GSocketConnection* connection = nullptr;
+        GSource* input_source = nullptr;
+        GSource* output_source = nullptr;
+        GString* input = nullptr;
+        GString* output = nullptr;
+        std::deque<PendingReply> pending_replies;
+        guint64 queued_size = 0;
+        guint64 written_size = 0;
+    };
+
+    struct Request
+    {
+        std::string id;
+        std::string command;
+        std::string argument;
+        GstClockTime receive_time = GST_CLOCK_TIME_NONE;
+    };
+
+    struct Reply
+    {
+        ControlServer* server = nullptr;
+        guint64 client_id = 0;
+        std::string line;
+        GstClockTime receive_time = GST_CLOCK_TIME_NONE;
+    };
+
+    static gboolean on_incoming(GSocketService* service, GSocketConnection* connection, GObject* source_object,
+                                ControlServer* control_server) noexcept;
+    static gboolean on_readable(GObject* stream, Client* client) noexcept;
+    static gboolean on_writable(GObject* stream, Client* client) noexcept;
+    static gboolean on_flush(ControlServer* control_server) noexcept;
+    static gboolean on_reply(Reply* reply) noexcept;
+    static void delete_reply(Reply* reply) noexcept;
+
+    bool parse_requests(Client& client, const char* data, gsize size) noexcept;
+    void execute(Client& client, const Request& request) noexcept;
+    void queue_reply(Client& client, const std::string& line, GstClockTime receive_time) noexcept;
+    bool flush(Client& client) noexcept;
+    void close_client(guint64 client_id) noexcept;
+
+    // Called from the subsystem contexts on completion
+    void post_reply(guint64 client_id, const Request& request, bool success, const char* detail) noexcept;
+
+    CameraManager* m_manager = nullptr;
+    std::string m_path;
+    MainContextThread m_thread;
+    GSocketService* m_service = nullptr;
+
+    // Replies are dropped once stopped
+    std::mutex m_reply_mutex;
+    bool m_accepting_replies = false;
+
+    // Only used from the control thread
+    std::unordered_map<guint64, std::unique_ptr<Client>> m_clients;
+    guint64 m_next_client_id = 0;
+    GSource* m_flush_source = nullptr;
+
+    Counter m_requests;
+    Counter m_failed_requests;
+    Histogram m_latency;
+};
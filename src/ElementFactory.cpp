@@ -0,0 +1,60 @@
+#include "ElementFactory.h"
+
+#include <cassert>
+
+GstElement* make_element(const char* factory_name, const char* name,
+                         std::initializer_list<ElementProperty> properties) noexcept
+{
+    assert(factory_name != nullptr);
+
+    GstElement* element = gst_element_factory_make(factory_name, name);
+    if (element == nullptr)
+    {
+        g_printerr("ERROR: cannot create %s element (missing plugin?)\n", factory_name);
+        return nullptr;
+    }
+
+    for (const ElementProperty& property : properties)
+    {
+        gst_util_set_object_arg(G_OBJECT(element), property.first, property.second);
+    }
+
+    return element;
+}
+
+bool add_and_link(GstBin* bin, std::initializer_list<GstElement*> elements) noexcept
+{
+    assert(bin != nullptr);
+
+    bool complete = true;
+    for (GstElement* element : elements)
+    {
+        complete = complete && (element != nullptr);
+    }
+
+    if (!complete)
+    {
+        for (GstElement* element : elements)
+        {
+            if (element != nullptr)
+            {
+                gst_object_unref(gst_object_ref_sink(element));
+            }
+        }
+        return false;
+    }
+
+    GstElement* previous = nullptr;
+    for (GstElement* element : elements)
+    {
+        gst_bin_add(bin, element);
+        if ((previous != nullptr) && !gst_element_link(previous, element))
+        {
+            g_printerr("ERROR: cannot link %s to %s\n", GST_ELEMENT_NAME(previous), GST_ELEMENT_NAME(element));
+            return false;
+        }
+        previous = element;
+    }
+
+    return true;
+}
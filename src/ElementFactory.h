@@ -0,0 +1,19 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <initializer_list>
+#include <utility>
+
+// Fixed topology pipelines are built element by element rather than parsed
+// from a launch description. Properties are given in their serialized form,
+// as in a launch description (e.g. {"format", "time"}).
+using ElementProperty = std::pair<const char*, const char*>;
+
+// Floating reference, nullptr (reported) when the factory is missing
+GstElement* make_element(const char* factory_name, const char* name,
+                         std::initializer_list<ElementProperty> properties = {}) noexcept;
+
+// Adds the elements to the bin and links them in order. The elements are
+// released if one of them could not be created (nullptr), and owned by the
+// bin otherwise, even when linking fails.
+bool add_and_link(GstBin* bin, std::initializer_list<GstElement*> elements) noexcept;
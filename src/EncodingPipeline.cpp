@@ -1,27 +1,105 @@
 #include "EncodingPipeline.h"
 
+#include "CaptureTimeMeta.h"
+#include "StartupTimeline.h"
+
 #include <cassert>
+#include <gst/video/video.h>
+#include <pthread.h>
 
 namespace
 {
-constexpr unsigned int NB_STREAMS = 2;
-constexpr char STREAM_IDX_KEY[] = "stream-idx";
+// Data of an encoded stream probe, owned by the probe
+struct EncodedStreamProbeData
+{
+    unsigned int stream_idx;
+    EncodingPipeline::StreamConsumers consumers;
+    EncodingPipeline::StreamMetrics* metrics;
+    EncodingPipeline::StreamGate* gate;
+};
 
-GstPadProbeReturn encoded_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, IStreamConsumer* encoded_stream_consumer)
+GstPadProbeReturn capture_pad_probe(GstPad* pad, GstPadProbeInfo* info, gpointer /*user_data*/)
 {
     assert(pad != nullptr);
     assert(info != nullptr);
-    assert(encoded_stream_consumer != nullptr);
 
+    // Stamped when leaving the camera source, which is as close to the
+    // capture as the monotonic clock allows
     if (info->data != nullptr)
     {
-        auto stream_idx =
-            static_cast<unsigned int>(reinterpret_cast<guintptr>(g_object_get_data(G_OBJECT(pad), STREAM_IDX_KEY)));
-        assert(stream_idx < NB_STREAMS);
+        GstBuffer* buffer = gst_buffer_make_writable(GST_BUFFER(info->data));
+        set_capture_time(buffer, gst_util_get_timestamp());
+        info->data = buffer;
+        mark_startup_milestone(StartupMilestone::FIRST_FRAME_CAPTURED);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
 
+GstPadProbeReturn gate_pad_probe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, EncodingPipeline::StreamGate* gate)
+{
+    assert(gate != nullptr);
+
+    // Frames are dropped before the queue of the encoder, which then idles
+    return gate->open.load(std::memory_order_relaxed) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+// Called once the first keyframe of a stream is pushed to the consumers,
+// which then know its caps and parameter sets
+void prime_stream_gate(EncodingPipeline::StreamGate& gate, Gauge& active)
+{
+    std::lock_guard<std::mutex> guard(gate.mutex);
+    gate.primed.store(true);
+    gate.open.store(gate.subscribers > 0);
+    active.set((gate.subscribers > 0) ? 1 : 0);
+}
+
+void delete_encoded_stream_probe_data(gpointer data)
+{
+    delete static_cast<EncodedStreamProbeData*>(data);
+}
+
+// Data of the raw stream probe, owned by the probe
+struct RawStreamProbeData
+{
+    EncodingPipeline::StreamConsumers consumers;
+    Counter* captured_frames;
+};
+
+void delete_raw_stream_probe_data(gpointer data)
+{
+    delete static_cast<RawStreamProbeData*>(data);
+}
+
+GstPadProbeReturn encoded_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, EncodedStreamProbeData* data)
+{
+    assert(pad != nullptr);
+    assert(info != nullptr);
+    assert(data != nullptr);
+
+    if (info->data != nullptr)
+    {
         if ((info->type & GST_PAD_PROBE_TYPE_BUFFER) == GST_PAD_PROBE_TYPE_BUFFER)
         {
-            encoded_stream_consumer->push_buffer(stream_idx, GST_BUFFER(info->data));
+            GstBuffer* buffer = GST_BUFFER(info->data);
+            data->metrics->frames.add();
+            data->metrics->bytes.add(gst_buffer_get_size(buffer));
+            data->metrics->latency.observe(get_capture_latency(buffer));
+            mark_startup_milestone(StartupMilestone::FIRST_FRAME_ENCODED);
+            if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+            {
+                data->metrics->keyframes.add();
+            }
+
+            for (IStreamConsumer* consumer : data->consumers)
+            {
+                consumer->push_buffer(data->stream_idx, buffer);
+            }
+
+            if (!data->gate->primed.load(std::memory_order_relaxed))
+            {
+                prime_stream_gate(*data->gate, data->metrics->active);
+            }
         }
         else if ((info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) == GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
         {
@@ -32,7 +110,10 @@ GstPadProbeReturn encoded_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, I
                 gst_event_parse_caps(event, &caps);
                 if (caps != nullptr)
                 {
-                    encoded_stream_consumer->push_caps(stream_idx, caps);
+                    for (IStreamConsumer* consumer : data->consumers)
+                    {
+                        consumer->push_caps(data->stream_idx, caps);
+                    }
                 }
             }
         }
@@ -41,17 +122,21 @@ GstPadProbeReturn encoded_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, I
     return GST_PAD_PROBE_OK;
 }
 
-GstPadProbeReturn raw_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, IStreamConsumer* raw_stream_consumer)
+GstPadProbeReturn raw_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, RawStreamProbeData* data)
 {
     assert(pad != nullptr);
     assert(info != nullptr);
-    assert(raw_stream_consumer != nullptr);
+    assert(data != nullptr);
 
     if (info->data != nullptr)
     {
         if ((info->type & GST_PAD_PROBE_TYPE_BUFFER) == GST_PAD_PROBE_TYPE_BUFFER)
         {
-            raw_stream_consumer->push_buffer(0, GST_BUFFER(info->data));
+            data->captured_frames->add();
+            for (IStreamConsumer* consumer : data->consumers)
+            {
+                consumer->push_buffer(0, GST_BUFFER(info->data));
+            }
         }
         else if ((info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) == GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
         {
@@ -62,7 +147,10 @@ GstPadProbeReturn raw_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, IStre
                 gst_event_parse_caps(event, &caps);
                 if (caps != nullptr)
                 {
-                    raw_stream_consumer->push_caps(0, caps);
+                    for (IStreamConsumer* consumer : data->consumers)
+                    {
+                        consumer->push_caps(0, caps);
+                    }
                 }
             }
         }
@@ -72,19 +160,180 @@ GstPadProbeReturn raw_stream_pad_probe(GstPad* pad, GstPadProbeInfo* info, IStre
 }
 } // namespace
 
-bool EncodingPipeline::create_pipeline() noexcept
+gchar* EncodingPipeline::create_pipeline_description(const Configuration& configuration,
+                                                     unsigned int camera_idx) noexcept
+{
+    const CameraConfiguration& camera = configuration.cameras[camera_idx];
+    GString* desc = g_string_new(nullptr);
+    if (camera.source == "test")
+    {
+        g_string_append(desc, "videotestsrc name=capture is-live=true pattern=ball ! ");
+    }
+    else
+    {
+        // The device is set once parsed (see create_pipeline), its path
+        // being taken as is from the configuration
+        g_string_append(desc, "v4l2src name=capture ! ");
+    }
+
+    const CaptureConfiguration& capture = configuration.capture;
+    g_string_append_printf(desc,
+                           "video/x-raw,width=%u,height=%u,framerate=%u/1 ! videoconvert ! "
+                           "tee name=raw-img "
+                           "raw-img. ! queue silent=true ! fakesink name=frame-producer enable-last-sample=true "
+                           "sync=false ",
+                           capture.width, capture.height, capture.framerate);
+
+    // Each rendition is scaled and rate-converted from the previous one (from
+    // the raw frames for the first one), then encoded in its own branch.
+    // Sinks do not wait for the clock: frames are handed off by the probes as
+    // soon as they reach them, the consumers keeping their timestamps.
+    for (size_t i = 0; i < configuration.renditions.size(); ++i)
+    {
+        const RenditionConfiguration& rendition = configuration.renditions[i];
+        if (i == 0)
+        {
+            g_string_append(desc, "raw-img. ! ");
+        }
+        else
+        {
+            g_string_append_printf(desc, "scaled%zu. ! ", i - 1);
+        }
+
+        g_string_append_printf(desc,
+                               "queue silent=true ! videoscale ! videorate ! "
+                               "video/x-raw,width=%u,height=%u,framerate=%u/1 ! tee name=scaled%zu "
+                               "scaled%zu. ! queue name=gate%zu silent=true ! vaapih264enc name=encoder%zu "
+                               "bitrate=%u cabac=true keyframe-period=0 quality-level=%u rate-control=vbr ! "
+                               "video/x-h264,profile=%s,stream-format=byte-stream ! "
+                               "fakesink name=stream%zu enable-last-sample=false sync=false ",
+                               rendition.width, rendition.height, rendition.framerate, i, i, i, i, rendition.bitrate,
+                               rendition.quality_level, rendition.profile.c_str(), i);
+    }
+
+    return g_string_free(desc, FALSE);
+}
+
+GstBusSyncReply EncodingPipeline::on_bus_sync_message(GstBus* /*bus*/, GstMessage* message,
+                                                      EncodingPipeline* encoding_pipeline) noexcept
+{
+    assert(message != nullptr);
+    assert(encoding_pipeline != nullptr);
+
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+    {
+        return GST_BUS_PASS;
+    }
+
+    // Posted synchronously from the streaming thread entering its task
+    GstStreamStatusType type = GST_STREAM_STATUS_TYPE_CREATE;
+    GstElement* owner = nullptr;
+    gst_message_parse_stream_status(message, &type, &owner);
+    if ((type == GST_STREAM_STATUS_TYPE_ENTER) && (CPU_COUNT(&encoding_pipeline->m_cpus) > 0))
+    {
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &encoding_pipeline->m_cpus);
+        if (error != 0)
+        {
+            g_printerr("WARNING: cannot set CPU affinity of %s streaming thread (%s)\n",
+                       (owner != nullptr) ? GST_ELEMENT_NAME(owner) : "unknown", g_strerror(error));
+        }
+    }
+
+    return GST_BUS_DROP;
+}
+
+void EncodingPipeline::set_cpu_affinity(const Configuration& configuration, unsigned int camera_idx) noexcept
+{
+    CPU_ZERO(&m_cpus);
+
+    const CameraConfiguration& camera = configuration.cameras[camera_idx];
+    if (!camera.cpus.empty())
+    {
+        for (unsigned int cpu : camera.cpus)
+        {
+            CPU_SET(cpu, &m_cpus);
+        }
+        return;
+    }
+
+    cpu_set_t allowed_cpus;
+    CPU_ZERO(&allowed_cpus);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed_cpus) != 0)
+    {
+        g_printerr("WARNING: cannot get CPU affinity, camera #%u threads are not pinned\n", camera_idx);
+        return;
+    }
+
+    std::vector<unsigned int> cpus;
+    for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed_cpus))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    // The cameras interleave on the allowed CPUs, each of them getting its own
+    // CPUs unless there are more cameras than CPUs
+    const auto nb_cameras = static_cast<unsigned int>(configuration.cameras.size());
+    const auto nb_cpus = static_cast<unsigned int>(cpus.size());
+    for (unsigned int i = camera_idx % nb_cpus; i < nb_cpus; i += nb_cameras)
+    {
+        CPU_SET(cpus[i], &m_cpus);
+    }
+}
+
+bool EncodingPipeline::configure(const Configuration& configuration, unsigned int camera_idx) noexcept
+{
+    assert(camera_idx < configuration.cameras.size());
+
+    if (m_stream_gates != nullptr)
+    {
+        return false;
+    }
+
+    m_camera_idx = camera_idx;
+    m_nb_streams = static_cast<unsigned int>(configuration.renditions.size());
+    m_first_stream_idx = camera_idx * m_nb_streams;
+    set_cpu_affinity(configuration, camera_idx);
+
+    GstClock* clock = gst_system_clock_obtain();
+    m_base_time = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+
+    m_stream_gates = std::make_unique<StreamGate[]>(m_nb_streams);
+    m_stream_metrics = std::make_unique<StreamMetrics[]>(m_nb_streams);
+    for (unsigned int i = 0; i < m_nb_streams; ++i)
+    {
+        gchar* labels = g_strdup_printf("camera=\"%u\",stream=\"%u\"", camera_idx, i);
+        m_stream_metrics[i].frames.publish("rtspcam_encoded_frames_total", "Frames produced by the encoder", labels);
+        m_stream_metrics[i].keyframes.publish("rtspcam_encoded_keyframes_total", "Keyframes produced by the encoder",
+                                              labels);
+        m_stream_metrics[i].bytes.publish("rtspcam_encoded_bytes_total", "Bytes produced by the encoder", labels);
+        m_stream_metrics[i].latency.publish("rtspcam_encoding_latency_seconds",
+                                            "Delay between the capture and the encoder output", labels);
+        m_stream_metrics[i].bitrate.publish("rtspcam_encoder_bitrate_kbps", "Target bitrate of the encoder", labels);
+        m_stream_metrics[i].bitrate.set(configuration.renditions[i].bitrate);
+        m_stream_metrics[i].active.publish("rtspcam_encoder_active", "Whether the encoder is fed with frames",
+                                           labels);
+        g_free(labels);
+    }
+    gchar* labels = g_strdup_printf("camera=\"%u\"", camera_idx);
+    m_captured_frames.publish("rtspcam_captured_frames_total", "Raw frames reaching the frame producer", labels);
+    g_free(labels);
+
+    return true;
+}
+
+bool EncodingPipeline::create_pipeline(const Configuration& configuration) noexcept
 {
     assert(m_pipeline == nullptr);
+    assert(configuration.renditions.size() == m_nb_streams);
 
+    gchar* pipeline_desc = create_pipeline_description(configuration, m_camera_idx);
     GError* error = nullptr;
-    // clang-format off
-    GstElement* pipeline = gst_parse_launch(
-        "v4l2src ! video/x-raw,width=640,height=480,framerate=30/1 ! videoconvert ! tee name=raw-img "
-        "raw-img. ! queue silent=true ! fakesink name=frame-producer enable-last-sample=true sync=true "
-        "raw-img. ! queue silent=true ! videoscale ! vaapih264enc bitrate=1024 cabac=true keyframe-period=0 quality-level=6 rate-control=vbr ! video/x-h264,profile=main,stream-format=byte-stream ! fakesink name=stream0 enable-last-sample=false qos=true sync=true "
-        "raw-img. ! queue silent=true ! videoscale ! vaapih264enc bitrate=512 cabac=true keyframe-period=0 quality-level=7 rate-control=vbr ! video/x-h264,profile=main,stream-format=byte-stream,width=320,height=240 ! fakesink name=stream1 enable-last-sample=false qos=true sync=true",
-        &error);
-    // clang-format on
+    GstElement* pipeline = gst_parse_launch(pipeline_desc, &error);
+    g_free(pipeline_desc);
 
     if (pipeline == nullptr)
     {
@@ -108,17 +357,63 @@ bool EncodingPipeline::create_pipeline() noexcept
     }
 
     m_pipeline = GST_PIPELINE(gst_object_ref_sink(pipeline));
+
+    const CameraConfiguration& camera = configuration.cameras[m_camera_idx];
+    if (camera.source == "v4l2")
+    {
+        GstElement* capture = gst_bin_get_by_name(GST_BIN(m_pipeline), "capture");
+        assert(capture != nullptr);
+        gchar* device = camera.device.empty() ? g_strdup_printf("/dev/video%u", m_camera_idx)
+                                              : g_strdup(camera.device.c_str());
+        g_object_set(capture, "device", device, nullptr);
+        g_free(device);
+        gst_object_unref(capture);
+    }
+
+    // Without start time, the base time is not computed again when going to
+    // the PLAYING state
+    GstClock* clock = gst_system_clock_obtain();
+    gst_pipeline_use_clock(m_pipeline, clock);
+    gst_object_unref(clock);
+    gst_element_set_start_time(GST_ELEMENT(m_pipeline), GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(GST_ELEMENT(m_pipeline), m_base_time);
+
+    // Set before any streaming thread is started
+    GstBus* bus = gst_pipeline_get_bus(m_pipeline);
+    assert(bus != nullptr);
+    gst_bus_set_sync_handler(bus, reinterpret_cast<GstBusSyncHandler>(on_bus_sync_message), this, nullptr);
+    gst_object_unref(bus);
+
     return true;
 }
 
-bool EncodingPipeline::register_buffer_probes(IStreamConsumer& encoded_stream_consumer,
-                                              IStreamConsumer& raw_stream_consumer) noexcept
+bool EncodingPipeline::register_buffer_probes(const StreamConsumers& encoded_stream_consumers,
+                                              const StreamConsumers& raw_stream_consumers) noexcept
 {
     assert(m_pipeline != nullptr);
 
+    // Register capture time probe
+    GstElement* capture = gst_bin_get_by_name(GST_BIN(m_pipeline), "capture");
+    assert(capture != nullptr);
+    GstPad* capture_pad = gst_element_get_static_pad(capture, "src");
+    assert(capture_pad != nullptr);
+    gulong capture_probe_id = gst_pad_add_probe(capture_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                                                reinterpret_cast<GstPadProbeCallback>(capture_pad_probe), nullptr,
+                                                nullptr);
+    gst_object_unref(capture_pad);
+    gst_object_unref(capture);
+
+    if (capture_probe_id == 0)
+    {
+        g_printerr("ERROR: cannot register capture time probe\n");
+        gst_object_unref(m_pipeline);
+        m_pipeline = nullptr;
+        return false;
+    }
+
     // Register encoded streams pads probes
-    char buff[9]; // until "stream99", just in case // NOLINT
-    for (unsigned int i = 0; i < NB_STREAMS; ++i)
+    char buff[17]; // until "stream4294967295", just in case // NOLINT
+    for (unsigned int i = 0; i < m_nb_streams; ++i)
     {
         g_snprintf(buff, sizeof(buff), "stream%u", i);
 
@@ -127,11 +422,14 @@ bool EncodingPipeline::register_buffer_probes(IStreamConsumer& encoded_stream_co
 
         GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
         assert(sink_pad != nullptr);
-        g_object_set_data(G_OBJECT(sink_pad), STREAM_IDX_KEY, reinterpret_cast<gpointer>(static_cast<guintptr>(i)));
 
+        // Each probe owns its own copy of the consumers list, released with the probe
         gulong probe_id = gst_pad_add_probe(
             sink_pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
-            reinterpret_cast<GstPadProbeCallback>(encoded_stream_pad_probe), &encoded_stream_consumer, nullptr);
+            reinterpret_cast<GstPadProbeCallback>(encoded_stream_pad_probe),
+            new EncodedStreamProbeData{m_first_stream_idx + i, encoded_stream_consumers, &m_stream_metrics[i],
+                                       &m_stream_gates[i]},
+            delete_encoded_stream_probe_data);
 
         gst_object_unref(sink_pad);
         gst_object_unref(sink);
@@ -143,6 +441,29 @@ bool EncodingPipeline::register_buffer_probes(IStreamConsumer& encoded_stream_co
             m_pipeline = nullptr;
             return false;
         }
+
+        // The gate stands before the queue of the encoder, after the tee
+        // feeding the next rendition
+        g_snprintf(buff, sizeof(buff), "gate%u", i);
+        GstElement* gate = gst_bin_get_by_name(GST_BIN(m_pipeline), buff);
+        assert(gate != nullptr);
+
+        GstPad* gate_pad = gst_element_get_static_pad(gate, "sink");
+        assert(gate_pad != nullptr);
+        probe_id = gst_pad_add_probe(gate_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                                     reinterpret_cast<GstPadProbeCallback>(gate_pad_probe), &m_stream_gates[i],
+                                     nullptr);
+
+        gst_object_unref(gate_pad);
+        gst_object_unref(gate);
+
+        if (probe_id == 0)
+        {
+            g_printerr("ERROR: cannot register gate probe for encoded stream #%u\n", i);
+            gst_object_unref(m_pipeline);
+            m_pipeline = nullptr;
+            return false;
+        }
     }
 
     // Register raw stream pad probe
@@ -153,7 +474,8 @@ bool EncodingPipeline::register_buffer_probes(IStreamConsumer& encoded_stream_co
     assert(sink_pad != nullptr);
     gulong probe_id = gst_pad_add_probe(
         sink_pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
-        reinterpret_cast<GstPadProbeCallback>(raw_stream_pad_probe), &raw_stream_consumer, nullptr);
+        reinterpret_cast<GstPadProbeCallback>(raw_stream_pad_probe),
+        new RawStreamProbeData{raw_stream_consumers, &m_captured_frames}, delete_raw_stream_probe_data);
 
     gst_object_unref(sink_pad);
     gst_object_unref(sink);
@@ -169,20 +491,36 @@ bool EncodingPipeline::register_buffer_probes(IStreamConsumer& encoded_stream_co
     return true;
 }
 
-bool EncodingPipeline::start(IStreamConsumer& encoded_stream_consumer, IStreamConsumer& raw_stream_consumer) noexcept
+bool EncodingPipeline::start(const Configuration& configuration, const StreamConsumers& encoded_stream_consumers,
+                             const StreamConsumers& raw_stream_consumers) noexcept
 {
+    if (m_stream_gates == nullptr)
+    {
+        return false;
+    }
+
     if (m_pipeline != nullptr)
     {
         return true;
     }
 
-    if (!create_pipeline() || !register_buffer_probes(encoded_stream_consumer, raw_stream_consumer))
+    if (!create_pipeline(configuration) || !register_buffer_probes(encoded_stream_consumers, raw_stream_consumers))
     {
         return false;
     }
 
+    // Every encoder runs until its first keyframe, so that the caps of its
+    // stream are known by the consumers
+    for (unsigned int i = 0; i < m_nb_streams; ++i)
+    {
+        std::lock_guard<std::mutex> guard(m_stream_gates[i].mutex);
+        m_stream_gates[i].primed.store(false);
+        m_stream_gates[i].open.store(true);
+        m_stream_metrics[i].active.set(1);
+    }
+
     gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PLAYING);
-    g_print("Encoding pipeline started\n");
+    g_print("Encoding pipeline of camera #%u started\n", m_camera_idx);
     return true;
 }
 
@@ -193,7 +531,7 @@ void EncodingPipeline::stop() noexcept
         gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
         gst_object_unref(m_pipeline);
         m_pipeline = nullptr;
-        g_print("Encoding pipeline stopped\n");
+        g_print("Encoding pipeline of camera #%u stopped\n", m_camera_idx);
     }
 }
 
@@ -213,3 +551,102 @@ GstSample* EncodingPipeline::get_last_sample() const noexcept
 
     return last_sample;
 }
+
+bool EncodingPipeline::request_key_frame(unsigned int stream_idx) noexcept
+{
+    if ((m_pipeline == nullptr) || (stream_idx >= m_nb_streams))
+    {
+        return false;
+    }
+
+    char buff[17]; // until "stream4294967295", just in case // NOLINT
+    g_snprintf(buff, sizeof(buff), "stream%u", stream_idx);
+    GstElement* stream = gst_bin_get_by_name(GST_BIN(m_pipeline), buff);
+    assert(stream != nullptr);
+
+    // Sent upstream from the sink of the stream, the event reaches the
+    // encoder of this rendition only
+    GstEvent* event = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0);
+    gboolean sent = gst_element_send_event(stream, event);
+    gst_object_unref(stream);
+
+    return (sent != FALSE);
+}
+
+bool EncodingPipeline::set_bitrate(unsigned int stream_idx, unsigned int bitrate) noexcept
+{
+    if ((m_pipeline == nullptr) || (stream_idx >= m_nb_streams) || (bitrate == 0))
+    {
+        return false;
+    }
+
+    char buff[18]; // until "encoder4294967295", just in case // NOLINT
+    g_snprintf(buff, sizeof(buff), "encoder%u", stream_idx);
+    GstElement* encoder = gst_bin_get_by_name(GST_BIN(m_pipeline), buff);
+    assert(encoder != nullptr);
+
+    // The VBR target is mutable in the playing state, the encoder applying it
+    // from the next frame without a new keyframe
+    g_object_set(encoder, "bitrate", bitrate, nullptr);
+    gst_object_unref(encoder);
+    m_stream_metrics[stream_idx].bitrate.set(bitrate);
+
+    return true;
+}
+
+GstClockTime EncodingPipeline::get_base_time() const noexcept
+{
+    return m_base_time;
+}
+
+bool EncodingPipeline::subscribe(unsigned int stream_idx) noexcept
+{
+    if (stream_idx >= m_nb_streams)
+    {
+        return false;
+    }
+
+    StreamGate& gate = m_stream_gates[stream_idx];
+    std::lock_guard<std::mutex> guard(gate.mutex);
+    ++gate.subscribers;
+
+    // Until primed the encoder runs anyway (and its pipeline may still be
+    // built by another thread). The keyframe is requested before the gate is
+    // opened, so that a resumed encoder starts again with a keyframe.
+    if (!gate.primed.load())
+    {
+        return true;
+    }
+
+    request_key_frame(stream_idx);
+    if (gate.subscribers == 1)
+    {
+        gate.open.store(true);
+        m_stream_metrics[stream_idx].active.set(1);
+        g_print("Encoder #%u of camera #%u resumed\n", stream_idx, m_camera_idx);
+    }
+
+    return true;
+}
+
+void EncodingPipeline::unsubscribe(unsigned int stream_idx) noexcept
+{
+    if (stream_idx >= m_nb_streams)
+    {
+        return;
+    }
+
+    StreamGate& gate = m_stream_gates[stream_idx];
+    std::lock_guard<std::mutex> guard(gate.mutex);
+    if (gate.subscribers == 0)
+    {
+        return;
+    }
+
+    if ((--gate.subscribers == 0) && gate.primed.load())
+    {
+        gate.open.store(false);
+        m_stream_metrics[stream_idx].active.set(0);
+        g_print("Encoder #%u of camera #%u paused\n", stream_idx, m_camera_idx);
+    }
+}
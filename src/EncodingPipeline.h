@@ -1,15 +1,56 @@
 #pragma once
 
+#include "Configuration.h"
 #include "IFrameProducer.h"
 #include "IStreamConsumer.h"
+#include "IStreamController.h"
+#include "Metrics.h"
 
-class EncodingPipeline final : public IFrameProducer
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sched.h>
+#include <vector>
+
+// Capture and encoding pipeline of one camera, producing the whole rendition
+// ladder. Its encoded streams are pushed to the consumers with indexes
+// following the ones of the previous cameras (camera_idx * number of
+// renditions + rendition index), while the controller methods take the
+// rendition index.
+//
+// The frames of a rendition are dropped before its encoder while nobody
+// subscribes to its stream, so that idle cameras only pay for the capture
+// and the scaling.
+class EncodingPipeline final : public IFrameProducer, public IStreamController
 {
   public:
+    using StreamConsumers = std::vector<IStreamConsumer*>;
+
+    struct StreamMetrics
+    {
+        Counter frames;
+        Counter keyframes;
+        Counter bytes;
+        Histogram latency;
+        Gauge bitrate;
+        Gauge active;
+    };
+
+    // Opened while the stream has subscribers, or until its first keyframe.
+    // The state is only changed under the mutex, the streaming threads
+    // reading the flags without locking.
+    struct StreamGate
+    {
+        std::mutex mutex;
+        unsigned int subscribers = 0;
+        std::atomic<bool> primed{false};
+        std::atomic<bool> open{true};
+    };
+
     EncodingPipeline() = default;
-    EncodingPipeline(EncodingPipeline&&) = default;
-    EncodingPipeline& operator=(EncodingPipeline&&) = default;
 
+    EncodingPipeline(EncodingPipeline&&) = delete;
+    EncodingPipeline& operator=(EncodingPipeline&&) = delete;
     EncodingPipeline(const EncodingPipeline&) = delete;
     EncodingPipeline& operator=(const EncodingPipeline&) = delete;
 
@@ -18,15 +59,45 @@ class EncodingPipeline final : public IFrameProducer
         stop();
     }
 
-    bool start(IStreamConsumer& encoded_stream_consumer, IStreamConsumer& raw_stream_consumer) noexcept;
+    // Streams can be subscribed to once configured, even before the pipeline
+    // is started
+    bool configure(const Configuration& configuration, unsigned int camera_idx) noexcept;
+    bool start(const Configuration& configuration, const StreamConsumers& encoded_stream_consumers,
+               const StreamConsumers& raw_stream_consumers) noexcept;
     void stop() noexcept;
 
     GstSample* get_last_sample() const noexcept override;
+    bool request_key_frame(unsigned int stream_idx) noexcept override;
+    bool set_bitrate(unsigned int stream_idx, unsigned int bitrate) noexcept override;
+    bool subscribe(unsigned int stream_idx) noexcept override;
+    void unsubscribe(unsigned int stream_idx) noexcept override;
+    GstClockTime get_base_time() const noexcept override;
 
   private:
-    bool create_pipeline() noexcept;
-    bool register_buffer_probes(IStreamConsumer& encoded_stream_consumer,
-                                IStreamConsumer& raw_stream_consumer) noexcept;
+    static gchar* create_pipeline_description(const Configuration& configuration, unsigned int camera_idx) noexcept;
+    static GstBusSyncReply on_bus_sync_message(GstBus* bus, GstMessage* message,
+                                               EncodingPipeline* encoding_pipeline) noexcept;
+
+    bool create_pipeline(const Configuration& configuration) noexcept;
+    void set_cpu_affinity(const Configuration& configuration, unsigned int camera_idx) noexcept;
+    bool register_buffer_probes(const StreamConsumers& encoded_stream_consumers,
+                                const StreamConsumers& raw_stream_consumers) noexcept;
 
     GstPipeline* m_pipeline = nullptr;
+    unsigned int m_camera_idx = 0;
+    unsigned int m_nb_streams = 0;
+    unsigned int m_first_stream_idx = 0;
+
+    // Chosen once configured, so that it is known by the consumers before the
+    // pipeline is started and kept across its state changes
+    GstClockTime m_base_time = GST_CLOCK_TIME_NONE;
+
+    // Streaming threads are pinned to these CPUs as they enter the pipeline
+    // (not pinned when empty)
+    cpu_set_t m_cpus = {};
+
+    // Used from the probes, allocated once configured
+    std::unique_ptr<StreamMetrics[]> m_stream_metrics;
+    std::unique_ptr<StreamGate[]> m_stream_gates;
+    Counter m_captured_frames;
 };
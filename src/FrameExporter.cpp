@@ -0,0 +1,152 @@
+#include "FrameExporter.h"
+
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+// Up to 32 bits per pixel for the 8-bit raw formats
+constexpr size_t MAX_BYTES_PER_PIXEL = 4;
+} // namespace
+
+bool FrameExporter::start(const Configuration& configuration) noexcept
+{
+    if (m_header != nullptr)
+    {
+        return true;
+    }
+
+    const ExportConfiguration& frame_export = configuration.frame_export;
+    const CaptureConfiguration& capture = configuration.capture;
+    size_t slot_size = static_cast<size_t>(capture.width) * capture.height * MAX_BYTES_PER_PIXEL;
+    if (slot_size > UINT32_MAX)
+    {
+        g_printerr("ERROR: captured frames too large to be exported\n");
+        return false;
+    }
+
+    // A ring left by a previous process is replaced, its readers keeping
+    // their mapping until they reopen the new one
+    m_path = "/" + frame_export.name;
+    shm_unlink(m_path.c_str());
+    int fd = shm_open(m_path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (fd < 0)
+    {
+        g_printerr("ERROR: cannot create shared memory %s (%s)\n", m_path.c_str(), g_strerror(errno));
+        return false;
+    }
+
+    m_size = frame_ring_size(frame_export.slots, static_cast<uint32_t>(slot_size));
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(m_size)) == 0)
+    {
+        mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        g_printerr("ERROR: cannot map shared memory %s (%s)\n", m_path.c_str(), g_strerror(errno));
+        shm_unlink(m_path.c_str());
+        return false;
+    }
+
+    // Zero filled by ftruncate, the magic being set last
+    m_header = static_cast<FrameRingHeader*>(mapping);
+    m_header->version = FRAME_RING_VERSION;
+    m_header->nb_slots = frame_export.slots;
+    m_header->slot_size = static_cast<uint32_t>(slot_size);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = FRAME_RING_MAGIC;
+    m_last_frame = 0;
+
+    m_exported_frames.publish("rtspcam_export_frames_total", "Raw frames written to the shared memory ring");
+    m_oversized_frames.publish("rtspcam_export_oversized_frames_total", "Raw frames too large for a ring slot");
+    m_copy_duration.publish("rtspcam_export_copy_seconds", "Duration of the copy of a raw frame to its slot");
+
+    g_print("Raw frames exported to shared memory %s (%u slots of %zu bytes)\n", m_path.c_str(), frame_export.slots,
+            slot_size);
+    return true;
+}
+
+void FrameExporter::stop() noexcept
+{
+    if (m_header == nullptr)
+    {
+        return;
+    }
+
+    m_header->closed.store(1, std::memory_order_release);
+    munmap(m_header, m_size);
+    m_header = nullptr;
+    shm_unlink(m_path.c_str());
+}
+
+bool FrameExporter::push_caps(unsigned int /*stream_idx*/, GstCaps* caps) noexcept
+{
+    if ((m_header == nullptr) || (caps == nullptr))
+    {
+        return false;
+    }
+
+    gchar* caps_string = gst_caps_to_string(caps);
+    if (strlen(caps_string) >= FRAME_RING_CAPS_SIZE)
+    {
+        g_printerr("WARNING: raw caps too long to be exported\n");
+        g_free(caps_string);
+        return false;
+    }
+
+    uint32_t sequence = m_header->caps_sequence.load(std::memory_order_relaxed);
+    m_header->caps_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    g_strlcpy(m_header->caps, caps_string, FRAME_RING_CAPS_SIZE);
+    m_header->caps_sequence.store(sequence + 2, std::memory_order_release);
+
+    g_free(caps_string);
+    return true;
+}
+
+bool FrameExporter::push_buffer(unsigned int /*stream_idx*/, GstBuffer* buffer) noexcept
+{
+    if ((m_header == nullptr) || (buffer == nullptr))
+    {
+        return false;
+    }
+
+    GstClockTime start_time = gst_util_get_timestamp();
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        return false;
+    }
+
+    if (map.size > m_header->slot_size)
+    {
+        gst_buffer_unmap(buffer, &map);
+        m_oversized_frames.add();
+        return false;
+    }
+
+    // The odd sequence tells the readers that the slot is being written
+    uint64_t frame = ++m_last_frame;
+    FrameSlotHeader* slot = frame_ring_slot(m_header, frame);
+    slot->sequence.store(2 * frame - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->pts = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) : UINT64_MAX;
+    slot->size = static_cast<uint32_t>(map.size);
+    slot->caps_sequence = m_header->caps_sequence.load(std::memory_order_relaxed);
+    memcpy(frame_ring_slot_data(slot), map.data, map.size);
+    gst_buffer_unmap(buffer, &map);
+
+    slot->sequence.store(2 * frame, std::memory_order_release);
+    m_header->last_frame.store(frame, std::memory_order_release);
+
+    m_exported_frames.add();
+    m_copy_duration.observe(gst_util_get_timestamp() - start_time);
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Configuration.h"
+#include "FrameRing.h"
+#include "IStreamConsumer.h"
+#include "Metrics.h"
+
+#include <string>
+
+// Publishes the raw frames of a camera into a shared memory ring (see
+// FrameRing.h), so that local analytics processes can map them instead of
+// decoding an RTSP stream. Each frame is copied once into its slot, readers
+// then using it in place, and the exporter never waits for them.
+//
+// Caps and buffers are pushed from the same streaming thread.
+class FrameExporter final : public IStreamConsumer
+{
+  public:
+    FrameExporter() = default;
+
+    FrameExporter(FrameExporter&&) = delete;
+    FrameExporter& operator=(FrameExporter&&) = delete;
+    FrameExporter(const FrameExporter&) = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    ~FrameExporter() override
+    {
+        stop();
+    }
+
+    // Slots are sized for the largest frames of the capture configuration
+    bool start(const Configuration& configuration) noexcept;
+    void stop() noexcept;
+
+    bool push_caps(unsigned int stream_idx, GstCaps* caps) noexcept override;
+    bool push_buffer(unsigned int stream_idx, GstBuffer* buffer) noexcept override;
+
+  private:
+    std::string m_path;
+    FrameRingHeader* m_header = nullptr;
+    size_t m_size = 0;
+    uint64_t m_last_frame = 0;
+
+    Counter m_exported_frames;
+    Counter m_oversized_frames;
+    Histogram m_copy_duration;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Shared memory ring of raw frames, written by the camera process (see
+// FrameExporter.h) and mapped by local readers (see FrameRingReader.h).
+//
+// The POSIX shared memory object starts with a FrameRingHeader, followed by
+// nb_slots slots, each of them made of a FrameSlotHeader and of slot_size
+// bytes of frame data. Frame n (numbered from 1) is written to slot
+// n % nb_slots, the producer never waiting for the readers.
+//
+// Slots and caps are protected by sequence locks: their sequence is odd
+// while they are written. A slot holds frame n once its sequence is 2n, and
+// the data read in place from it is only valid if the sequence did not
+// change once done with it. Frames refer to their caps (a GStreamer caps
+// string in the header) by the caps sequence they were written with.
+
+constexpr uint32_t FRAME_RING_MAGIC = 0x52464352; // "RCFR"
+constexpr uint32_t FRAME_RING_VERSION = 1;
+constexpr size_t FRAME_RING_CAPS_SIZE = 1024;
+constexpr size_t FRAME_RING_ALIGNMENT = 64;
+
+struct alignas(FRAME_RING_ALIGNMENT) FrameRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nb_slots;
+    uint32_t slot_size;
+    // Number of the last written frame (0 until the first one)
+    std::atomic<uint64_t> last_frame;
+    // Set once the producer stopped, readers must then reopen the ring
+    std::atomic<uint32_t> closed;
+    std::atomic<uint32_t> caps_sequence;
+    char caps[FRAME_RING_CAPS_SIZE];
+};
+
+struct alignas(FRAME_RING_ALIGNMENT) FrameSlotHeader
+{
+    std::atomic<uint64_t> sequence;
+    uint64_t pts; // in nanoseconds, UINT64_MAX when unknown
+    uint32_t size;
+    uint32_t caps_sequence;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomics of the ring must be address-free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "atomics of the ring must be address-free");
+
+inline size_t frame_ring_slot_stride(uint32_t slot_size) noexcept
+{
+    size_t stride = sizeof(FrameSlotHeader) + slot_size;
+    return (stride + FRAME_RING_ALIGNMENT - 1) / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+}
+
+inline size_t frame_ring_size(uint32_t nb_slots, uint32_t slot_size) noexcept
+{
+    return sizeof(FrameRingHeader) + nb_slots * frame_ring_slot_stride(slot_size);
+}
+
+inline FrameSlotHeader* frame_ring_slot(FrameRingHeader* header, uint64_t frame) noexcept
+{
+    auto* slots = reinterpret_cast<uint8_t*>(header + 1);
+    return reinterpret_cast<FrameSlotHeader*>(slots + (frame % header->nb_slots) *
+                                                          frame_ring_slot_stride(header->slot_size));
+}
+
+inline const FrameSlotHeader* frame_ring_slot(const FrameRingHeader* header, uint64_t frame) noexcept
+{
+    return frame_ring_slot(const_cast<FrameRingHeader*>(header), frame); // NOLINT
+}
+
+inline uint8_t* frame_ring_slot_data(FrameSlotHeader* slot) noexcept
+{
+    return reinterpret_cast<uint8_t*>(slot + 1);
+}
+
+inline const uint8_t* frame_ring_slot_data(const FrameSlotHeader* slot) noexcept
+{
+    return reinterpret_cast<const uint8_t*>(slot + 1);
+}
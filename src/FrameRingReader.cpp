@@ -0,0 +1,161 @@
+#include "FrameRingReader.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool FrameRingReader::open(const char* name) noexcept
+{
+    if ((name == nullptr) || (m_header != nullptr))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    std::string path = std::string("/") + name;
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat status = {};
+    if ((fstat(fd, &status) != 0) || (static_cast<size_t>(status.st_size) < sizeof(FrameRingHeader)))
+    {
+        ::close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    auto size = static_cast<size_t>(status.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const auto* header = static_cast<const FrameRingHeader*>(mapping);
+    if ((header->magic != FRAME_RING_MAGIC) || (header->version != FRAME_RING_VERSION) || (header->nb_slots == 0) ||
+        (frame_ring_size(header->nb_slots, header->slot_size) > size))
+    {
+        munmap(mapping, size);
+        errno = EPROTO;
+        return false;
+    }
+
+    m_header = header;
+    m_size = size;
+    m_next_frame = header->last_frame.load(std::memory_order_acquire) + 1;
+    m_lost_frames = 0;
+    return true;
+}
+
+void FrameRingReader::close() noexcept
+{
+    if (m_header != nullptr)
+    {
+        munmap(const_cast<FrameRingHeader*>(m_header), m_size); // NOLINT
+        m_header = nullptr;
+        m_size = 0;
+    }
+}
+
+bool FrameRingReader::next_frame(Frame& frame) noexcept
+{
+    if (m_header == nullptr)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        uint64_t last_frame = m_header->last_frame.load(std::memory_order_acquire);
+        if (last_frame < m_next_frame)
+        {
+            return false;
+        }
+
+        // The slot of the oldest readable frame is the next one to be written
+        if (last_frame - m_next_frame >= m_header->nb_slots - 1)
+        {
+            uint64_t oldest_frame = last_frame - (m_header->nb_slots - 1) + 1;
+            if (oldest_frame > m_next_frame)
+            {
+                m_lost_frames += oldest_frame - m_next_frame;
+                m_next_frame = oldest_frame;
+            }
+        }
+
+        const FrameSlotHeader* slot = frame_ring_slot(m_header, m_next_frame);
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * m_next_frame)
+        {
+            // Overwritten in the meantime
+            ++m_lost_frames;
+            ++m_next_frame;
+            continue;
+        }
+
+        frame.number = m_next_frame;
+        frame.pts = slot->pts;
+        frame.data = frame_ring_slot_data(slot);
+        frame.size = slot->size;
+        frame.caps_sequence = slot->caps_sequence;
+        ++m_next_frame;
+
+        // The metadata above may have been torn too
+        if (!is_valid(frame) || (frame.size > m_header->slot_size))
+        {
+            ++m_lost_frames;
+            continue;
+        }
+
+        return true;
+    }
+}
+
+bool FrameRingReader::is_valid(const Frame& frame) const noexcept
+{
+    if ((m_header == nullptr) || (frame.number == 0))
+    {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame_ring_slot(m_header, frame.number)->sequence.load(std::memory_order_relaxed) == 2 * frame.number;
+}
+
+bool FrameRingReader::read_caps(uint32_t caps_sequence, std::string& caps) const noexcept
+{
+    if ((m_header == nullptr) || ((caps_sequence % 2) != 0) ||
+        (m_header->caps_sequence.load(std::memory_order_acquire) != caps_sequence))
+    {
+        return false;
+    }
+
+    // The string is always null-terminated by the producer, but a torn copy
+    // may not be
+    char copy[FRAME_RING_CAPS_SIZE];
+    for (size_t i = 0; i < FRAME_RING_CAPS_SIZE; ++i)
+    {
+        copy[i] = m_header->caps[i];
+    }
+    copy[FRAME_RING_CAPS_SIZE - 1] = 0;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_header->caps_sequence.load(std::memory_order_relaxed) != caps_sequence)
+    {
+        return false;
+    }
+
+    caps = copy;
+    return true;
+}
+
+bool FrameRingReader::is_closed() const noexcept
+{
+    return (m_header == nullptr) || (m_header->closed.load(std::memory_order_acquire) != 0);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "FrameRing.h"
+
+#include <string>
+
+// Reader of the raw frames exported by the camera process, without any
+// GStreamer dependency. Frames are read in place from the shared memory,
+// the producer possibly overwriting a frame while it is used: readers must
+// check that a frame is still valid once done with it, and have up to
+// nb_slots - 1 frame periods for that.
+//
+// The ring is polled, the readers being expected to do so at most at the
+// frame rate. Errors are reported through the return values (and errno for
+// open).
+class FrameRingReader final
+{
+  public:
+    struct Frame
+    {
+        uint64_t number = 0;
+        uint64_t pts = UINT64_MAX;
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        uint32_t caps_sequence = 0;
+    };
+
+    FrameRingReader() = default;
+
+    FrameRingReader(FrameRingReader&&) = delete;
+    FrameRingReader& operator=(FrameRingReader&&) = delete;
+    FrameRingReader(const FrameRingReader&) = delete;
+    FrameRingReader& operator=(const FrameRingReader&) = delete;
+
+    ~FrameRingReader()
+    {
+        close();
+    }
+
+    // Name of the shared memory object, as configured in [export] name
+    bool open(const char* name) noexcept;
+    void close() noexcept;
+
+    // Oldest frame not returned yet which can still be read, frames already
+    // overwritten being skipped (and counted as lost). False when there is no
+    // new frame.
+    bool next_frame(Frame& frame) noexcept;
+    bool is_valid(const Frame& frame) const noexcept;
+
+    // Caps of the frames written with the given caps sequence (false if the
+    // caps changed since)
+    bool read_caps(uint32_t caps_sequence, std::string& caps) const noexcept;
+
+    bool is_closed() const noexcept;
+
+    uint64_t lost_frames() const noexcept
+    {
+        return m_lost_frames;
+    }
+
+  private:
+    const FrameRingHeader* m_header = nullptr;
+    size_t m_size = 0;
+    uint64_t m_next_frame = 0;
+    uint64_t m_lost_frames = 0;
+};
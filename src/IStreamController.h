@@ -0,0 +1,33 @@
+#pragma once
+
+#include <gst/gst.h>
+
+class IStreamController
+{
+  public:
+    IStreamController() = default;
+    IStreamController(const IStreamController&) = default;
+    IStreamController(IStreamController&&) = default;
+    IStreamController& operator=(const IStreamController&) = default;
+    IStreamController& operator=(IStreamController&&) = default;
+
+    virtual ~IStreamController() = default;
+
+    // Ask the encoder of an encoded stream for a keyframe as soon as possible
+    virtual bool request_key_frame(unsigned int stream_idx) noexcept = 0;
+    // Change the target bitrate (in kbit/s) of the encoder of an encoded
+    // stream while it is running
+    virtual bool set_bitrate(unsigned int stream_idx, unsigned int bitrate) noexcept = 0;
+
+    // Encoders only run while their encoded stream has subscribers (and until
+    // their first keyframe, so that the stream caps are known). A subscriber
+    // gets a keyframe as soon as possible, and must unsubscribe once it does
+    // not consume the stream anymore.
+    virtual bool subscribe(unsigned int stream_idx) noexcept = 0;
+    virtual void unsubscribe(unsigned int stream_idx) noexcept = 0;
+
+    // Base time of the encoding pipeline on the system clock, the timestamps
+    // of the pushed buffers being running times against it. A consumer
+    // pipeline using the same clock and base time can keep them as they are.
+    virtual GstClockTime get_base_time() const noexcept = 0;
+};
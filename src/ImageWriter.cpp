@@ -1,57 +1,353 @@
 #include "ImageWriter.h"
 
+#include "CaptureTimeMeta.h"
+#include "ElementFactory.h"
+
 #include <cassert>
-#include <gst/app/app.h>
+#include <utility>
 
-static constexpr GstClockTime MESSAGE_TIMEOUT = 1 * GST_SECOND;
+namespace
+{
+constexpr GstClockTime MESSAGE_TIMEOUT = 1 * GST_SECOND;
+constexpr unsigned int MAX_PENDING_REQUESTS = 8;
+constexpr char JPEG_ENCODED_MESSAGE[] = "jpeg-encoded";
+} // namespace
 
 bool ImageWriter::create_pipeline() noexcept
 {
     assert(m_pipeline == nullptr);
 
-    GError* error = nullptr;
-    GstElement* pipeline = gst_parse_launch(
-        "appsrc name=entry-point is-live=true emit-signals=false format=time ! videoconvert ! vaapijpegenc ! "
-        "multifilesink enable-last-sample=false post-messages=true location=./screenshot_%03d.jpg",
-        &error);
+    // Built element by element, its topology being fixed
+    GstElement* pipeline = gst_pipeline_new("image-writer");
+    if (!add_and_link(GST_BIN(pipeline),
+                      {make_element("appsrc", "entry-point",
+                                    {{"is-live", "true"}, {"emit-signals", "false"}, {"format", "time"}}),
+                       make_element("videoconvert", nullptr), make_element("vaapijpegenc", nullptr),
+                       make_element("appsink", "exit-point",
+                                    {{"enable-last-sample", "false"}, {"emit-signals", "false"}, {"sync", "false"}})}))
+    {
+        g_printerr("ERROR: cannot create image writer pipeline\n");
+        gst_object_unref(gst_object_ref_sink(pipeline));
+        return false;
+    }
+
+    m_pipeline = GST_PIPELINE(gst_object_ref_sink(pipeline));
+
+    GstElement* appsink = gst_bin_get_by_name(GST_BIN(m_pipeline), "exit-point");
+    assert(appsink != nullptr);
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = reinterpret_cast<GstFlowReturn (*)(GstAppSink*, gpointer)>(on_new_sample);
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, this, nullptr);
+    gst_object_unref(appsink);
+
+    GstBus* bus = gst_pipeline_get_bus(m_pipeline);
+    assert(bus != nullptr);
+    m_bus_source = gst_bus_create_watch(bus);
+    g_source_set_callback(m_bus_source, G_SOURCE_FUNC(on_bus_message), this, nullptr);
+    g_source_attach(m_bus_source, m_context);
+    gst_object_unref(bus);
+
+    return true;
+}
+
+GstFlowReturn ImageWriter::on_new_sample(GstAppSink* appsink, ImageWriter* /*image_writer*/) noexcept
+{
+    assert(appsink != nullptr);
+
+    // Called from the streaming thread: hand the encoded image over to the
+    // writer context through the pipeline bus.
+    GstSample* sample = gst_app_sink_pull_sample(appsink);
+    if (sample == nullptr)
+    {
+        return GST_FLOW_ERROR;
+    }
+
+    GstStructure* msg_struct = gst_structure_new(JPEG_ENCODED_MESSAGE, "sample", GST_TYPE_SAMPLE, sample, nullptr);
+    gst_sample_unref(sample);
+    gst_element_post_message(GST_ELEMENT(appsink), gst_message_new_application(GST_OBJECT(appsink), msg_struct));
+    return GST_FLOW_OK;
+}
+
+gboolean ImageWriter::on_bus_message(GstBus* /*bus*/, GstMessage* message, ImageWriter* image_writer) noexcept
+{
+    assert(message != nullptr);
+    assert(image_writer != nullptr);
 
-    if (pipeline == nullptr)
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_APPLICATION)
     {
-        if (error != nullptr)
+        const GstStructure* msg_struct = gst_message_get_structure(message);
+        if (gst_structure_has_name(msg_struct, JPEG_ENCODED_MESSAGE))
         {
-            g_printerr("ERROR: cannot create image writer pipeline (%s)\n", error->message);
-            g_error_free(error);
+            const GValue* sample_value = gst_structure_get_value(msg_struct, "sample");
+            image_writer->on_jpeg_encoded(GST_SAMPLE(g_value_get_boxed(sample_value)));
+        }
+    }
+    else if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR)
+    {
+        GError* error = nullptr;
+        gst_message_parse_error(message, &error, nullptr);
+        g_printerr("WARNING: cannot encode image (%s)\n", (error != nullptr) ? error->message : "unspecified error");
+        g_clear_error(&error);
+        image_writer->reset_pipeline();
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean ImageWriter::on_timeout(ImageWriter* image_writer) noexcept
+{
+    assert(image_writer != nullptr);
+
+    g_source_unref(image_writer->m_timeout_source);
+    image_writer->m_timeout_source = nullptr;
+    g_printerr("WARNING: cannot encode image (timeout occurred)\n");
+    if (!image_writer->m_pending_requests.empty())
+    {
+        image_writer->complete_request(image_writer->m_pending_requests.begin(), nullptr);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void ImageWriter::on_jpeg_encoded(GstSample* jpeg_sample) noexcept
+{
+    // Images are matched to the requests by the timestamp of their frame, as
+    // the ones completed late (after a timeout) must not be taken for the
+    // following frames. The encoder does not necessarily keep the offset.
+    GstBuffer* jpeg_buffer = gst_sample_get_buffer(jpeg_sample);
+    if (jpeg_buffer != nullptr)
+    {
+        GstClockTime pts = GST_BUFFER_PTS(jpeg_buffer);
+        guint64 offset = GST_BUFFER_OFFSET(jpeg_buffer);
+        for (auto it = m_pending_requests.begin(); it != m_pending_requests.end(); ++it)
+        {
+            if ((it->key.pts == pts) && ((offset == GST_BUFFER_OFFSET_NONE) || (it->key.offset == offset)))
+            {
+                complete_request(it, jpeg_sample);
+                return;
+            }
+        }
+    }
+
+    g_printerr("WARNING: encoded image matches no pending request, dropped\n");
+}
+
+void ImageWriter::reset_pipeline() noexcept
+{
+    // Frames being encoded are lost on error: restart the pipeline before
+    // failing their requests, whose callbacks may already queue new frames
+    if (m_pipeline != nullptr)
+    {
+        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PLAYING);
+        g_print("Image writer pipeline restarted\n");
+    }
+
+    std::deque<Request> failed_requests = std::move(m_pending_requests);
+    m_pending_requests.clear();
+    m_pending_images.set(0);
+    disarm_timeout();
+    for (Request& request : failed_requests)
+    {
+        m_failed_images.add();
+        notify_request(request, nullptr);
+    }
+}
+
+void ImageWriter::complete_request(std::deque<Request>::iterator request_it, GstSample* jpeg_sample) noexcept
+{
+    Request request = std::move(*request_it);
+    m_pending_requests.erase(request_it);
+    m_pending_images.set(static_cast<gint64>(m_pending_requests.size()));
+    arm_timeout();
+
+    GBytes* jpeg = nullptr;
+    GstBuffer* jpeg_buffer = (jpeg_sample != nullptr) ? gst_sample_get_buffer(jpeg_sample) : nullptr;
+    if (jpeg_buffer != nullptr)
+    {
+        GstMapInfo map_info = GST_MAP_INFO_INIT;
+        if (gst_buffer_map(jpeg_buffer, &map_info, GST_MAP_READ))
+        {
+            jpeg = g_bytes_new(map_info.data, map_info.size);
+            gst_buffer_unmap(jpeg_buffer, &map_info);
+            cache_image(request.key, jpeg);
+        }
+        m_capture_latency.observe(get_capture_latency(jpeg_buffer));
+    }
+
+    if (jpeg != nullptr)
+    {
+        m_encoded_images.add();
+        m_encoding_latency.observe((g_get_monotonic_time() - request.request_time) * GST_USECOND);
+    }
+    else
+    {
+        m_failed_images.add();
+    }
+
+    notify_request(request, jpeg);
+
+    if (jpeg != nullptr)
+    {
+        g_bytes_unref(jpeg);
+    }
+}
+
+void ImageWriter::notify_request(Request& request, GBytes* jpeg) noexcept
+{
+    if (!request.screenshot_callbacks.empty())
+    {
+        write_screenshot(jpeg, request.screenshot_callbacks);
+    }
+
+    for (JpegCallback& callback : request.jpeg_callbacks)
+    {
+        callback(jpeg);
+    }
+}
+
+void ImageWriter::write_screenshot(GBytes* jpeg, const std::vector<ScreenshotCallback>& callbacks) noexcept
+{
+    bool success = false;
+    gchar* absolute_path = nullptr;
+
+    if (jpeg != nullptr)
+    {
+        char filename[24]; // until "./screenshot_99999.jpg", just in case // NOLINT
+        g_snprintf(filename, sizeof(filename), "./screenshot_%03u.jpg", m_screenshot_idx++);
+        absolute_path = g_canonicalize_filename(filename, nullptr);
+
+        gsize size = 0;
+        gconstpointer data = g_bytes_get_data(jpeg, &size);
+        GError* error = nullptr;
+        success = g_file_set_contents(absolute_path, static_cast<const gchar*>(data), static_cast<gssize>(size),
+                                      &error);
+        if (success)
+        {
+            g_print("Screenshot written to %s\n", absolute_path);
         }
         else
         {
-            g_printerr("ERROR: cannot create image writer pipeline (unspecified error)\n");
+            g_printerr("WARNING: cannot write image file (%s)\n", error->message);
+            g_error_free(error);
+        }
+    }
+
+    for (const ScreenshotCallback& callback : callbacks)
+    {
+        if (callback)
+        {
+            callback(success, absolute_path);
         }
+    }
 
-        return false;
+    g_free(absolute_path);
+}
+
+GBytes* ImageWriter::find_cached_image(const FrameKey& key) noexcept
+{
+    for (CachedImage& cached_image : m_cache)
+    {
+        if ((cached_image.jpeg != nullptr) && (cached_image.key == key))
+        {
+            cached_image.last_use = ++m_cache_clock;
+            return cached_image.jpeg;
+        }
     }
 
-    if (error != nullptr)
+    return nullptr;
+}
+
+void ImageWriter::cache_image(const FrameKey& key, GBytes* jpeg) noexcept
+{
+    if (!GST_CLOCK_TIME_IS_VALID(key.pts) || (find_cached_image(key) != nullptr))
     {
-        g_printerr("WARNING: fixed issue encountered while creating image writer pipeline (%s)\n", error->message);
-        g_error_free(error);
+        return;
     }
 
-    m_pipeline = GST_PIPELINE(gst_object_ref_sink(pipeline));
-    return true;
+    // Replace the least recently used image
+    CachedImage* oldest = &m_cache[0];
+    for (CachedImage& cached_image : m_cache)
+    {
+        if (cached_image.last_use < oldest->last_use)
+        {
+            oldest = &cached_image;
+        }
+    }
+
+    if (oldest->jpeg != nullptr)
+    {
+        g_bytes_unref(oldest->jpeg);
+    }
+
+    oldest->key = key;
+    oldest->jpeg = g_bytes_ref(jpeg);
+    oldest->last_use = ++m_cache_clock;
+}
+
+void ImageWriter::clear_cache() noexcept
+{
+    for (CachedImage& cached_image : m_cache)
+    {
+        if (cached_image.jpeg != nullptr)
+        {
+            g_bytes_unref(cached_image.jpeg);
+        }
+
+        cached_image = CachedImage();
+    }
+}
+
+void ImageWriter::arm_timeout() noexcept
+{
+    disarm_timeout();
+    if (m_pending_requests.empty())
+    {
+        return;
+    }
+
+    // Only the oldest request is watched, the following ones being handled
+    // once it is completed
+    gint64 delay = m_pending_requests.front().deadline - g_get_monotonic_time();
+    m_timeout_source = g_timeout_source_new((delay > 0) ? static_cast<guint>(delay / 1000) : 0);
+    g_source_set_callback(m_timeout_source, reinterpret_cast<GSourceFunc>(on_timeout), this, nullptr);
+    g_source_attach(m_timeout_source, m_context);
+}
+
+void ImageWriter::disarm_timeout() noexcept
+{
+    if (m_timeout_source != nullptr)
+    {
+        g_source_destroy(m_timeout_source);
+        g_source_unref(m_timeout_source);
+        m_timeout_source = nullptr;
+    }
 }
 
-bool ImageWriter::start() noexcept
+bool ImageWriter::start(GMainContext* context) noexcept
 {
+    assert(context != nullptr);
+
     if (m_pipeline != nullptr)
     {
         return true;
     }
 
+    m_context = context;
+
     if (!create_pipeline())
     {
         return false;
     }
 
+    m_encoded_images.publish("rtspcam_images_encoded_total", "Frames encoded to JPEG");
+    m_failed_images.publish("rtspcam_images_failed_total", "Frames which could not be encoded to JPEG");
+    m_cache_hits.publish("rtspcam_images_cache_hits_total", "Image requests served from the JPEG cache");
+    m_coalesced_requests.publish("rtspcam_images_coalesced_total", "Image requests for a frame already being encoded");
+    m_pending_images.publish("rtspcam_images_pending", "Frames waiting to be encoded to JPEG");
+    m_encoding_latency.publish("rtspcam_images_latency_seconds", "Delay between an image request and its encoding");
+    m_capture_latency.publish("rtspcam_images_capture_latency_seconds",
+                              "Delay between the capture and the delivery of a JPEG image");
+
     gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PLAYING);
     g_print("Image writer pipeline started\n");
     return true;
@@ -59,8 +355,20 @@ bool ImageWriter::start() noexcept
 
 void ImageWriter::stop() noexcept
 {
+    disarm_timeout();
+    while (!m_pending_requests.empty())
+    {
+        complete_request(m_pending_requests.begin(), nullptr);
+    }
+
+    clear_cache();
+
     if (m_pipeline != nullptr)
     {
+        g_source_destroy(m_bus_source);
+        g_source_unref(m_bus_source);
+        m_bus_source = nullptr;
+
         gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
         gst_object_unref(m_pipeline);
         m_pipeline = nullptr;
@@ -68,17 +376,19 @@ void ImageWriter::stop() noexcept
     }
 }
 
-bool ImageWriter::take_screenshot(const IFrameProducer& producer) noexcept
+ImageWriter::Request* ImageWriter::find_or_queue_request(const IFrameProducer& producer,
+                                                         GBytes*& cached_jpeg) noexcept
 {
+    cached_jpeg = nullptr;
     if (m_pipeline == nullptr)
     {
-        return false;
+        return nullptr;
     }
 
     GstSample* sample = producer.get_last_sample();
     if (sample == nullptr)
     {
-        return false;
+        return nullptr;
     }
 
     GstCaps* sample_caps = gst_sample_get_caps(sample);
@@ -86,7 +396,41 @@ bool ImageWriter::take_screenshot(const IFrameProducer& producer) noexcept
     if ((sample_caps == nullptr) || (sample_buffer == nullptr))
     {
         gst_sample_unref(sample);
-        return false;
+        return nullptr;
+    }
+
+    FrameKey key;
+    key.pts = GST_BUFFER_PTS(sample_buffer);
+    key.offset = GST_BUFFER_OFFSET(sample_buffer);
+
+    // Serve already encoded frames from the cache
+    if (GST_CLOCK_TIME_IS_VALID(key.pts))
+    {
+        cached_jpeg = find_cached_image(key);
+        if (cached_jpeg != nullptr)
+        {
+            m_cache_hits.add();
+            gst_sample_unref(sample);
+            return nullptr;
+        }
+
+        // Coalesce requests for the frame being encoded
+        for (Request& request : m_pending_requests)
+        {
+            if (request.key == key)
+            {
+                m_coalesced_requests.add();
+                gst_sample_unref(sample);
+                return &request;
+            }
+        }
+    }
+
+    if (m_pending_requests.size() >= MAX_PENDING_REQUESTS)
+    {
+        gst_sample_unref(sample);
+        g_printerr("WARNING: too many pending screenshots, request dropped\n");
+        return nullptr;
     }
 
     GstElement* appsrc = gst_bin_get_by_name(GST_BIN(m_pipeline), "entry-point");
@@ -100,35 +444,63 @@ bool ImageWriter::take_screenshot(const IFrameProducer& producer) noexcept
     if (ret != GST_FLOW_OK)
     {
         g_printerr("WARNING: cannot push the raw frame to the image encoder\n");
-        return false;
+        return nullptr;
     }
 
-    GstBus* bus = gst_pipeline_get_bus(m_pipeline);
-    assert(bus != nullptr);
+    Request request;
+    request.key = key;
+    request.request_time = g_get_monotonic_time();
+    request.deadline = request.request_time + static_cast<gint64>(GST_TIME_AS_USECONDS(MESSAGE_TIMEOUT));
+    m_pending_requests.push_back(std::move(request));
+    m_pending_images.set(static_cast<gint64>(m_pending_requests.size()));
 
-    for (;;)
+    if (m_pending_requests.size() == 1)
     {
-        GstMessage* msg = gst_bus_timed_pop_filtered(bus, MESSAGE_TIMEOUT, GST_MESSAGE_ELEMENT);
-        if (msg == nullptr)
-        {
-            gst_object_unref(bus);
-            g_printerr("WARNING: cannot write image file (timeout occurred)\n");
-            return false;
-        }
+        arm_timeout();
+    }
 
-        const GstStructure* msg_struct = gst_message_get_structure(msg);
-        if (g_strcmp0(gst_structure_get_name(msg_struct), "GstMultiFileSink") == 0)
-        {
-            const gchar* filename = gst_structure_get_string(msg_struct, "filename");
-            gchar* absolute_path = g_canonicalize_filename(filename, nullptr);
-            g_print("Screenshot written to %s\n", absolute_path);
-            g_free(absolute_path);
+    return &m_pending_requests.back();
+}
 
-            gst_message_unref(msg);
-            gst_object_unref(bus);
-            return true;
-        }
+bool ImageWriter::take_screenshot(const IFrameProducer& producer, ScreenshotCallback callback) noexcept
+{
+    GBytes* cached_jpeg = nullptr;
+    Request* request = find_or_queue_request(producer, cached_jpeg);
+    if (cached_jpeg != nullptr)
+    {
+        write_screenshot(cached_jpeg, {std::move(callback)});
+        return true;
+    }
+
+    if (request == nullptr)
+    {
+        return false;
+    }
+
+    request->screenshot_callbacks.push_back(std::move(callback));
+    return true;
+}
+
+bool ImageWriter::take_jpeg(const IFrameProducer& producer, JpegCallback callback) noexcept
+{
+    if (!callback)
+    {
+        return false;
+    }
+
+    GBytes* cached_jpeg = nullptr;
+    Request* request = find_or_queue_request(producer, cached_jpeg);
+    if (cached_jpeg != nullptr)
+    {
+        callback(cached_jpeg);
+        return true;
+    }
 
-        gst_message_unref(msg);
+    if (request == nullptr)
+    {
+        return false;
     }
+
+    request->jpeg_callbacks.push_back(std::move(callback));
+    return true;
 }
@@ -1,14 +1,25 @@
 #pragma once
 
 #include "IFrameProducer.h"
+#include "Metrics.h"
+
+#include <deque>
+#include <functional>
+#include <gst/app/app.h>
+#include <vector>
+
+// Called once a screenshot is written, with the absolute path of the image file
+using ScreenshotCallback = std::function<void(bool success, const char* filename)>;
+// Called once a frame is encoded, with the JPEG image (nullptr on failure)
+using JpegCallback = std::function<void(GBytes* jpeg)>;
 
 class ImageWriter final
 {
   public:
     ImageWriter() = default;
-    ImageWriter(ImageWriter&&) = default;
-    ImageWriter& operator=(ImageWriter&&) = default;
 
+    ImageWriter(ImageWriter&&) = delete;
+    ImageWriter& operator=(ImageWriter&&) = delete;
     ImageWriter(const ImageWriter&) = delete;
     ImageWriter& operator=(const ImageWriter&) = delete;
 
@@ -17,13 +28,84 @@ class ImageWriter final
         stop();
     }
 
-    bool start() noexcept;
+    // The writer is only used from the given context, from which its
+    // pipeline bus and timeouts are dispatched
+    bool start(GMainContext* context) noexcept;
     void stop() noexcept;
 
-    bool take_screenshot(const IFrameProducer& producer) noexcept;
+    // Screenshots are asynchronous: the methods return as soon as the last
+    // frame is queued for encoding, the completion being reported through the
+    // callback from the writer context. Requests for the frame already
+    // being encoded are coalesced, and frames already encoded are served from
+    // a cache (the callback is then called before returning).
+    bool take_screenshot(const IFrameProducer& producer, ScreenshotCallback callback = nullptr) noexcept;
+    bool take_jpeg(const IFrameProducer& producer, JpegCallback callback) noexcept;
 
   private:
+    static constexpr unsigned int NB_CACHED_IMAGES = 4;
+
+    // Frames are identified by the pts and the offset of the raw buffer
+    struct FrameKey
+    {
+        GstClockTime pts = GST_CLOCK_TIME_NONE;
+        guint64 offset = GST_BUFFER_OFFSET_NONE;
+
+        bool operator==(const FrameKey& other) const noexcept
+        {
+            return (pts == other.pts) && (offset == other.offset);
+        }
+    };
+
+    struct CachedImage
+    {
+        FrameKey key;
+        GBytes* jpeg = nullptr;
+        guint64 last_use = 0;
+    };
+
+    struct Request
+    {
+        FrameKey key;
+        gint64 request_time = 0;
+        gint64 deadline = 0;
+        std::vector<ScreenshotCallback> screenshot_callbacks;
+        std::vector<JpegCallback> jpeg_callbacks;
+    };
+
+    static gboolean on_bus_message(GstBus* bus, GstMessage* message, ImageWriter* image_writer) noexcept;
+    static GstFlowReturn on_new_sample(GstAppSink* appsink, ImageWriter* image_writer) noexcept;
+    static gboolean on_timeout(ImageWriter* image_writer) noexcept;
+
     bool create_pipeline() noexcept;
+    Request* find_or_queue_request(const IFrameProducer& producer, GBytes*& cached_jpeg) noexcept;
+    void on_jpeg_encoded(GstSample* jpeg_sample) noexcept;
+    void reset_pipeline() noexcept;
+    void complete_request(std::deque<Request>::iterator request_it, GstSample* jpeg_sample) noexcept;
+    void notify_request(Request& request, GBytes* jpeg) noexcept;
+    void write_screenshot(GBytes* jpeg, const std::vector<ScreenshotCallback>& callbacks) noexcept;
+
+    GBytes* find_cached_image(const FrameKey& key) noexcept;
+    void cache_image(const FrameKey& key, GBytes* jpeg) noexcept;
+    void clear_cache() noexcept;
 
+    void arm_timeout() noexcept;
+    void disarm_timeout() noexcept;
+
+    GMainContext* m_context = nullptr;
     GstPipeline* m_pipeline = nullptr;
+    GSource* m_bus_source = nullptr;
+    std::deque<Request> m_pending_requests;
+    GSource* m_timeout_source = nullptr;
+    unsigned int m_screenshot_idx = 0;
+
+    CachedImage m_cache[NB_CACHED_IMAGES];
+    guint64 m_cache_clock = 0;
+
+    Counter m_encoded_images;
+    Counter m_failed_images;
+    Counter m_cache_hits;
+    Counter m_coalesced_requests;
+    Gauge m_pending_images;
+    Histogram m_encoding_latency;
+    Histogram m_capture_latency;
 };
@@ -0,0 +1,100 @@
+#include "MainContextThread.h"
+
+#include <cassert>
+#include <memory>
+#include <utility>
+
+MainContextThread::~MainContextThread()
+{
+    stop();
+    g_main_context_unref(m_context);
+}
+
+gpointer MainContextThread::run(MainContextThread* thread) noexcept
+{
+    assert(thread != nullptr);
+
+    // Sources attached by the tasks default to this context
+    g_main_context_push_thread_default(thread->m_context);
+    while (thread->m_running.load())
+    {
+        g_main_context_iteration(thread->m_context, TRUE);
+    }
+    g_main_context_pop_thread_default(thread->m_context);
+
+    return nullptr;
+}
+
+gboolean MainContextThread::on_task(Task* task) noexcept
+{
+    assert(task != nullptr);
+
+    (*task)();
+    return G_SOURCE_REMOVE;
+}
+
+void MainContextThread::delete_task(Task* task) noexcept
+{
+    delete task;
+}
+
+bool MainContextThread::start(const char* name) noexcept
+{
+    assert(name != nullptr);
+
+    if (m_thread != nullptr)
+    {
+        return true;
+    }
+
+    m_running.store(true);
+    GError* error = nullptr;
+    m_thread = g_thread_try_new(name, reinterpret_cast<GThreadFunc>(run), this, &error);
+    if (m_thread == nullptr)
+    {
+        g_printerr("ERROR: cannot start %s thread (%s)\n", name, error->message);
+        g_error_free(error);
+        m_running.store(false);
+        return false;
+    }
+
+    return true;
+}
+
+void MainContextThread::stop() noexcept
+{
+    if (m_thread == nullptr)
+    {
+        return;
+    }
+
+    m_running.store(false);
+    g_main_context_wakeup(m_context);
+    g_thread_join(m_thread);
+    m_thread = nullptr;
+}
+
+bool MainContextThread::invoke(Task task) noexcept
+{
+    if (!m_running.load())
+    {
+        return false;
+    }
+
+    g_main_context_invoke_full(m_context, G_PRIORITY_DEFAULT, reinterpret_cast<GSourceFunc>(on_task),
+                               new Task(std::move(task)), reinterpret_cast<GDestroyNotify>(delete_task));
+    return true;
+}
+
+std::future<bool> MainContextThread::invoke_async(std::function<bool()> task) noexcept
+{
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = promise->get_future();
+
+    if (!invoke([promise, task = std::move(task)]() { promise->set_value(task()); }))
+    {
+        promise->set_value(false);
+    }
+
+    return result;
+}
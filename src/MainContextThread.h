@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <glib.h>
+
+// Main context iterated by a dedicated thread, so that the sources of a
+// subsystem (bus watches, timeouts, sockets) are dispatched without waiting
+// behind the ones of the other subsystems.
+//
+// The context lives as long as the object: sources can be attached before
+// the thread is started and removed once it is stopped, tasks still pending
+// at that time being dropped with the context.
+class MainContextThread final
+{
+  public:
+    using Task = std::function<void()>;
+
+    MainContextThread() : m_context(g_main_context_new())
+    {
+    }
+
+    MainContextThread(MainContextThread&&) = delete;
+    MainContextThread& operator=(MainContextThread&&) = delete;
+    MainContextThread(const MainContextThread&) = delete;
+    MainContextThread& operator=(const MainContextThread&) = delete;
+
+    ~MainContextThread();
+
+    bool start(const char* name) noexcept;
+    void stop() noexcept;
+
+    GMainContext* context() const noexcept
+    {
+        return m_context;
+    }
+
+    // Runs the task from the thread, at once when called from it
+    bool invoke(Task task) noexcept;
+
+    // Same as invoke, the result of the task being waited for through the
+    // returned future (false if the task could not be run)
+    std::future<bool> invoke_async(std::function<bool()> task) noexcept;
+
+  private:
+    static gpointer run(MainContextThread* thread) noexcept;
+    static gboolean on_task(Task* task) noexcept;
+    static void delete_task(Task* task) noexcept;
+
+    GMainContext* m_context;
+    GThread* m_thread = nullptr;
+    std::atomic<bool> m_running{false};
+};
@@ -0,0 +1,155 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// Function-local statics, as metrics may be published from other static
+// initializers
+std::mutex& registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<Metric*>& registry()
+{
+    static std::vector<Metric*> metrics;
+    return metrics;
+}
+
+void append_labels(GString* output, const std::string& labels, const char* extra_label = nullptr)
+{
+    if (labels.empty() && (extra_label == nullptr))
+    {
+        return;
+    }
+
+    g_string_append_c(output, '{');
+    g_string_append(output, labels.c_str());
+    if (extra_label != nullptr)
+    {
+        if (!labels.empty())
+        {
+            g_string_append_c(output, ',');
+        }
+        g_string_append(output, extra_label);
+    }
+    g_string_append_c(output, '}');
+}
+} // namespace
+
+void Metric::publish(const char* name, const char* help, std::string labels) noexcept
+{
+    assert(name != nullptr);
+    assert(help != nullptr);
+
+    std::lock_guard<std::mutex> guard(registry_mutex());
+    m_name = name;
+    m_help = help;
+    m_labels = std::move(labels);
+
+    std::vector<Metric*>& metrics = registry();
+    if (std::find(metrics.begin(), metrics.end(), this) == metrics.end())
+    {
+        metrics.push_back(this);
+    }
+}
+
+void Metric::unpublish() noexcept
+{
+    std::lock_guard<std::mutex> guard(registry_mutex());
+    std::vector<Metric*>& metrics = registry();
+    metrics.erase(std::remove(metrics.begin(), metrics.end(), this), metrics.end());
+}
+
+gchar* Metric::format_all() noexcept
+{
+    GString* output = g_string_new(nullptr);
+
+    std::lock_guard<std::mutex> guard(registry_mutex());
+    std::vector<Metric*> metrics = registry();
+    std::stable_sort(metrics.begin(), metrics.end(),
+                     [](const Metric* a, const Metric* b) { return std::strcmp(a->m_name, b->m_name) < 0; });
+
+    // Metrics sharing a name are grouped under the same description
+    const char* previous_name = nullptr;
+    for (const Metric* metric : metrics)
+    {
+        if ((previous_name == nullptr) || (std::strcmp(previous_name, metric->m_name) != 0))
+        {
+            g_string_append_printf(output, "# HELP %s %s\n# TYPE %s %s\n", metric->m_name, metric->m_help,
+                                   metric->m_name, metric->type());
+            previous_name = metric->m_name;
+        }
+        metric->format_samples(output);
+    }
+
+    return g_string_free(output, FALSE);
+}
+
+void Counter::format_samples(GString* output) const noexcept
+{
+    g_string_append(output, name());
+    append_labels(output, labels());
+    g_string_append_printf(output, " %" G_GUINT64_FORMAT "\n", value());
+}
+
+void Gauge::format_samples(GString* output) const noexcept
+{
+    g_string_append(output, name());
+    append_labels(output, labels());
+    g_string_append_printf(output, " %" G_GINT64_FORMAT "\n", m_value.load(std::memory_order_relaxed));
+}
+
+void Histogram::observe(GstClockTime duration) noexcept
+{
+    if (!GST_CLOCK_TIME_IS_VALID(duration))
+    {
+        return;
+    }
+
+    unsigned int bucket = 0;
+    while ((bucket < NB_BUCKETS) && (duration > BUCKET_BOUNDS[bucket]))
+    {
+        ++bucket;
+    }
+
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(duration, std::memory_order_relaxed);
+}
+
+void Histogram::format_samples(GString* output) const noexcept
+{
+    char le[32]; // NOLINT
+    guint64 count = 0;
+    for (unsigned int i = 0; i <= NB_BUCKETS; ++i)
+    {
+        count += m_buckets[i].load(std::memory_order_relaxed);
+        if (i < NB_BUCKETS)
+        {
+            g_snprintf(le, sizeof(le), "le=\"%g\"", static_cast<double>(BUCKET_BOUNDS[i]) / GST_SECOND);
+        }
+        else
+        {
+            g_snprintf(le, sizeof(le), "le=\"+Inf\"");
+        }
+
+        g_string_append_printf(output, "%s_bucket", name());
+        append_labels(output, labels(), le);
+        g_string_append_printf(output, " %" G_GUINT64_FORMAT "\n", count);
+    }
+
+    g_string_append_printf(output, "%s_sum", name());
+    append_labels(output, labels());
+    g_string_append_printf(output, " %g\n", static_cast<double>(m_sum.load(std::memory_order_relaxed)) / GST_SECOND);
+
+    g_string_append_printf(output, "%s_count", name());
+    append_labels(output, labels());
+    g_string_append_printf(output, " %" G_GUINT64_FORMAT "\n", count);
+}
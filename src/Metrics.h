@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <gst/gst.h>
+#include <string>
+
+// Metrics are updated from the streaming threads with relaxed atomic
+// operations only, and exposed in the Prometheus text format. A metric is
+// only visible once published under a name, shared by the metrics of every
+// stream or consumer which then differ by their labels.
+//
+// Publishing and formatting are serialized on the registry mutex, so metrics
+// must not be published from a streaming thread hot path.
+class Metric
+{
+  public:
+    Metric() = default;
+
+    Metric(Metric&&) = delete;
+    Metric& operator=(Metric&&) = delete;
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+
+    virtual ~Metric()
+    {
+        unpublish();
+    }
+
+    // Labels are given in the Prometheus format, e.g. stream="0"
+    void publish(const char* name, const char* help, std::string labels = std::string()) noexcept;
+    void unpublish() noexcept;
+
+    // All published metrics in the Prometheus text exposition format
+    static gchar* format_all() noexcept;
+
+  protected:
+    virtual const char* type() const noexcept = 0;
+    virtual void format_samples(GString* output) const noexcept = 0;
+
+    const char* name() const noexcept
+    {
+        return m_name;
+    }
+
+    const std::string& labels() const noexcept
+    {
+        return m_labels;
+    }
+
+  private:
+    const char* m_name = nullptr;
+    const char* m_help = nullptr;
+    std::string m_labels;
+};
+
+// Monotonic count of events or bytes
+class Counter final : public Metric
+{
+  public:
+    Counter() = default;
+
+    Counter(Counter&&) = delete;
+    Counter& operator=(Counter&&) = delete;
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    ~Counter() override
+    {
+        unpublish();
+    }
+
+    void add(guint64 value = 1) noexcept
+    {
+        m_value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    guint64 value() const noexcept
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+  protected:
+    const char* type() const noexcept override
+    {
+        return "counter";
+    }
+
+    void format_samples(GString* output) const noexcept override;
+
+  private:
+    std::atomic<guint64> m_value{0};
+};
+
+// Instant value such as a queue depth
+class Gauge final : public Metric
+{
+  public:
+    Gauge() = default;
+
+    Gauge(Gauge&&) = delete;
+    Gauge& operator=(Gauge&&) = delete;
+    Gauge(const Gauge&) = delete;
+    Gauge& operator=(const Gauge&) = delete;
+
+    ~Gauge() override
+    {
+        unpublish();
+    }
+
+    void set(gint64 value) noexcept
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    void add(gint64 value) noexcept
+    {
+        m_value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+  protected:
+    const char* type() const noexcept override
+    {
+        return "gauge";
+    }
+
+    void format_samples(GString* output) const noexcept override;
+
+  private:
+    std::atomic<gint64> m_value{0};
+};
+
+// Distribution of durations, from 10 us to 1 s
+class Histogram final : public Metric
+{
+  public:
+    Histogram() = default;
+
+    Histogram(Histogram&&) = delete;
+    Histogram& operator=(Histogram&&) = delete;
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    ~Histogram() override
+    {
+        unpublish();
+    }
+
+    void observe(GstClockTime duration) noexcept;
+
+  protected:
+    const char* type() const noexcept override
+    {
+        return "histogram";
+    }
+
+    void format_samples(GString* output) const noexcept override;
+
+  private:
+    static constexpr unsigned int NB_BUCKETS = 16;
+    static constexpr GstClockTime BUCKET_BOUNDS[NB_BUCKETS] = {
+        10 * GST_USECOND,  20 * GST_USECOND,  50 * GST_USECOND,  100 * GST_USECOND,
+        200 * GST_USECOND, 500 * GST_USECOND, 1 * GST_MSECOND,   2 * GST_MSECOND,
+        5 * GST_MSECOND,   10 * GST_MSECOND,  20 * GST_MSECOND,  50 * GST_MSECOND,
+        100 * GST_MSECOND, 200 * GST_MSECOND, 500 * GST_MSECOND, 1000 * GST_MSECOND};
+
+    // Buckets are not cumulative here, only when formatted
+    std::atomic<guint64> m_buckets[NB_BUCKETS + 1] = {};
+    std::atomic<guint64> m_sum{0};
+};
@@ -0,0 +1,108 @@
+#include "MetricsServer.h"
+
+#include "Metrics.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+constexpr int MAX_WORKER_THREADS = 2;
+constexpr gsize MAX_REQUEST_SIZE = 1024;
+constexpr char METRICS_REQUEST[] = "GET /metrics ";
+constexpr char METRICS_RESPONSE_HEADER[] = "HTTP/1.0 200 OK\r\n"
+                                           "Content-Type: text/plain; version=0.0.4\r\n"
+                                           "Content-Length: %zu\r\n"
+                                           "Connection: close\r\n\r\n";
+constexpr char NOT_FOUND_RESPONSE[] = "HTTP/1.0 404 Not Found\r\n"
+                                      "Content-Length: 0\r\n"
+                                      "Connection: close\r\n\r\n";
+} // namespace
+
+gboolean MetricsServer::on_run(GThreadedSocketService* service, GSocketConnection* connection,
+                               GObject* /*source_object*/, MetricsServer* metrics_server) noexcept
+{
+    assert(service != nullptr);
+    assert(connection != nullptr);
+    assert(metrics_server != nullptr);
+
+    // Only the request line matters, the remaining headers are ignored
+    char request[MAX_REQUEST_SIZE]; // NOLINT
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    gssize read = g_input_stream_read(input, request, sizeof(request) - 1, nullptr, nullptr);
+    if (read <= 0)
+    {
+        return TRUE;
+    }
+    request[read] = 0;
+
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    if (std::strncmp(request, METRICS_REQUEST, sizeof(METRICS_REQUEST) - 1) != 0)
+    {
+        g_output_stream_write_all(output, NOT_FOUND_RESPONSE, sizeof(NOT_FOUND_RESPONSE) - 1, nullptr, nullptr,
+                                  nullptr);
+        return TRUE;
+    }
+
+    gchar* body = Metric::format_all();
+    gsize body_size = std::strlen(body);
+    gchar* header = g_strdup_printf(METRICS_RESPONSE_HEADER, body_size);
+    if (g_output_stream_write_all(output, header, std::strlen(header), nullptr, nullptr, nullptr))
+    {
+        g_output_stream_write_all(output, body, body_size, nullptr, nullptr, nullptr);
+    }
+    g_free(header);
+    g_free(body);
+
+    return TRUE;
+}
+
+bool MetricsServer::start(unsigned int port) noexcept
+{
+    if (m_service != nullptr)
+    {
+        return true;
+    }
+
+    GSocketService* service = g_threaded_socket_service_new(MAX_WORKER_THREADS);
+
+    // Local scraping only
+    GInetAddress* loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress* address = g_inet_socket_address_new(loopback, static_cast<guint16>(port));
+    g_object_unref(loopback);
+
+    GError* error = nullptr;
+    gboolean added = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM,
+                                                   G_SOCKET_PROTOCOL_TCP, nullptr, nullptr, &error);
+    g_object_unref(address);
+    if (!added)
+    {
+        g_printerr("ERROR: cannot listen for metrics requests on port %u (%s)\n", port, error->message);
+        g_error_free(error);
+        g_object_unref(service);
+        return false;
+    }
+
+    if (g_signal_connect(service, "run", reinterpret_cast<GCallback>(MetricsServer::on_run), this) == 0)
+    {
+        g_printerr("ERROR: cannot connect signal to metrics service\n");
+        g_object_unref(service);
+        return false;
+    }
+
+    g_socket_service_start(service);
+    m_service = service;
+    g_print("Metrics served at http://127.0.0.1:%u/metrics\n", port);
+    return true;
+}
+
+void MetricsServer::stop() noexcept
+{
+    if (m_service != nullptr)
+    {
+        g_socket_service_stop(m_service);
+        g_socket_listener_close(G_SOCKET_LISTENER(m_service));
+        g_object_unref(m_service);
+        m_service = nullptr;
+    }
+}
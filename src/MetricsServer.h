@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gio/gio.h>
+
+// Serves the published metrics over HTTP on the loopback interface, in the
+// Prometheus text format (GET /metrics). Requests are handled by the worker
+// threads of the socket service, outside of the streaming threads.
+class MetricsServer final
+{
+  public:
+    MetricsServer() = default;
+
+    MetricsServer(MetricsServer&&) = delete;
+    MetricsServer& operator=(MetricsServer&&) = delete;
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    ~MetricsServer()
+    {
+        stop();
+    }
+
+    bool start(unsigned int port) noexcept;
+    void stop() noexcept;
+
+  private:
+    static gboolean on_run(GThreadedSocketService* service, GSocketConnection* connection, GObject* source_object,
+                           MetricsServer* metrics_server) noexcept;
+
+    GSocketService* m_service = nullptr;
+};
@@ -0,0 +1,152 @@
+#include "MotionDetector.h"
+
+#include "MotionKernel.h"
+
+#include <cassert>
+#include <utility>
+
+namespace
+{
+// Luma is sampled every other pixel of every other line
+constexpr unsigned int SAMPLING_STEP = 2;
+constexpr unsigned int PERMILLE = 1000;
+} // namespace
+
+void MotionDetector::configure(const MotionConfiguration& configuration, MotionCallback callback) noexcept
+{
+    m_configuration = configuration;
+    m_callback = std::move(callback);
+
+    m_analyzed_frames.publish("rtspcam_motion_frames_total", "Raw frames analyzed by the motion detector");
+    m_motion_events.publish("rtspcam_motion_events_total", "Motion periods detected");
+    m_changed_permille.publish("rtspcam_motion_changed_permille", "Changed luma samples in the last analyzed frame");
+    m_analysis_duration.publish("rtspcam_motion_analysis_seconds", "Duration of the analysis of a raw frame");
+
+    g_print("Motion detector configured (%s kernel)\n", motion_kernel_name());
+}
+
+bool MotionDetector::push_caps(unsigned int /*stream_idx*/, GstCaps* caps) noexcept
+{
+    if ((caps == nullptr) || !gst_video_info_from_caps(&m_video_info, caps))
+    {
+        m_has_luma = false;
+        return false;
+    }
+
+    // The first component of YUV and gray formats is the luma, 8-bit samples
+    // being expected by the kernel
+    m_has_luma = (GST_VIDEO_INFO_IS_YUV(&m_video_info) || GST_VIDEO_INFO_IS_GRAY(&m_video_info)) &&
+                 (GST_VIDEO_INFO_COMP_DEPTH(&m_video_info, 0) == 8);
+    if (!m_has_luma)
+    {
+        g_printerr("WARNING: motion detection not supported for %s frames\n",
+                   gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&m_video_info)));
+        return false;
+    }
+
+    m_grid_width = static_cast<unsigned int>(GST_VIDEO_INFO_COMP_WIDTH(&m_video_info, 0)) / SAMPLING_STEP;
+    m_grid_height = static_cast<unsigned int>(GST_VIDEO_INFO_COMP_HEIGHT(&m_video_info, 0)) / SAMPLING_STEP;
+    m_samples.assign(static_cast<size_t>(m_grid_width) * m_grid_height, 0);
+    m_previous_samples.assign(m_samples.size(), 0);
+    m_has_previous_samples = false;
+    return true;
+}
+
+bool MotionDetector::push_buffer(unsigned int /*stream_idx*/, GstBuffer* buffer) noexcept
+{
+    if ((buffer == nullptr) || !m_has_luma || m_samples.empty())
+    {
+        return false;
+    }
+
+    GstClockTime start_time = gst_util_get_timestamp();
+    if (!sample_luma(buffer))
+    {
+        return false;
+    }
+
+    if (m_has_previous_samples)
+    {
+        size_t changed_samples = count_changed_samples(m_samples.data(), m_previous_samples.data(), m_samples.size(),
+                                                       static_cast<uint8_t>(m_configuration.pixel_threshold));
+        auto changed_permille = static_cast<unsigned int>(changed_samples * PERMILLE / m_samples.size());
+        m_changed_permille.set(changed_permille);
+        update_state(changed_permille);
+    }
+
+    std::swap(m_samples, m_previous_samples);
+    m_has_previous_samples = true;
+
+    m_analyzed_frames.add();
+    m_analysis_duration.observe(gst_util_get_timestamp() - start_time);
+    return true;
+}
+
+bool MotionDetector::sample_luma(GstBuffer* buffer) noexcept
+{
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &m_video_info, buffer, GST_MAP_READ))
+    {
+        g_printerr("WARNING: cannot map raw frame for motion detection\n");
+        return false;
+    }
+
+    // Packed formats interleave the luma with the chroma, hence the pixel
+    // stride of the component
+    const auto* luma = static_cast<const guint8*>(GST_VIDEO_FRAME_COMP_DATA(&frame, 0));
+    const auto row_stride = static_cast<size_t>(GST_VIDEO_FRAME_COMP_STRIDE(&frame, 0)) * SAMPLING_STEP;
+    const auto sample_stride = static_cast<size_t>(GST_VIDEO_FRAME_COMP_PSTRIDE(&frame, 0)) * SAMPLING_STEP;
+
+    guint8* sample = m_samples.data();
+    for (unsigned int y = 0; y < m_grid_height; ++y)
+    {
+        const guint8* row = luma + y * row_stride;
+        for (unsigned int x = 0; x < m_grid_width; ++x)
+        {
+            *sample++ = row[x * sample_stride];
+        }
+    }
+
+    gst_video_frame_unmap(&frame);
+    return true;
+}
+
+void MotionDetector::update_state(unsigned int changed_permille) noexcept
+{
+    gint64 now = g_get_monotonic_time();
+    if (!m_motion)
+    {
+        m_moving_frames = (changed_permille >= m_configuration.start_permille) ? m_moving_frames + 1 : 0;
+        if (m_moving_frames < m_configuration.start_frames)
+        {
+            return;
+        }
+
+        m_motion = true;
+        m_last_motion_time = now;
+        m_motion_events.add();
+        g_print("Motion started (%u permille of the frame changed)\n", changed_permille);
+    }
+    else
+    {
+        if (changed_permille >= m_configuration.stop_permille)
+        {
+            m_last_motion_time = now;
+            return;
+        }
+
+        if (now - m_last_motion_time < static_cast<gint64>(m_configuration.post_roll) * G_TIME_SPAN_SECOND)
+        {
+            return;
+        }
+
+        m_motion = false;
+        m_moving_frames = 0;
+        g_print("Motion ended\n");
+    }
+
+    if (m_callback)
+    {
+        m_callback(m_motion);
+    }
+}
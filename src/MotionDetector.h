@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Configuration.h"
+#include "IStreamConsumer.h"
+#include "Metrics.h"
+
+#include <functional>
+#include <gst/video/video.h>
+#include <vector>
+
+// Called when motion starts (true) or ends (false), from the streaming
+// thread pushing the raw frames
+using MotionCallback = std::function<void(bool motion)>;
+
+// Frame difference motion detector fed with the raw frames of a camera.
+// The luma plane is sampled on a coarse grid, each sample being compared to
+// the same one of the previous frame (see count_changed_samples). Motion is
+// reported with hysteresis: it starts after several frames in a row with
+// enough changed samples, and ends once the changes stayed below a lower
+// ratio for the post-roll duration.
+//
+// Caps and buffers are pushed from the same streaming thread, from which the
+// detector state is only used.
+class MotionDetector final : public IStreamConsumer
+{
+  public:
+    MotionDetector() = default;
+
+    MotionDetector(MotionDetector&&) = delete;
+    MotionDetector& operator=(MotionDetector&&) = delete;
+    MotionDetector(const MotionDetector&) = delete;
+    MotionDetector& operator=(const MotionDetector&) = delete;
+
+    ~MotionDetector() override = default;
+
+    // To be called before any frame is pushed
+    void configure(const MotionConfiguration& configuration, MotionCallback callback) noexcept;
+
+    bool push_caps(unsigned int stream_idx, GstCaps* caps) noexcept override;
+    bool push_buffer(unsigned int stream_idx, GstBuffer* buffer) noexcept override;
+
+  private:
+    bool sample_luma(GstBuffer* buffer) noexcept;
+    void update_state(unsigned int changed_permille) noexcept;
+
+    MotionConfiguration m_configuration;
+    MotionCallback m_callback;
+
+    // Luma samples of the current and previous frames
+    GstVideoInfo m_video_info = {};
+    bool m_has_luma = false;
+    unsigned int m_grid_width = 0;
+    unsigned int m_grid_height = 0;
+    std::vector<guint8> m_samples;
+    std::vector<guint8> m_previous_samples;
+    bool m_has_previous_samples = false;
+
+    bool m_motion = false;
+    unsigned int m_moving_frames = 0;
+    gint64 m_last_motion_time = 0;
+
+    Counter m_analyzed_frames;
+    Counter m_motion_events;
+    Gauge m_changed_permille;
+    Histogram m_analysis_duration;
+};
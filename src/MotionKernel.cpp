@@ -0,0 +1,116 @@
+#include "MotionKernel.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+size_t count_changed_scalar(const uint8_t* current, const uint8_t* previous, size_t size, uint8_t threshold)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        int difference = static_cast<int>(current[i]) - static_cast<int>(previous[i]);
+        count += ((difference > threshold) || (-difference > threshold)) ? 1 : 0;
+    }
+
+    return count;
+}
+
+#if defined(__SSE2__)
+// Saturated subtractions in both directions give the absolute difference,
+// which is then zero where it does not exceed the threshold once the
+// threshold is subtracted too
+size_t count_changed_sse2(const uint8_t* current, const uint8_t* previous, size_t size, uint8_t threshold)
+{
+    const __m128i thresholds = _mm_set1_epi8(static_cast<char>(threshold));
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i))
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + i));
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        __m128i unchanged = _mm_cmpeq_epi8(_mm_subs_epu8(difference, thresholds), zero);
+        count += sizeof(__m128i) - static_cast<size_t>(__builtin_popcount(_mm_movemask_epi8(unchanged)));
+    }
+
+    return count + count_changed_scalar(current + i, previous + i, size - i, threshold);
+}
+
+__attribute__((target("avx2"))) size_t count_changed_avx2(const uint8_t* current, const uint8_t* previous,
+                                                           size_t size, uint8_t threshold)
+{
+    const __m256i thresholds = _mm256_set1_epi8(static_cast<char>(threshold));
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i))
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(previous + i));
+        __m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+        __m256i unchanged = _mm256_cmpeq_epi8(_mm256_subs_epu8(difference, thresholds), zero);
+        auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(unchanged));
+        count += sizeof(__m256i) - static_cast<size_t>(__builtin_popcount(mask));
+    }
+
+    return count + count_changed_sse2(current + i, previous + i, size - i, threshold);
+}
+#elif defined(__aarch64__)
+size_t count_changed_neon(const uint8_t* current, const uint8_t* previous, size_t size, uint8_t threshold)
+{
+    const uint8x16_t thresholds = vdupq_n_u8(threshold);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + sizeof(uint8x16_t) <= size; i += sizeof(uint8x16_t))
+    {
+        uint8x16_t difference = vabdq_u8(vld1q_u8(current + i), vld1q_u8(previous + i));
+        // Lanes are set to all ones where changed, hence 1 once shifted
+        uint8x16_t changed = vshrq_n_u8(vcgtq_u8(difference, thresholds), 7);
+        count += vaddvq_u8(changed);
+    }
+
+    return count + count_changed_scalar(current + i, previous + i, size - i, threshold);
+}
+#endif
+
+const MotionKernelImplementation& kernel_implementation()
+{
+    static const MotionKernelImplementation implementation = motion_kernel_implementations().front();
+    return implementation;
+}
+} // namespace
+
+std::vector<MotionKernelImplementation> motion_kernel_implementations() noexcept
+{
+    std::vector<MotionKernelImplementation> implementations;
+#if defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        implementations.push_back({count_changed_avx2, "AVX2"});
+    }
+    implementations.push_back({count_changed_sse2, "SSE2"});
+#elif defined(__aarch64__)
+    implementations.push_back({count_changed_neon, "NEON"});
+#endif
+    implementations.push_back({count_changed_scalar, "scalar"});
+    return implementations;
+}
+
+size_t count_changed_samples(const uint8_t* current, const uint8_t* previous, size_t size, uint8_t threshold) noexcept
+{
+    return kernel_implementation().count_changed_samples(current, previous, size, threshold);
+}
+
+const char* motion_kernel_name() noexcept
+{
+    return kernel_implementation().name;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Number of samples whose value differs by more than the threshold between
+// two frames of the same size (absolute difference).
+//
+// The vectorized implementation is selected on first use from the ones
+// supported by the CPU (AVX2 or SSE2 on x86, NEON on AArch64), with a scalar
+// fallback, all of them giving the same result.
+size_t count_changed_samples(const uint8_t* current, const uint8_t* previous, size_t size,
+                             uint8_t threshold) noexcept;
+
+// Name of the selected implementation, for logging
+const char* motion_kernel_name() noexcept;
+
+struct MotionKernelImplementation
+{
+    size_t (*count_changed_samples)(const uint8_t* current, const uint8_t* previous, size_t size, uint8_t threshold);
+    const char* name;
+};
+
+// Implementations supported by the CPU in order of preference, the first one
+// being selected and the scalar one always coming last (for tests and
+// benchmarks)
+std::vector<MotionKernelImplementation> motion_kernel_implementations() noexcept;
@@ -0,0 +1,203 @@
+#include "PreRecordBuffer.h"
+
+#include <cassert>
+
+namespace
+{
+GstClockTime get_timestamp(GstClockTime pts, GstClockTime dts)
+{
+    return GST_CLOCK_TIME_IS_VALID(dts) ? dts : pts;
+}
+} // namespace
+
+bool PreRecordBuffer::allocate(gsize budget_in_bytes, unsigned int max_access_units, GstClockTime duration) noexcept
+{
+    if ((budget_in_bytes == 0) || (max_access_units == 0))
+    {
+        return false;
+    }
+
+    m_slab.assign(budget_in_bytes, 0);
+    m_access_units.assign(max_access_units, AccessUnit());
+    m_duration = duration;
+    clear();
+    return true;
+}
+
+void PreRecordBuffer::release() noexcept
+{
+    clear();
+    m_slab = std::vector<guint8>();
+    m_access_units = std::vector<AccessUnit>();
+}
+
+void PreRecordBuffer::clear() noexcept
+{
+    m_first_access_unit = 0;
+    m_nb_access_units = 0;
+    m_write_offset = 0;
+}
+
+bool PreRecordBuffer::find_space(gsize size, gsize& offset) const noexcept
+{
+    if (m_nb_access_units == 0)
+    {
+        offset = 0;
+        return (size <= m_slab.size());
+    }
+
+    // Access units are stored contiguously, the write offset wrapping to the
+    // beginning of the slab when there is not enough room at its end.
+    gsize tail = at(0).offset;
+    if (m_write_offset > tail)
+    {
+        if (m_slab.size() - m_write_offset >= size)
+        {
+            offset = m_write_offset;
+            return true;
+        }
+
+        if (size <= tail)
+        {
+            offset = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    if (tail - m_write_offset >= size)
+    {
+        offset = m_write_offset;
+        return true;
+    }
+
+    return false;
+}
+
+void PreRecordBuffer::evict_gop() noexcept
+{
+    // Drop the oldest keyframe and all its dependent frames, so that the ring
+    // still starts with a keyframe.
+    do
+    {
+        m_first_access_unit = (m_first_access_unit + 1) % m_access_units.size();
+        --m_nb_access_units;
+    } while ((m_nb_access_units > 0) && !at(0).is_keyframe);
+
+    if (m_nb_access_units == 0)
+    {
+        m_write_offset = 0;
+    }
+}
+
+void PreRecordBuffer::trim_to_duration() noexcept
+{
+    if (!GST_CLOCK_TIME_IS_VALID(m_duration))
+    {
+        return;
+    }
+
+    // Evict the oldest GOP as long as the remaining ones still cover the
+    // requested duration
+    while (m_nb_access_units > 1)
+    {
+        const AccessUnit& newest = at(m_nb_access_units - 1);
+        GstClockTime newest_ts = get_timestamp(newest.pts, newest.dts);
+
+        unsigned int next_keyframe = 1;
+        while ((next_keyframe < m_nb_access_units) && !at(next_keyframe).is_keyframe)
+        {
+            ++next_keyframe;
+        }
+
+        if (next_keyframe == m_nb_access_units)
+        {
+            return;
+        }
+
+        const AccessUnit& keyframe = at(next_keyframe);
+        GstClockTime keyframe_ts = get_timestamp(keyframe.pts, keyframe.dts);
+        if (!GST_CLOCK_TIME_IS_VALID(newest_ts) || !GST_CLOCK_TIME_IS_VALID(keyframe_ts) ||
+            (newest_ts < keyframe_ts + m_duration))
+        {
+            return;
+        }
+
+        evict_gop();
+    }
+}
+
+void PreRecordBuffer::push(GstBuffer* buffer) noexcept
+{
+    assert(buffer != nullptr);
+
+    if (m_slab.empty())
+    {
+        return;
+    }
+
+    bool is_keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    gsize size = gst_buffer_get_size(buffer);
+    if (size > m_slab.size())
+    {
+        // Cannot store this access unit, the following ones would be undecodable
+        clear();
+        return;
+    }
+
+    if ((size == 0) || (!is_keyframe && (m_nb_access_units == 0)))
+    {
+        return;
+    }
+
+    if (m_nb_access_units == m_access_units.size())
+    {
+        evict_gop();
+    }
+
+    gsize offset = 0;
+    while (!find_space(size, offset))
+    {
+        evict_gop();
+    }
+
+    if (!is_keyframe && (m_nb_access_units == 0))
+    {
+        // The whole GOP has been evicted to make room for this access unit
+        return;
+    }
+
+    gst_buffer_extract(buffer, 0, &m_slab[offset], size);
+
+    AccessUnit& access_unit = m_access_units[(m_first_access_unit + m_nb_access_units) % m_access_units.size()];
+    access_unit.offset = offset;
+    access_unit.size = size;
+    access_unit.pts = GST_BUFFER_PTS(buffer);
+    access_unit.dts = GST_BUFFER_DTS(buffer);
+    access_unit.duration = GST_BUFFER_DURATION(buffer);
+    access_unit.is_keyframe = is_keyframe;
+
+    ++m_nb_access_units;
+    ++m_nb_stored_access_units;
+    m_write_offset = offset + size;
+
+    trim_to_duration();
+}
+
+GstBuffer* PreRecordBuffer::copy_access_unit(unsigned int idx) const noexcept
+{
+    assert(idx < m_nb_access_units);
+
+    const AccessUnit& access_unit = at(idx);
+    GstBuffer* buffer = gst_buffer_new_memdup(&m_slab[access_unit.offset], access_unit.size);
+    GST_BUFFER_PTS(buffer) = access_unit.pts;
+    GST_BUFFER_DTS(buffer) = access_unit.dts;
+    GST_BUFFER_DURATION(buffer) = access_unit.duration;
+    if (!access_unit.is_keyframe)
+    {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    return buffer;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include <vector>
+
+// Bounded ring of encoded access units, always starting with a keyframe.
+//
+// Access units data are copied into a single slab allocated once, so that
+// the ring can be fed continuously without any per-frame allocation. When
+// the byte budget, the number of access units or the duration is exceeded,
+// the oldest GOP is evicted.
+//
+// A ring is not thread-safe: accesses must be synchronized by the caller.
+class PreRecordBuffer final
+{
+  public:
+    PreRecordBuffer() = default;
+
+    PreRecordBuffer(PreRecordBuffer&&) = delete;
+    PreRecordBuffer& operator=(PreRecordBuffer&&) = delete;
+    PreRecordBuffer(const PreRecordBuffer&) = delete;
+    PreRecordBuffer& operator=(const PreRecordBuffer&) = delete;
+
+    ~PreRecordBuffer() = default;
+
+    bool allocate(gsize budget_in_bytes, unsigned int max_access_units, GstClockTime duration) noexcept;
+    void release() noexcept;
+
+    void push(GstBuffer* buffer) noexcept;
+    void clear() noexcept;
+
+    bool is_empty() const noexcept
+    {
+        return (m_nb_access_units == 0);
+    }
+
+    unsigned int size() const noexcept
+    {
+        return m_nb_access_units;
+    }
+
+    // Access units are numbered in their storage order, so that the ones
+    // stored since a previous read can be told apart
+    guint64 oldest_number() const noexcept
+    {
+        return m_nb_stored_access_units - m_nb_access_units;
+    }
+
+    // Create a new buffer holding a copy of the idx-th oldest access unit
+    GstBuffer* copy_access_unit(unsigned int idx) const noexcept;
+
+  private:
+    struct AccessUnit
+    {
+        gsize offset = 0;
+        gsize size = 0;
+        GstClockTime pts = GST_CLOCK_TIME_NONE;
+        GstClockTime dts = GST_CLOCK_TIME_NONE;
+        GstClockTime duration = GST_CLOCK_TIME_NONE;
+        bool is_keyframe = false;
+    };
+
+    const AccessUnit& at(unsigned int idx) const noexcept
+    {
+        return m_access_units[(m_first_access_unit + idx) % m_access_units.size()];
+    }
+
+    bool find_space(gsize size, gsize& offset) const noexcept;
+    void evict_gop() noexcept;
+    void trim_to_duration() noexcept;
+
+    std::vector<guint8> m_slab;
+    std::vector<AccessUnit> m_access_units;
+    GstClockTime m_duration = GST_CLOCK_TIME_NONE;
+
+    unsigned int m_first_access_unit = 0;
+    unsigned int m_nb_access_units = 0;
+    gsize m_write_offset = 0;
+    guint64 m_nb_stored_access_units = 0;
+};
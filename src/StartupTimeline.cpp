@@ -0,0 +1,48 @@
+#include "StartupTimeline.h"
+
+#include <atomic>
+#include <glib.h>
+
+namespace
+{
+constexpr auto NB_MILESTONES = static_cast<unsigned int>(StartupMilestone::NB_MILESTONES);
+constexpr const char* MILESTONE_NAMES[NB_MILESTONES] = {
+    "GStreamer initialized", "streaming server configured", "stream recorder ready", "image writer ready",
+    "encoding pipeline started", "streaming server started", "first frame captured", "first frame encoded",
+    "first frame served"};
+
+struct Timeline
+{
+    std::atomic<gint64> start_time{0};
+    std::atomic<bool> reached[NB_MILESTONES] = {};
+};
+
+Timeline& timeline()
+{
+    static Timeline timeline;
+    return timeline;
+}
+} // namespace
+
+void start_startup_timeline() noexcept
+{
+    timeline().start_time.store(g_get_monotonic_time());
+}
+
+void mark_startup_milestone(StartupMilestone milestone) noexcept
+{
+    auto idx = static_cast<unsigned int>(milestone);
+    if (idx >= NB_MILESTONES)
+    {
+        return;
+    }
+
+    Timeline& startup = timeline();
+    if (startup.reached[idx].load(std::memory_order_relaxed) || startup.reached[idx].exchange(true))
+    {
+        return;
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - startup.start_time.load();
+    g_print("Startup: %s after %.1f ms\n", MILESTONE_NAMES[idx], static_cast<double>(elapsed) / 1000.0);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Milestones of the application bring-up, logged with their delay since the
+// timeline start. Each milestone is only logged the first time it is
+// reached, so that marks can stay on the streaming hot paths (a relaxed
+// atomic load once reached).
+enum class StartupMilestone
+{
+    GST_INITIALIZED,
+    SERVER_CONFIGURED,
+    RECORDER_READY,
+    IMAGE_WRITER_READY,
+    PIPELINE_STARTED,
+    SERVER_STARTED,
+    FIRST_FRAME_CAPTURED,
+    FIRST_FRAME_ENCODED,
+    FIRST_FRAME_SERVED,
+    NB_MILESTONES
+};
+
+// To be called first thing in main
+void start_startup_timeline() noexcept;
+void mark_startup_milestone(StartupMilestone milestone) noexcept;
@@ -1,101 +1,550 @@
 #include "StreamRecorder.h"
 
+#include "CaptureTimeMeta.h"
+#include "ElementFactory.h"
+
 #include <cassert>
 #include <gst/app/app.h>
+#include <string>
+#include <utility>
 
 namespace
 {
 constexpr GstClockTime EOS_PROPAGATION_TIMEOUT = 5 * GST_SECOND;
 constexpr GstClockTime WAITING_FOR_PLAYING_STATE_TIMEOUT = 3 * GST_SECOND;
+
+// Pre-recording of the main encoded stream, sized for a few seconds at the
+// encoding pipeline bitrates
+constexpr unsigned int PRE_RECORD_STREAM_IDX = 0;
+constexpr gsize PRE_RECORD_BUDGET_IN_BYTES = 2 * 1024 * 1024;
+constexpr unsigned int PRE_RECORD_MAX_ACCESS_UNITS = 512;
+
+// Queue of the passthrough entry point, which leaks its oldest buffers when
+// full. Raised while pre-recorded access units are flushed, so that the
+// leading keyframe is not leaked before the recording pipeline consumes it.
+constexpr guint PASSTHROUGH_MAX_BUFFERS = 30;
+constexpr guint FLUSH_MAX_BUFFERS = PRE_RECORD_MAX_ACCESS_UNITS + PASSTHROUGH_MAX_BUFFERS;
+
+// Recording pipelines are built element by element whenever a recording
+// starts (their topology depends on the recording options), which is cheaper
+// than parsing a launch description each time.
+constexpr char REENCODED_CAPS[] = "video/x-h264,profile=high,stream-format=byte-stream";
+constexpr char FRAGMENT_MUXER_PROPERTIES[] = "properties,fragment-duration=(uint)1000";
+
+// The re-encoding pipeline runs its own high quality encoder on the raw
+// frames, while the passthrough one only parses an encoded stream coming from
+// the encoding pipeline.
+// Buffers keep their original timestamps (rebased on the first recorded one),
+// as pre-recorded access units are pushed all at once.
+bool add_source_elements(GstBin* bin, RecordingMode mode) noexcept
+{
+    if (mode == RecordingMode::REENCODE)
+    {
+        return add_and_link(bin, {make_element("appsrc", "entry-point",
+                                               {{"is-live", "true"},
+                                                {"do-timestamp", "false"},
+                                                {"emit-signals", "false"},
+                                                {"format", "time"},
+                                                {"leaky-type", "downstream"},
+                                                {"max-buffers", "5"}}),
+                                  make_element("videoconvert", nullptr),
+                                  make_element("vaapih264enc", nullptr,
+                                               {{"bitrate", "2048"},
+                                                {"cabac", "true"},
+                                                {"dct8x8", "true"},
+                                                {"keyframe-period", "0"},
+                                                {"quality-level", "2"},
+                                                {"rate-control", "vbr"}}),
+                                  make_element("capsfilter", nullptr, {{"caps", REENCODED_CAPS}}),
+                                  make_element("h264parse", "parser")});
+    }
+
+    return add_and_link(bin, {make_element("appsrc", "entry-point",
+                                           {{"is-live", "true"},
+                                            {"do-timestamp", "false"},
+                                            {"emit-signals", "false"},
+                                            {"format", "time"},
+                                            {"leaky-type", "downstream"},
+                                            {"max-buffers", std::to_string(PASSTHROUGH_MAX_BUFFERS).c_str()}}),
+                              make_element("h264parse", "parser")});
+}
+
+// Single file recordings are only finalized on EOS, while segmented ones are
+// rotated on keyframes by splitmuxsink and written as fragmented MP4, so that
+// a crash loses at most the last fragment.
+bool add_sink_elements(GstBin* bin, bool segmented) noexcept
+{
+    GstElement* parser = gst_bin_get_by_name(bin, "parser");
+    assert(parser != nullptr);
+
+    bool linked = false;
+    if (segmented)
+    {
+        GstElement* sink = make_element("splitmuxsink", "file-output",
+                                        {{"async-finalize", "false"},
+                                         {"muxer-factory", "mp4mux"},
+                                         {"muxer-properties", FRAGMENT_MUXER_PROPERTIES}});
+        linked = add_and_link(bin, {sink}) && gst_element_link(parser, sink);
+    }
+    else
+    {
+        GstElement* muxer = make_element("qtmux", nullptr);
+        linked = add_and_link(bin, {muxer, make_element("filesink", "file-output",
+                                                        {{"enable-last-sample", "false"}, {"qos", "true"}})}) &&
+                 gst_element_link(parser, muxer);
+    }
+
+    gst_object_unref(parser);
+    return linked;
+}
 } // namespace
 
-bool StreamRecorder::create_pipeline() noexcept
+bool StreamRecorder::create_pipeline(RecordingMode mode, bool segmented) noexcept
 {
     assert(m_pipeline == nullptr);
 
-    GError* error = nullptr;
-    GstElement* pipeline = gst_parse_launch(
-        "appsrc name=entry-point is-live=true do-timestamp=true emit-signals=false format=time leaky-type=downstream "
-        "max-buffers=5 ! videoconvert ! vaapih264enc bitrate=2048 cabac=true dct8x8=true keyframe-period=0 "
-        "quality-level=2 rate-control=vbr ! video/x-h264,profile=high,stream-format=byte-stream ! h264parse ! qtmux ! "
-        "filesink name=file-output enable-last-sample=false qos=true",
-        &error);
+    GstElement* pipeline = gst_pipeline_new("stream-recorder");
+    if (!add_source_elements(GST_BIN(pipeline), mode) || !add_sink_elements(GST_BIN(pipeline), segmented))
+    {
+        g_printerr("ERROR: cannot create stream recorder pipeline\n");
+        gst_object_unref(gst_object_ref_sink(pipeline));
+        return false;
+    }
+
+    m_pipeline = GST_PIPELINE(gst_object_ref_sink(pipeline));
+
+    GstBus* bus = gst_pipeline_get_bus(m_pipeline);
+    assert(bus != nullptr);
+    m_bus_source = gst_bus_create_watch(bus);
+    g_source_set_callback(m_bus_source, G_SOURCE_FUNC(on_bus_message), this, nullptr);
+    g_source_attach(m_bus_source, m_context);
+    gst_object_unref(bus);
+
+    // Latency is measured on the parsed stream entering the muxer
+    GstElement* parser = gst_bin_get_by_name(GST_BIN(m_pipeline), "parser");
+    assert(parser != nullptr);
+    GstPad* parser_pad = gst_element_get_static_pad(parser, "src");
+    assert(parser_pad != nullptr);
+    gst_pad_add_probe(parser_pad, GST_PAD_PROBE_TYPE_BUFFER, reinterpret_cast<GstPadProbeCallback>(on_parsed_buffer),
+                      &m_latency, nullptr);
+    gst_object_unref(parser_pad);
+    gst_object_unref(parser);
+
+    GstElement* appsrc = gst_bin_get_by_name(GST_BIN(m_pipeline), "entry-point");
+    assert(appsrc != nullptr);
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    assert(m_appsrc == nullptr);
+    m_appsrc = appsrc;
+    m_max_buffers_raised = false;
+    m_options.mode = mode;
+    m_options.segmented = segmented;
+    return true;
+}
+
+GstPadProbeReturn StreamRecorder::on_parsed_buffer(GstPad* pad, GstPadProbeInfo* info, Histogram* latency) noexcept
+{
+    assert(pad != nullptr);
+    assert(info != nullptr);
+    assert(latency != nullptr);
+
+    if (info->data != nullptr)
+    {
+        latency->observe(get_capture_latency(GST_BUFFER(info->data)));
+    }
+
+    return GST_PAD_PROBE_OK;
+}
 
-    if (pipeline == nullptr)
+void StreamRecorder::release_pipeline() noexcept
+{
     {
-        if (error != nullptr)
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_appsrc != nullptr)
         {
-            g_printerr("ERROR: cannot create stream recorder pipeline (%s)\n", error->message);
-            g_error_free(error);
+            gst_object_unref(m_appsrc);
+            m_appsrc = nullptr;
         }
-        else
+    }
+
+    if (m_pipeline != nullptr)
+    {
+        g_source_destroy(m_bus_source);
+        g_source_unref(m_bus_source);
+        m_bus_source = nullptr;
+
+        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+        gst_object_unref(m_pipeline);
+        m_pipeline = nullptr;
+    }
+}
+
+gboolean StreamRecorder::on_bus_message(GstBus* /*bus*/, GstMessage* message, StreamRecorder* recorder) noexcept
+{
+    assert(message != nullptr);
+    assert(recorder != nullptr);
+
+    switch (GST_MESSAGE_TYPE(message))
+    {
+    case GST_MESSAGE_STATE_CHANGED:
+        if ((recorder->m_state == State::STARTING) && (GST_MESSAGE_SRC(message) == GST_OBJECT(recorder->m_pipeline)))
         {
-            g_printerr("ERROR: cannot create stream recorder pipeline (unspecified error)\n");
+            GstState new_state = GST_STATE_NULL;
+            gst_message_parse_state_changed(message, nullptr, &new_state, nullptr);
+            if (new_state == GST_STATE_PLAYING)
+            {
+                recorder->complete_start();
+            }
         }
+        break;
 
-        return false;
+    case GST_MESSAGE_ELEMENT: {
+        const GstStructure* msg_struct = gst_message_get_structure(message);
+        if (gst_structure_has_name(msg_struct, "splitmuxsink-fragment-closed"))
+        {
+            const gchar* location = gst_structure_get_string(msg_struct, "location");
+            gchar* absolute_path = g_canonicalize_filename(location, nullptr);
+            g_print("Video segment written to %s\n", absolute_path);
+            g_free(absolute_path);
+        }
+        break;
     }
 
-    if (error != nullptr)
+    case GST_MESSAGE_EOS:
+        if (recorder->m_state == State::STOPPING)
+        {
+            recorder->complete_stop(true);
+        }
+        break;
+
+    case GST_MESSAGE_ERROR: {
+        GError* error = nullptr;
+        gst_message_parse_error(message, &error, nullptr);
+        g_printerr("ERROR: stream recorder pipeline failure (%s)\n",
+                   (error != nullptr) ? error->message : "unspecified error");
+        g_clear_error(&error);
+
+        if (recorder->m_state == State::STARTING)
+        {
+            recorder->fail_start();
+        }
+        else if (recorder->m_state != State::IDLE)
+        {
+            recorder->complete_stop(false);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean StreamRecorder::on_timeout(StreamRecorder* recorder) noexcept
+{
+    assert(recorder != nullptr);
+
+    g_source_unref(recorder->m_timeout_source);
+    recorder->m_timeout_source = nullptr;
+    if (recorder->m_state == State::STARTING)
     {
-        g_printerr("WARNING: fixed issue encountered while creating stream recorder pipeline (%s)\n", error->message);
-        g_error_free(error);
+        g_printerr("ERROR: cannot change stream recorder pipeline to PLAYING state\n");
+        recorder->fail_start();
+    }
+    else if (recorder->m_state == State::STOPPING)
+    {
+        g_printerr("WARNING: not receiving EOS message, grabbed video may be corrupted\n");
+        recorder->complete_stop(false);
     }
 
-    m_pipeline = GST_PIPELINE(gst_object_ref_sink(pipeline));
-    return true;
+    return G_SOURCE_REMOVE;
+}
+
+void StreamRecorder::arm_timeout(GstClockTime timeout) noexcept
+{
+    disarm_timeout();
+    m_timeout_source = g_timeout_source_new(static_cast<guint>(GST_TIME_AS_MSECONDS(timeout)));
+    g_source_set_callback(m_timeout_source, reinterpret_cast<GSourceFunc>(on_timeout), this, nullptr);
+    g_source_attach(m_timeout_source, m_context);
 }
 
-void StreamRecorder::finish_grabbing() noexcept
+void StreamRecorder::disarm_timeout() noexcept
+{
+    if (m_timeout_source != nullptr)
+    {
+        g_source_destroy(m_timeout_source);
+        g_source_unref(m_timeout_source);
+        m_timeout_source = nullptr;
+    }
+}
+
+bool StreamRecorder::send_eos() noexcept
 {
     assert(m_pipeline != nullptr);
-    assert(m_appsrc != nullptr);
 
-    GstState state = GST_STATE_NULL;
-    GstStateChangeReturn ret = gst_element_get_state(GST_ELEMENT(m_pipeline), &state, nullptr, 0);
-    if ((ret != GST_STATE_CHANGE_SUCCESS) || (state != GST_STATE_PLAYING))
     {
-        return;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_recording = false;
     }
 
+    GstElement* appsrc = gst_bin_get_by_name(GST_BIN(m_pipeline), "entry-point");
+    assert(appsrc != nullptr);
+
     g_print("Finishing grabbing...\n");
-    if (gst_app_src_end_of_stream(GST_APP_SRC(m_appsrc)) != GST_FLOW_OK)
+    GstFlowReturn ret = gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    gst_object_unref(appsrc);
+    if (ret != GST_FLOW_OK)
     {
         g_printerr("WARNING: cannot send EOS event to the pipeline, grabbed video may be corrupted\n");
-        return;
+        return false;
     }
 
+    return true;
+}
+
+bool StreamRecorder::wait_for_eos() noexcept
+{
+    assert(m_pipeline != nullptr);
+
     GstBus* bus = gst_pipeline_get_bus(m_pipeline);
     assert(bus != nullptr);
     GstMessage* eos_message = gst_bus_timed_pop_filtered(bus, EOS_PROPAGATION_TIMEOUT, GST_MESSAGE_EOS);
     gst_object_unref(bus);
 
-    if (eos_message != nullptr)
+    if (eos_message == nullptr)
     {
-        gst_message_unref(eos_message);
+        g_printerr("WARNING: not receiving EOS message, grabbed video may be corrupted\n");
+        return false;
+    }
+
+    gst_message_unref(eos_message);
+    return true;
+}
+
+void StreamRecorder::complete_start() noexcept
+{
+    assert(m_state == State::STARTING);
+    disarm_timeout();
+
+    // Flush pre-recorded access units first, the live ones will follow them
+    GstElement* flushed_appsrc = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_timestamp_offset = GST_CLOCK_TIME_NONE;
+        m_waiting_for_keyframe = (m_options.mode == RecordingMode::PASSTHROUGH);
+
+        if ((m_options.mode == RecordingMode::PASSTHROUGH) && (m_options.stream_idx == PRE_RECORD_STREAM_IDX) &&
+            !m_pre_record_buffer.is_empty())
+        {
+            flushed_appsrc = GST_ELEMENT(gst_object_ref(m_appsrc));
+            gst_app_src_set_max_buffers(GST_APP_SRC(m_appsrc), FLUSH_MAX_BUFFERS);
+            m_max_buffers_raised = true;
+        }
+        else
+        {
+            m_recording = true;
+        }
+    }
+
+    if (flushed_appsrc != nullptr)
+    {
+        unsigned int nb_flushed = flush_pre_recording(flushed_appsrc);
+        gst_object_unref(flushed_appsrc);
+        g_print("%u pre-recorded frames flushed\n", nb_flushed);
+    }
+
+    m_state = State::RECORDING;
+    ++m_video_idx;
+    m_start_latency.observe((g_get_monotonic_time() - m_start_request_time) * GST_USECOND);
+
+    const char* output = m_options.segmented ? "segments" : "file";
+    if (m_options.mode == RecordingMode::REENCODE)
+    {
+        g_print("Start recording video %s to %s (re-encoding raw stream)\n", output, m_filename.c_str());
     }
     else
     {
-        g_printerr("WARNING: not receiving EOS message, grabbed video may be corrupted\n");
+        g_print("Start recording video %s to %s (encoded stream #%u)\n", output, m_filename.c_str(),
+                m_options.stream_idx);
+    }
+
+    RecordingCallback callback = std::move(m_start_callback);
+    m_start_callback = nullptr;
+    if (callback)
+    {
+        callback(true, m_filename.c_str());
+    }
+}
+
+unsigned int StreamRecorder::flush_pre_recording(GstElement* appsrc) noexcept
+{
+    // Access units are copied under the lock but pushed without it, so that
+    // the encoder streaming thread is not blocked by the flush. The ones
+    // stored meanwhile are flushed in turn, until the live ones can follow.
+    // As the pushes never block, a round only lasts for a few frames: the
+    // ring would have to be entirely renewed during one of them to evict
+    // access units not flushed yet.
+    std::vector<GstBuffer*> access_units;
+    access_units.reserve(PRE_RECORD_MAX_ACCESS_UNITS);
+    bool first_round = true;
+    guint64 next_number = 0;
+    unsigned int nb_flushed = 0;
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            guint64 oldest_number = m_pre_record_buffer.oldest_number();
+            guint64 end_number = oldest_number + m_pre_record_buffer.size();
+            if (first_round)
+            {
+                next_number = oldest_number;
+                first_round = false;
+            }
+            else if (next_number < oldest_number)
+            {
+                // Whole GOPs being evicted, the flush goes on with a keyframe
+                guint64 nb_evicted = oldest_number - next_number;
+                m_dropped_buffers.add(nb_evicted);
+                g_printerr("WARNING: %" G_GUINT64_FORMAT " pre-recorded frames evicted before being flushed\n",
+                           nb_evicted);
+                next_number = oldest_number;
+            }
+
+            for (guint64 number = next_number; number < end_number; ++number)
+            {
+                GstBuffer* access_unit =
+                    m_pre_record_buffer.copy_access_unit(static_cast<unsigned int>(number - oldest_number));
+                rebase_timestamps(access_unit, access_unit);
+                access_units.push_back(access_unit);
+            }
+            next_number = end_number;
+
+            if (access_units.empty())
+            {
+                m_waiting_for_keyframe = false;
+                m_recording = true;
+                return nb_flushed;
+            }
+        }
+
+        for (GstBuffer* access_unit : access_units)
+        {
+            push_to_appsrc(appsrc, access_unit);
+        }
+        nb_flushed += static_cast<unsigned int>(access_units.size());
+        access_units.clear();
+    }
+}
+
+void StreamRecorder::restore_max_buffers() noexcept
+{
+    // Called with the mutex held, once the flushed access units are consumed
+    // (or the recording stopped)
+    if (m_max_buffers_raised && (m_appsrc != nullptr))
+    {
+        gst_app_src_set_max_buffers(GST_APP_SRC(m_appsrc), PASSTHROUGH_MAX_BUFFERS);
+    }
+    m_max_buffers_raised = false;
+}
+
+void StreamRecorder::fail_start() noexcept
+{
+    assert(m_state == State::STARTING);
+    disarm_timeout();
+
+    gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+    m_state = State::IDLE;
+    release_recorded_stream();
+
+    RecordingCallback callback = std::move(m_start_callback);
+    m_start_callback = nullptr;
+    if (callback)
+    {
+        callback(false, m_filename.c_str());
+    }
+}
+
+void StreamRecorder::complete_stop(bool success) noexcept
+{
+    assert((m_state == State::RECORDING) || (m_state == State::STOPPING));
+    disarm_timeout();
+
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_recording = false;
+        restore_max_buffers();
+    }
+
+    gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+    m_state = State::IDLE;
+    release_recorded_stream();
+    g_print("Stream recorder stopped\n");
+
+    RecordingCallback callback = std::move(m_stop_callback);
+    m_stop_callback = nullptr;
+    if (callback)
+    {
+        callback(success, m_filename.c_str());
+    }
+}
+
+void StreamRecorder::release_recorded_stream() noexcept
+{
+    if (m_recorded_stream_subscribed)
+    {
+        m_stream_controller->unsubscribe(m_options.stream_idx);
+        m_recorded_stream_subscribed = false;
     }
 }
 
-bool StreamRecorder::init() noexcept
+bool StreamRecorder::init(GMainContext* context, IStreamController& stream_controller,
+                          const RecordingConfiguration& configuration) noexcept
 {
+    assert(context != nullptr);
+
     if (m_pipeline != nullptr)
     {
-        assert(m_appsrc != nullptr);
         return true;
     }
 
-    assert(m_appsrc == nullptr);
-    if (!create_pipeline())
+    m_context = context;
+    m_stream_controller = &stream_controller;
+
+    if (!create_pipeline(RecordingOptions().mode, RecordingOptions().segmented))
     {
         return false;
     }
 
-    m_appsrc = gst_bin_get_by_name(GST_BIN(m_pipeline), "entry-point");
-    assert(m_appsrc != nullptr);
+    if (configuration.pre_record > 0)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_pre_record_buffer.allocate(PRE_RECORD_BUDGET_IN_BYTES, PRE_RECORD_MAX_ACCESS_UNITS,
+                                          configuration.pre_record * GST_SECOND))
+        {
+            g_printerr("WARNING: cannot allocate pre-recording buffer\n");
+        }
+        else
+        {
+            m_pre_recording = true;
+        }
+    }
+
+    // The pre-recorded stream is encoded all along
+    if (m_pre_recording)
+    {
+        m_stream_controller->subscribe(PRE_RECORD_STREAM_IDX);
+    }
+
+    m_recorded_buffers.publish("rtspcam_recorder_buffers_total", "Buffers pushed to the recording pipeline");
+    m_dropped_buffers.publish("rtspcam_recorder_dropped_buffers_total",
+                              "Buffers dropped by the leaky recording pipeline entry point");
+    m_push_failures.publish("rtspcam_recorder_push_failures_total", "Buffers refused by the recording pipeline");
+    m_queued_buffers.publish("rtspcam_recorder_queued_buffers", "Buffers queued in the recording pipeline entry point");
+    m_start_latency.publish("rtspcam_recorder_start_latency_seconds",
+                            "Delay between a recording request and the recording start");
+    m_latency.publish("rtspcam_recorder_latency_seconds", "Delay between the capture and the recording muxer");
 
     g_print("Stream recorder configured\n");
     return true;
@@ -103,44 +552,122 @@ bool StreamRecorder::init() noexcept
 
 void StreamRecorder::shut() noexcept
 {
-    stop_recording();
+    // The recorded file is synchronously finalized here, as the recorder
+    // context may not be iterated anymore.
+    if (m_state == State::STARTING)
+    {
+        fail_start();
+    }
+    else if (m_state == State::RECORDING)
+    {
+        complete_stop(send_eos() && wait_for_eos());
+    }
+    else if (m_state == State::STOPPING)
+    {
+        complete_stop(wait_for_eos());
+    }
+
+    release_pipeline();
 
-    if (m_appsrc != nullptr)
+    if (m_pre_recording)
     {
-        gst_object_unref(m_appsrc);
-        m_appsrc = nullptr;
+        m_stream_controller->unsubscribe(PRE_RECORD_STREAM_IDX);
+        m_pre_recording = false;
     }
 
-    if (m_pipeline != nullptr)
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_pre_record_buffer.release();
+
+    if (m_raw_caps != nullptr)
     {
-        gst_object_unref(m_pipeline);
-        m_pipeline = nullptr;
+        gst_caps_unref(m_raw_caps);
+        m_raw_caps = nullptr;
+    }
+
+    for (GstCaps*& caps : m_encoded_caps)
+    {
+        if (caps != nullptr)
+        {
+            gst_caps_unref(caps);
+            caps = nullptr;
+        }
     }
 }
 
-bool StreamRecorder::start_recording() noexcept
+bool StreamRecorder::start_recording(const RecordingOptions& options, RecordingCallback callback) noexcept
 {
-    if (m_pipeline == nullptr)
+    if ((m_pipeline == nullptr) || (m_state != State::IDLE))
     {
         return false;
     }
 
-    assert(m_appsrc != nullptr);
-    if (is_recording())
+    // Rebuild the recording pipeline when the requested mode or output differs
+    // from the previous recording one
+    bool same_pipeline = false;
     {
-        return true;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        same_pipeline = (m_options.mode == options.mode) && (m_options.segmented == options.segmented);
+    }
+
+    if (!same_pipeline)
+    {
+        release_pipeline();
+        if (!create_pipeline(options.mode, options.segmented))
+        {
+            g_printerr("ERROR: cannot create stream recorder pipeline for the requested mode\n");
+            return false;
+        }
     }
 
-    // Set output filename for the recorded video
-    char filename[16]; // until "./video_999.mp4", just in case // NOLINT
-    g_snprintf(filename, sizeof(filename), "./video_%03u.mp4", m_video_idx);
+    // Select the recorded stream, its caps must already be known
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        assert(m_appsrc != nullptr);
+
+        GstCaps* caps = nullptr;
+        if (options.mode == RecordingMode::REENCODE)
+        {
+            caps = m_raw_caps;
+        }
+        else if (options.stream_idx < m_encoded_caps.size())
+        {
+            caps = m_encoded_caps[options.stream_idx];
+        }
+
+        if (caps == nullptr)
+        {
+            g_printerr("ERROR: cannot start recording, no data received yet for the requested stream\n");
+            return false;
+        }
+
+        g_object_set(m_appsrc, "caps", caps, nullptr);
+        m_options = options;
+    }
 
+    // Set output filename for the recorded video, or the filename pattern of
+    // its segments
+    char filename[22]; // until "./video_999_%05d.mp4", just in case // NOLINT
     GstElement* sink = gst_bin_get_by_name(GST_BIN(m_pipeline), "file-output");
     assert(sink != nullptr);
-    g_object_set(sink, "location", filename, nullptr);
+    if (options.segmented)
+    {
+        g_snprintf(filename, sizeof(filename), "./video_%03u_%%05d.mp4", m_video_idx);
+        g_object_set(sink, "location", filename, "max-size-time", options.segment_duration, "max-size-bytes",
+                     options.segment_size, nullptr);
+    }
+    else
+    {
+        g_snprintf(filename, sizeof(filename), "./video_%03u.mp4", m_video_idx);
+        g_object_set(sink, "location", filename, nullptr);
+    }
     gst_object_unref(sink);
 
-    // Start recording pipeline
+    gchar* absolute_path = g_canonicalize_filename(filename, nullptr);
+    m_filename = absolute_path;
+    g_free(absolute_path);
+
+    // Start recording pipeline, the PLAYING state being asynchronously reached
+    // (see on_bus_message)
     if (gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_READY) != GST_STATE_CHANGE_SUCCESS)
     {
         gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
@@ -155,107 +682,250 @@ bool StreamRecorder::start_recording() noexcept
         return false;
     }
 
-    if (gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PLAYING) != GST_STATE_CHANGE_ASYNC)
+    // Keeps the encoder of the recorded stream running, which is also asked
+    // for the keyframe the recording waits for
+    if (options.mode == RecordingMode::PASSTHROUGH)
     {
-        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
-        g_printerr("ERROR: cannot change stream recorder pipeline to PLAYING state\n");
-        return false;
+        m_recorded_stream_subscribed = m_stream_controller->subscribe(options.stream_idx);
     }
 
-    GstState state = GST_STATE_NULL;
-    if ((gst_element_get_state(GST_ELEMENT(m_pipeline), &state, nullptr, WAITING_FOR_PLAYING_STATE_TIMEOUT) !=
-         GST_STATE_CHANGE_SUCCESS) ||
-        (state != GST_STATE_PLAYING))
+    m_state = State::STARTING;
+    ++m_recording_id;
+    m_start_callback = std::move(callback);
+    m_start_request_time = g_get_monotonic_time();
+
+    GstStateChangeReturn ret = gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE)
     {
-        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
         g_printerr("ERROR: cannot change stream recorder pipeline to PLAYING state\n");
+        fail_start();
         return false;
     }
 
-    ++m_video_idx;
-
-    gchar* absolute_path = g_canonicalize_filename(filename, nullptr);
-    g_print("Start recording video to %s\n", absolute_path);
-    g_free(absolute_path);
+    if (m_state == State::STARTING)
+    {
+        arm_timeout(WAITING_FOR_PLAYING_STATE_TIMEOUT);
+    }
 
     return true;
 }
 
-void StreamRecorder::stop_recording() noexcept
+void StreamRecorder::stop_recording(RecordingCallback callback) noexcept
 {
-    if (m_pipeline != nullptr)
+    if (m_state == State::STARTING)
+    {
+        g_printerr("WARNING: stream recorder stopped before recording started\n");
+        fail_start();
+        if (callback)
+        {
+            callback(false, m_filename.c_str());
+        }
+    }
+    else if (m_state == State::RECORDING)
     {
         // When stopping the recording pipeline, we must ensure that the pipeline
         // has processed all the buffers, else the resulting file may be corrupted.
         // To do so, we push an EOS event at the beginning of the pipeline and we
-        // wait for the event to reach the final file sink.
-        finish_grabbing();
+        // wait for the event to reach the final file sink (see on_bus_message).
+        m_stop_callback = std::move(callback);
+        if (!send_eos())
+        {
+            complete_stop(false);
+            return;
+        }
 
-        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
-        g_print("Stream recorder stopped\n");
+        m_state = State::STOPPING;
+        arm_timeout(EOS_PROPAGATION_TIMEOUT);
+    }
+    else if (m_state == State::STOPPING)
+    {
+        // Completed along with the pending stop
+        if (callback)
+        {
+            auto chained = [pending = std::move(m_stop_callback), callback = std::move(callback)](
+                               bool success, const char* filename) {
+                if (pending)
+                {
+                    pending(success, filename);
+                }
+                callback(success, filename);
+            };
+            m_stop_callback = std::move(chained);
+        }
+    }
+    else if (callback)
+    {
+        callback(false, nullptr);
     }
 }
 
 bool StreamRecorder::is_recording() const noexcept
 {
-    if (m_pipeline != nullptr)
+    // Also read from other threads, hence the single load
+    State state = m_state.load();
+    return (state == State::STARTING) || (state == State::RECORDING);
+}
+
+bool StreamRecorder::push_caps(unsigned int stream_idx, GstCaps* caps) noexcept
+{
+    if (caps == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (stream_idx >= m_encoded_caps.size())
+    {
+        m_encoded_caps.resize(stream_idx + 1, nullptr);
+    }
+    gst_caps_replace(&m_encoded_caps[stream_idx], caps);
+
+    if ((m_appsrc != nullptr) && (m_options.mode == RecordingMode::PASSTHROUGH) &&
+        (m_options.stream_idx == stream_idx))
+    {
+        g_object_set(m_appsrc, "caps", caps, nullptr);
+    }
+
+    return true;
+}
+
+bool StreamRecorder::push_buffer(unsigned int stream_idx, GstBuffer* buffer) noexcept
+{
+    // This method is called from the streaming threads of the encoding
+    // pipeline encoded branches (from encoded_stream_pad_probe() pad probe in
+    // EncodingPipeline.cpp). As the recording pipeline may be rebuilt from the
+    // application user thread (start_recording method), m_appsrc is only
+    // accessed under m_mutex and referenced for the duration of the push.
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+
+    GstElement* appsrc = nullptr;
     {
-        GstState state = GST_STATE_NULL;
-        if ((gst_element_get_state(GST_ELEMENT(m_pipeline), &state, nullptr, 0) != GST_STATE_CHANGE_FAILURE) &&
-            (state > GST_STATE_NULL))
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (stream_idx == PRE_RECORD_STREAM_IDX)
         {
-            return true;
+            m_pre_record_buffer.push(buffer);
         }
+
+        if (!m_recording || (m_appsrc == nullptr) || (m_options.mode != RecordingMode::PASSTHROUGH) ||
+            (m_options.stream_idx != stream_idx))
+        {
+            return false;
+        }
+
+        // The recorded file must begin with a keyframe as we don't decode
+        // the stream
+        if (m_waiting_for_keyframe)
+        {
+            if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+            {
+                return false;
+            }
+
+            m_waiting_for_keyframe = false;
+        }
+
+        if (m_max_buffers_raised &&
+            (gst_app_src_get_current_level_buffers(GST_APP_SRC(m_appsrc)) < PASSTHROUGH_MAX_BUFFERS))
+        {
+            restore_max_buffers();
+        }
+
+        appsrc = GST_ELEMENT(gst_object_ref(m_appsrc));
+        GstBuffer* shell = m_buffer_pool.wrap(buffer);
+        rebase_timestamps(shell, buffer);
+        buffer = shell;
     }
 
-    return false;
+    bool pushed = push_to_appsrc(appsrc, buffer);
+    gst_object_unref(appsrc);
+    return pushed;
 }
 
-bool StreamRecorder::push_caps(unsigned int /*stream_idx*/, GstCaps* caps) noexcept
+bool StreamRecorder::push_raw_caps(GstCaps* caps) noexcept
 {
-    // WARNING: same remark about multithreading as the one below
-    // in push_buffer() method.
-    if ((caps == nullptr) || (m_appsrc == nullptr))
+    if (caps == nullptr)
     {
         return false;
     }
 
-    g_object_set(m_appsrc, "caps", caps, nullptr);
+    std::lock_guard<std::mutex> guard(m_mutex);
+    gst_caps_replace(&m_raw_caps, caps);
+
+    if ((m_appsrc != nullptr) && (m_options.mode == RecordingMode::REENCODE))
+    {
+        g_object_set(m_appsrc, "caps", caps, nullptr);
+    }
+
     return true;
 }
 
-bool StreamRecorder::push_buffer(unsigned int /*stream_idx*/, GstBuffer* buffer) noexcept
+bool StreamRecorder::push_raw_buffer(GstBuffer* buffer) noexcept
 {
-    // WARNING: this method is normally called from the streaming thread of the
-    // encoding pipeline raw branch (from raw_stream_pad_probe() pad probe in
-    // EncodingPipeline.cpp). As m_appsrc is initialized and released from the
-    // application user thread (init/shut methods), we may potentially encounter
-    // multithreading issues here.
-    //
-    // BUT, as the StreamRecorder MUST be initialized before passing it to
-    // the EncodingPipeline (through the EncodingPipeline::start() method) and
-    // MUST be shut only AFTER stopping the EncodingPipeline (see CameraManager
-    // run_and_wait() and shut() methods), we don't need any kind of
-    // synchronization here. The m_appsrc member is always initialized BEFORE
-    // starting the streaming threads and released AFTER terminating the
-    // streaming threads.
-    //
-    // Indeed, if previous conditions are changed, correct multithreading
-    // synchronization would be required to access m_appsrc member.
-    if ((buffer == nullptr) || (m_appsrc == nullptr))
+    // Same remark about multithreading as the one in push_buffer() method,
+    // this one being called from the encoding pipeline raw branch streaming
+    // thread (from raw_stream_pad_probe() pad probe in EncodingPipeline.cpp).
+    if (buffer == nullptr)
     {
         return false;
     }
 
-    // Invalidate buffer pts and dts to enable appsrc retimestamping
-    // on current running-time (do-timestamp=true).
-    // We can directly retimestamp all incoming buffers on pipeline
-    // running-time because they are pushed synchronously to the recording
-    // pipeline (sync=true in EncodingPipeline "frame-producer" fakesink).
-    buffer = gst_buffer_copy(buffer);
-    GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
-    GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+    GstElement* appsrc = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_recording || (m_appsrc == nullptr) || (m_options.mode != RecordingMode::REENCODE))
+        {
+            return false;
+        }
 
-    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(m_appsrc), buffer);
-    return (ret == GST_FLOW_OK);
+        appsrc = GST_ELEMENT(gst_object_ref(m_appsrc));
+        GstBuffer* shell = m_raw_buffer_pool.wrap(buffer);
+        rebase_timestamps(shell, buffer);
+        buffer = shell;
+    }
+
+    bool pushed = push_to_appsrc(appsrc, buffer);
+    gst_object_unref(appsrc);
+    return pushed;
+}
+
+void StreamRecorder::rebase_timestamps(GstBuffer* dest, GstBuffer* src) noexcept
+{
+    // Recorded timestamps start from the first pushed buffer
+    GstClockTime pts = GST_BUFFER_PTS(src);
+    GstClockTime dts = GST_BUFFER_DTS(src);
+    if (!GST_CLOCK_TIME_IS_VALID(m_timestamp_offset))
+    {
+        m_timestamp_offset = GST_CLOCK_TIME_IS_VALID(dts) ? dts : pts;
+    }
+
+    GST_BUFFER_PTS(dest) = (GST_CLOCK_TIME_IS_VALID(pts) && (pts >= m_timestamp_offset))
+                               ? pts - m_timestamp_offset
+                               : GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DTS(dest) = (GST_CLOCK_TIME_IS_VALID(dts) && (dts >= m_timestamp_offset))
+                               ? dts - m_timestamp_offset
+                               : GST_CLOCK_TIME_NONE;
+}
+
+bool StreamRecorder::push_to_appsrc(GstElement* appsrc, GstBuffer* buffer) noexcept
+{
+    // A full queue makes the leaky appsrc drop its oldest buffer.
+    GstAppSrc* src = GST_APP_SRC(appsrc);
+    if (gst_app_src_get_current_level_buffers(src) >= gst_app_src_get_max_buffers(src))
+    {
+        m_dropped_buffers.add();
+    }
+
+    GstFlowReturn ret = gst_app_src_push_buffer(src, buffer);
+    m_queued_buffers.set(static_cast<gint64>(gst_app_src_get_current_level_buffers(src)));
+    if (ret != GST_FLOW_OK)
+    {
+        m_push_failures.add();
+        return false;
+    }
+
+    m_recorded_buffers.add();
+    return true;
 }
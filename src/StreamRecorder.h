@@ -1,14 +1,51 @@
 #pragma once
 
+#include "BufferShellPool.h"
+#include "Configuration.h"
 #include "IStreamConsumer.h"
+#include "IStreamController.h"
+#include "Metrics.h"
+#include "PreRecordBuffer.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class RecordingMode
+{
+    // Mux the H.264 stream already produced by one of the encoding pipeline
+    // renditions (no additional encoder)
+    PASSTHROUGH,
+    // Encode the raw frames with a dedicated high quality encoder
+    REENCODE
+};
+
+struct RecordingOptions
+{
+    RecordingMode mode = RecordingMode::PASSTHROUGH;
+    // Encoded stream to record, only used in RecordingMode::PASSTHROUGH
+    unsigned int stream_idx = 0;
+
+    // Continuous recording into fragmented MP4 segments, rotated on the first
+    // keyframe after the duration or the size (if not zero) is reached
+    bool segmented = false;
+    GstClockTime segment_duration = 60 * GST_SECOND;
+    guint64 segment_size = 0;
+};
+
+// Called once a recording is started or finalized, with the absolute path of
+// the recorded file (or the filename pattern of its segments)
+using RecordingCallback = std::function<void(bool success, const char* filename)>;
 
 class StreamRecorder final : public IStreamConsumer
 {
   public:
     StreamRecorder() = default;
-    StreamRecorder(StreamRecorder&&) = default;
-    StreamRecorder& operator=(StreamRecorder&&) = default;
 
+    StreamRecorder(StreamRecorder&&) = delete;
+    StreamRecorder& operator=(StreamRecorder&&) = delete;
     StreamRecorder(const StreamRecorder&) = delete;
     StreamRecorder& operator=(const StreamRecorder&) = delete;
 
@@ -17,21 +54,129 @@ class StreamRecorder final : public IStreamConsumer
         shut();
     }
 
-    bool init() noexcept;
+    // The recorder is only controlled from the given context, from which its
+    // pipeline bus and timeouts are dispatched (is_recording excepted).
+    // Encoded streams are subscribed to through the stream controller while
+    // pre-recorded or recorded, the first one being pre-recorded all along
+    // unless disabled by the configuration.
+    bool init(GMainContext* context, IStreamController& stream_controller,
+              const RecordingConfiguration& configuration = RecordingConfiguration()) noexcept;
     void shut() noexcept;
 
-    bool start_recording() noexcept;
-    void stop_recording() noexcept;
+    // Recording start and stop are asynchronous: both methods return as soon
+    // as the request is issued, the completion being reported through the
+    // callback from the recorder context. A stop callback is always called,
+    // failing with a null filename when there is no recording to stop.
+    bool start_recording(const RecordingOptions& options = RecordingOptions(),
+                         RecordingCallback callback = nullptr) noexcept;
+    void stop_recording(RecordingCallback callback = nullptr) noexcept;
     bool is_recording() const noexcept;
 
+    // Identifier of the current (or last) recording, a new one being given
+    // to each issued start request
+    unsigned int get_recording_id() const noexcept
+    {
+        return m_recording_id;
+    }
+
+    // Encoded streams entry point (see RecordingMode::PASSTHROUGH)
     bool push_caps(unsigned int stream_idx, GstCaps* caps) noexcept override;
     bool push_buffer(unsigned int stream_idx, GstBuffer* buffer) noexcept override;
 
+    // Raw stream entry point (see RecordingMode::REENCODE)
+    IStreamConsumer& raw_stream_consumer() noexcept
+    {
+        return m_raw_stream_consumer;
+    }
+
   private:
-    bool create_pipeline() noexcept;
-    void finish_grabbing() noexcept;
+    class RawStreamConsumer final : public IStreamConsumer
+    {
+      public:
+        explicit RawStreamConsumer(StreamRecorder& recorder) noexcept : m_recorder(recorder)
+        {
+        }
+
+        bool push_caps(unsigned int /*stream_idx*/, GstCaps* caps) noexcept override
+        {
+            return m_recorder.push_raw_caps(caps);
+        }
+
+        bool push_buffer(unsigned int /*stream_idx*/, GstBuffer* buffer) noexcept override
+        {
+            return m_recorder.push_raw_buffer(buffer);
+        }
+
+      private:
+        StreamRecorder& m_recorder;
+    };
+
+    enum class State
+    {
+        IDLE,
+        STARTING,
+        RECORDING,
+        STOPPING
+    };
+
+    static gboolean on_bus_message(GstBus* bus, GstMessage* message, StreamRecorder* recorder) noexcept;
+    static gboolean on_timeout(StreamRecorder* recorder) noexcept;
+    static GstPadProbeReturn on_parsed_buffer(GstPad* pad, GstPadProbeInfo* info, Histogram* latency) noexcept;
+
+    bool create_pipeline(RecordingMode mode, bool segmented) noexcept;
+    void release_pipeline() noexcept;
 
+    void arm_timeout(GstClockTime timeout) noexcept;
+    void disarm_timeout() noexcept;
+    bool send_eos() noexcept;
+    bool wait_for_eos() noexcept;
+
+    void complete_start() noexcept;
+    unsigned int flush_pre_recording(GstElement* appsrc) noexcept;
+    void restore_max_buffers() noexcept;
+    void fail_start() noexcept;
+    void complete_stop(bool success) noexcept;
+    void release_recorded_stream() noexcept;
+
+    bool push_raw_caps(GstCaps* caps) noexcept;
+    bool push_raw_buffer(GstBuffer* buffer) noexcept;
+    void rebase_timestamps(GstBuffer* dest, GstBuffer* src) noexcept;
+    bool push_to_appsrc(GstElement* appsrc, GstBuffer* buffer) noexcept;
+
+    GMainContext* m_context = nullptr;
+    IStreamController* m_stream_controller = nullptr;
+    bool m_pre_recording = false;
+    bool m_recorded_stream_subscribed = false;
     GstPipeline* m_pipeline = nullptr;
-    GstElement* m_appsrc = nullptr;
+    GSource* m_bus_source = nullptr;
     unsigned int m_video_idx = 0;
+    unsigned int m_recording_id = 0;
+    std::atomic<State> m_state{State::IDLE};
+    GSource* m_timeout_source = nullptr;
+    std::string m_filename;
+    RecordingCallback m_start_callback;
+    RecordingCallback m_stop_callback;
+    RawStreamConsumer m_raw_stream_consumer{*this};
+    gint64 m_start_request_time = 0;
+
+    // Following members are shared with the encoding pipeline streaming threads
+    std::mutex m_mutex;
+    GstElement* m_appsrc = nullptr;
+    RecordingOptions m_options;
+    bool m_recording = false;
+    bool m_waiting_for_keyframe = false;
+    bool m_max_buffers_raised = false;
+    GstClockTime m_timestamp_offset = GST_CLOCK_TIME_NONE;
+    PreRecordBuffer m_pre_record_buffer;
+    GstCaps* m_raw_caps = nullptr;
+    std::vector<GstCaps*> m_encoded_caps;
+    BufferShellPool m_buffer_pool;
+    BufferShellPool m_raw_buffer_pool;
+
+    Counter m_recorded_buffers;
+    Counter m_dropped_buffers;
+    Counter m_push_failures;
+    Gauge m_queued_buffers;
+    Histogram m_start_latency;
+    Histogram m_latency;
 };
@@ -1,18 +1,141 @@
 #include "StreamingServer.h"
 
+#include "CaptureTimeMeta.h"
+#include "StartupTimeline.h"
+
+#include <algorithm>
 #include <cassert>
 #include <gst/app/app.h>
+#include <thread>
 
 namespace
 {
 constexpr char DEFAULT_RTSP_PORT[] = "8554";
+// Caps are only a fallback until the encoder caps are known (see push_caps).
+// Buffers keep the timestamps of the encoding pipeline, whose clock and base
+// time are shared by the media (see on_media_configure).
+// The queue budget is enforced by the streaming thread (see within_budget),
+// the appsrc never blocking it.
 constexpr char MEDIA_FACTORY_BIN_DESC[] =
-    "( appsrc name=entry-point is-live=true do-timestamp=true caps=\"video/x-h264,framerate=30/1\" emit-signals=false "
-    "format=time ! h264parse ! rtph264pay name=pay0 pt=96 )";
-constexpr char MEDIA_IDX_KEY[] = "media-idx";
+    "( appsrc name=entry-point is-live=true do-timestamp=false block=false "
+    "max-bytes=%" G_GUINT64_FORMAT " max-buffers=0 max-time=%" G_GUINT64_FORMAT " "
+    "caps=\"video/x-h264,stream-format=byte-stream,alignment=au,framerate=%u/1\" emit-signals=false format=time ! "
+    "h264parse ! rtph264pay name=pay0 pt=96 )";
+constexpr char MOUNT_IDX_KEY[] = "mount-idx";
+// Set on a configured media until it is detached from its mount
+constexpr char ATTACHMENT_KEY[] = "attachment";
+// Set on the appsrc of a media dropping its frames until the next keyframe
+constexpr char DROPPING_KEY[] = "dropping";
+// Longer GOP are not cached, joining clients then wait for the next keyframe
+constexpr size_t MAX_GOP_CACHE_SIZE = 300;
 constexpr guint SESSIONS_CLEANUP_TIMEOUT_IN_SECONDS = 5;
+
+// Bitrate adaptation (see BitrateAdaptation), the thresholds of the smoothed
+// loss fraction and jitter (in ms) leaving a dead band to avoid oscillations
+constexpr guint ADAPTATION_PERIOD_IN_SECONDS = 1;
+constexpr double ADAPTATION_SMOOTHING = 0.3;
+constexpr double HIGH_LOSS = 0.05;
+constexpr double LOW_LOSS = 0.01;
+constexpr double HIGH_JITTER = 50.0;
+constexpr double LOW_JITTER = 20.0;
+constexpr gint64 DECREASE_INTERVAL = 2 * G_TIME_SPAN_SECOND;
+constexpr gint64 INCREASE_INTERVAL = 10 * G_TIME_SPAN_SECOND;
+constexpr unsigned int DECREASE_PERCENT = 25;
+constexpr unsigned int INCREASE_PERCENT = 10;
+// RTP clock rate of H.264, in which the jitter is reported
+constexpr double RTP_CLOCK_RATE_IN_KHZ = 90.0;
+
+GstRTSPAddressPool* create_address_pool(const MulticastConfiguration& multicast)
+{
+    GstRTSPAddressPool* pool = gst_rtsp_address_pool_new();
+    if (!gst_rtsp_address_pool_add_range(pool, multicast.address_min.c_str(), multicast.address_max.c_str(),
+                                         static_cast<guint16>(multicast.port_min),
+                                         static_cast<guint16>(multicast.port_max), static_cast<guint8>(multicast.ttl)))
+    {
+        g_printerr("ERROR: invalid multicast address range %s-%s\n", multicast.address_min.c_str(),
+                   multicast.address_max.c_str());
+        g_object_unref(pool);
+        return nullptr;
+    }
+
+    return pool;
+}
+
+// Position of the next 00 00 01 start code of an H.264 byte-stream
+gsize find_start_code(const guint8* data, gsize size, gsize pos)
+{
+    for (; pos + 3 <= size; ++pos)
+    {
+        if ((data[pos] == 0) && (data[pos + 1] == 0) && (data[pos + 2] == 1))
+        {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+// Base64 SPS and PPS leading a byte-stream access unit, as expected by the
+// sprop-parameter-sets SDP attribute (nullptr if there is none)
+gchar* build_sprop_parameter_sets(const guint8* data, gsize size)
+{
+    constexpr guint8 NAL_TYPE_MASK = 0x1f;
+    constexpr guint8 NAL_SLICE = 1;
+    constexpr guint8 NAL_IDR_SLICE = 5;
+    constexpr guint8 NAL_SPS = 7;
+    constexpr guint8 NAL_PPS = 8;
+
+    GString* sprop = nullptr;
+    gsize start = find_start_code(data, size, 0);
+    while (start < size)
+    {
+        gsize nal = start + 3;
+        gsize next = find_start_code(data, size, nal);
+        gsize end = next;
+        while ((end > nal) && (data[end - 1] == 0))
+        {
+            --end;
+        }
+
+        guint8 nal_type = (end > nal) ? (data[nal] & NAL_TYPE_MASK) : 0;
+        if ((nal_type == NAL_SLICE) || (nal_type == NAL_IDR_SLICE))
+        {
+            // Parameter sets precede the picture data
+            break;
+        }
+
+        if ((nal_type == NAL_SPS) || (nal_type == NAL_PPS))
+        {
+            gchar* base64 = g_base64_encode(data + nal, end - nal);
+            if (sprop == nullptr)
+            {
+                sprop = g_string_new(base64);
+            }
+            else
+            {
+                g_string_append_c(sprop, ',');
+                g_string_append(sprop, base64);
+            }
+            g_free(base64);
+        }
+
+        start = next;
+    }
+
+    return (sprop != nullptr) ? g_string_free(sprop, FALSE) : nullptr;
+}
 } // namespace
 
+StreamingServer::Mount::~Mount()
+{
+    clear_gop_cache(*this);
+    if (caps != nullptr)
+    {
+        gst_caps_unref(caps);
+    }
+    g_free(sprop_parameter_sets);
+}
+
 gboolean StreamingServer::on_sessions_cleanup(StreamingServer* streaming_server) noexcept
 {
     assert(streaming_server != nullptr);
@@ -25,6 +148,43 @@ gboolean StreamingServer::on_sessions_cleanup(StreamingServer* streaming_server)
     return G_SOURCE_CONTINUE;
 }
 
+gboolean StreamingServer::on_bitrate_adaptation(StreamingServer* streaming_server) noexcept
+{
+    assert(streaming_server != nullptr);
+    assert(streaming_server->m_server != nullptr);
+
+    // Shared media appear in several sessions, which does not change the
+    // worst report of their mount
+    std::vector<ReceiverReport> reports(streaming_server->m_nb_mounts);
+    GstRTSPSessionPool* pool = gst_rtsp_server_get_session_pool(streaming_server->m_server);
+    GList* sessions = gst_rtsp_session_pool_filter(pool, nullptr, nullptr);
+    for (GList* session = sessions; session != nullptr; session = session->next)
+    {
+        GList* session_medias = gst_rtsp_session_filter(static_cast<GstRTSPSession*>(session->data), nullptr, nullptr);
+        for (GList* session_media = session_medias; session_media != nullptr; session_media = session_media->next)
+        {
+            GstRTSPMedia* media =
+                gst_rtsp_session_media_get_media(static_cast<GstRTSPSessionMedia*>(session_media->data));
+            auto mount_idx = static_cast<unsigned int>(
+                reinterpret_cast<guintptr>(g_object_get_data(G_OBJECT(media), MOUNT_IDX_KEY)));
+            if (mount_idx < streaming_server->m_nb_mounts)
+            {
+                collect_receiver_reports(media, reports[mount_idx]);
+            }
+        }
+        g_list_free_full(session_medias, g_object_unref);
+    }
+    g_list_free_full(sessions, g_object_unref);
+    g_object_unref(pool);
+
+    for (unsigned int i = 0; i < streaming_server->m_nb_mounts; ++i)
+    {
+        streaming_server->adapt_bitrate(i, reports[i]);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
 void StreamingServer::on_media_configure(GstRTSPMediaFactory* factory, GstRTSPMedia* media,
                                          StreamingServer* streaming_server) noexcept
 {
@@ -32,36 +192,575 @@ void StreamingServer::on_media_configure(GstRTSPMediaFactory* factory, GstRTSPMe
     assert(media != nullptr);
     assert(streaming_server != nullptr);
 
-    auto media_idx =
-        static_cast<unsigned int>(reinterpret_cast<guintptr>(g_object_get_data(G_OBJECT(factory), MEDIA_IDX_KEY)));
-    assert(media_idx < NB_MEDIA);
+    gpointer mount_idx = g_object_get_data(G_OBJECT(factory), MOUNT_IDX_KEY);
+    assert(static_cast<unsigned int>(reinterpret_cast<guintptr>(mount_idx)) < streaming_server->m_nb_mounts);
+
+    // Remember the mount of the media to detach it once unprepared. A media
+    // failing to prepare is not unprepared, hence also detached when its
+    // target state goes back to NULL or when it is finalized.
+    g_object_set_data(G_OBJECT(media), MOUNT_IDX_KEY, mount_idx);
+    if ((g_signal_connect(media, "unprepared", reinterpret_cast<GCallback>(StreamingServer::on_media_unprepared),
+                          streaming_server) == 0) ||
+        (g_signal_connect(media, "target-state",
+                          reinterpret_cast<GCallback>(StreamingServer::on_media_target_state), streaming_server) == 0))
+    {
+        g_printerr("ERROR: cannot connect signal to media\n");
+        return;
+    }
+
+    auto idx = static_cast<unsigned int>(reinterpret_cast<guintptr>(mount_idx));
+    Mount& mount = streaming_server->m_mounts[idx];
+
+    // Latency is measured on the RTP packets leaving the payloader
+    GstElement* media_bin = gst_rtsp_media_get_element(media);
+    assert(media_bin != nullptr);
+    share_stream_time(mount, media_bin);
+    GstElement* payloader = gst_bin_get_by_name(GST_BIN(media_bin), "pay0");
+    assert(payloader != nullptr);
+    GstPad* payloader_pad = gst_element_get_static_pad(payloader, "src");
+    assert(payloader_pad != nullptr);
+    gst_pad_add_probe(payloader_pad,
+                      static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      reinterpret_cast<GstPadProbeCallback>(on_payloaded_data), &mount, nullptr);
+    gst_object_unref(payloader_pad);
+    gst_object_unref(payloader);
+    gst_object_unref(media_bin);
+
+    GstElement* entry_point = get_entry_point(media);
+    apply_stream_caps(mount, media, entry_point);
+
+    // The encoder of the stream runs as long as the media is attached
+    auto* attachment = new MediaAttachment();
+    attachment->mount = &mount;
+    attachment->entry_point = GST_ELEMENT(gst_object_ref(entry_point));
+    join_appsrc(mount, entry_point);
+    mount.controller->subscribe(mount.stream_idx);
+    g_object_set_data_full(G_OBJECT(media), ATTACHMENT_KEY, attachment,
+                           reinterpret_cast<GDestroyNotify>(detach_media));
+}
+
+void StreamingServer::on_media_unprepared(GstRTSPMedia* media, StreamingServer* streaming_server) noexcept
+{
+    assert(media != nullptr);
+    assert(streaming_server != nullptr);
+
+    // Clearing the attachment detaches the media, only once
+    g_object_set_data(G_OBJECT(media), ATTACHMENT_KEY, nullptr);
+}
+
+void StreamingServer::on_media_target_state(GstRTSPMedia* media, gint state,
+                                            StreamingServer* streaming_server) noexcept
+{
+    assert(media != nullptr);
+    assert(streaming_server != nullptr);
+
+    if (state == GST_STATE_NULL)
+    {
+        g_object_set_data(G_OBJECT(media), ATTACHMENT_KEY, nullptr);
+    }
+}
+
+void StreamingServer::detach_media(MediaAttachment* attachment) noexcept
+{
+    assert(attachment != nullptr);
+
+    Mount& mount = *attachment->mount;
+    remove_appsrc(mount, attachment->entry_point);
+    gst_object_unref(attachment->entry_point);
+    mount.controller->unsubscribe(mount.stream_idx);
+    delete attachment;
+}
+
+GstPadProbeReturn StreamingServer::on_payloaded_data(GstPad* pad, GstPadProbeInfo* info, Mount* mount) noexcept
+{
+    assert(pad != nullptr);
+    assert(info != nullptr);
+    assert(mount != nullptr);
+
+    // The packets of a fragmented frame are pushed as a list, only the first
+    // one is measured
+    GstBuffer* buffer = nullptr;
+    if ((info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) == GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        GstBufferList* list = GST_BUFFER_LIST(info->data);
+        buffer = (gst_buffer_list_length(list) > 0) ? gst_buffer_list_get(list, 0) : nullptr;
+    }
+    else
+    {
+        buffer = GST_BUFFER(info->data);
+    }
+
+    if (buffer != nullptr)
+    {
+        mount->latency.observe(get_capture_latency(buffer));
+        mark_startup_milestone(StartupMilestone::FIRST_FRAME_SERVED);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+void StreamingServer::on_client_connected(GstRTSPServer* server, GstRTSPClient* client,
+                                          StreamingServer* streaming_server) noexcept
+{
+    assert(server != nullptr);
+    assert(client != nullptr);
+    assert(streaming_server != nullptr);
+
+    if (g_signal_connect(client, "play-request", reinterpret_cast<GCallback>(StreamingServer::on_play_request),
+                         streaming_server) == 0)
+    {
+        g_printerr("WARNING: cannot connect signal to client\n");
+    }
+}
+
+void StreamingServer::on_play_request(GstRTSPClient* client, GstRTSPContext* context,
+                                      StreamingServer* streaming_server) noexcept
+{
+    assert(client != nullptr);
+    assert(context != nullptr);
+    assert(streaming_server != nullptr);
+
+    if (context->media == nullptr)
+    {
+        return;
+    }
+
+    // A client joining an already prepared shared media also needs a
+    // keyframe, the cached GOP only covering clients of new media
+    auto mount_idx = static_cast<unsigned int>(
+        reinterpret_cast<guintptr>(g_object_get_data(G_OBJECT(context->media), MOUNT_IDX_KEY)));
+    assert(mount_idx < streaming_server->m_nb_mounts);
+    const Mount& mount = streaming_server->m_mounts[mount_idx];
+    mount.controller->request_key_frame(mount.stream_idx);
+}
 
+void StreamingServer::share_stream_time(const Mount& mount, GstElement* media_bin) noexcept
+{
+    // The media pipeline running time then matches the timestamps of the
+    // encoding pipeline, which are kept instead of being generated again by
+    // appsrc once dequeued. Without start time, the base time is not
+    // computed again when the media goes to the PLAYING state.
+    GstElement* pipeline = GST_ELEMENT(gst_object_get_parent(GST_OBJECT(media_bin)));
+    assert(pipeline != nullptr);
+    GstClock* clock = gst_system_clock_obtain();
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), clock);
+    gst_object_unref(clock);
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, mount.controller->get_base_time());
+    gst_object_unref(pipeline);
+}
+
+GstElement* StreamingServer::get_entry_point(GstRTSPMedia* media) noexcept
+{
     GstElement* media_bin = gst_rtsp_media_get_element(media);
     assert(media_bin != nullptr);
     GstElement* entry_point = gst_bin_get_by_name(GST_BIN(media_bin), "entry-point");
     assert(entry_point != nullptr);
     gst_object_unref(media_bin);
+    return entry_point;
+}
+
+void StreamingServer::apply_stream_caps(Mount& mount, GstRTSPMedia* media, GstElement* entry_point) noexcept
+{
+    std::lock_guard<std::mutex> guard(mount.caps_mutex);
+    if (mount.caps != nullptr)
+    {
+        gst_app_src_set_caps(GST_APP_SRC(entry_point), mount.caps);
+    }
+
+    // Known parameter sets complete the SDP before any buffer reaches the
+    // payloader
+    if (mount.sprop_parameter_sets != nullptr)
+    {
+        GstElement* media_bin = gst_rtsp_media_get_element(media);
+        assert(media_bin != nullptr);
+        GstElement* payloader = gst_bin_get_by_name(GST_BIN(media_bin), "pay0");
+        assert(payloader != nullptr);
+        g_object_set(payloader, "sprop-parameter-sets", mount.sprop_parameter_sets, nullptr);
+        gst_object_unref(payloader);
+        gst_object_unref(media_bin);
+    }
+}
+
+void StreamingServer::update_parameter_sets(Mount& mount, GstBuffer* keyframe) noexcept
+{
+    GstMapInfo map;
+    if (!gst_buffer_map(keyframe, &map, GST_MAP_READ))
+    {
+        return;
+    }
+    gchar* sprop = build_sprop_parameter_sets(map.data, map.size);
+    gst_buffer_unmap(keyframe, &map);
+
+    if (sprop == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(mount.caps_mutex);
+    if (g_strcmp0(sprop, mount.sprop_parameter_sets) != 0)
+    {
+        g_free(mount.sprop_parameter_sets);
+        mount.sprop_parameter_sets = sprop;
+    }
+    else
+    {
+        g_free(sprop);
+    }
+}
+
+void StreamingServer::join_appsrc(Mount& mount, GstElement* appsrc) noexcept
+{
+    // Takes ownership of the appsrc reference
+    std::lock_guard<std::mutex> guard(mount.joining_mutex);
+    mount.joining_appsrcs.push_back(appsrc);
+    mount.has_joining_appsrcs.store(true);
+}
+
+void StreamingServer::admit_joining_appsrcs(Mount& mount, bool replay) noexcept
+{
+    // Called from the streaming thread, which owns the GOP cache. Holding
+    // the joining mutex until the appsrc are published prevents them from
+    // being removed in between.
+    AppsrcList* replaced = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(mount.joining_mutex);
+        if (replay)
+        {
+            for (GstElement* appsrc : mount.joining_appsrcs)
+            {
+                for (GstBuffer* cached_buffer : mount.gop_cache)
+                {
+                    if (!within_budget(mount, appsrc, cached_buffer))
+                    {
+                        continue;
+                    }
+
+                    // Shares the memory of the cached buffer. Replayed frames
+                    // are late against the media running time, hence sent at
+                    // once, and would skew the latency measures.
+                    GstBuffer* buffer = gst_buffer_copy(cached_buffer);
+                    remove_capture_time(buffer);
+                    gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+                }
+            }
+            mount.gop_replays.add(mount.joining_appsrcs.size());
+        }
+        replaced = add_appsrcs(mount, mount.joining_appsrcs);
+        mount.joining_appsrcs.clear();
+        mount.has_joining_appsrcs.store(false);
+    }
+
+    retire_appsrcs(mount, replaced);
+}
+
+bool StreamingServer::within_budget(Mount& mount, GstElement* appsrc, GstBuffer* buffer) noexcept
+{
+    // Called from the streaming thread of the mount only. A frame over the
+    // budget is dropped with the rest of its GOP, whose frames may reference
+    // it, the media resuming on the next keyframe that fits.
+    GstAppSrc* src = GST_APP_SRC(appsrc);
+    bool dropping = (g_object_get_data(G_OBJECT(appsrc), DROPPING_KEY) != nullptr);
+    if (dropping && GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+        mount.dropped_buffers.add();
+        return false;
+    }
+
+    // An empty queue takes any keyframe, so that a media always resumes
+    guint64 level_bytes = gst_app_src_get_current_level_bytes(src);
+    bool over_budget = (level_bytes > 0) &&
+                       ((level_bytes + gst_buffer_get_size(buffer) > gst_app_src_get_max_bytes(src)) ||
+                        (gst_app_src_get_current_level_time(src) >= gst_app_src_get_max_time(src)));
+    if (over_budget)
+    {
+        if (!dropping)
+        {
+            g_object_set_data(G_OBJECT(appsrc), DROPPING_KEY, GINT_TO_POINTER(TRUE));
+            mount.overflows.add();
+        }
+        mount.dropped_buffers.add();
+        return false;
+    }
+
+    if (dropping)
+    {
+        g_object_set_data(G_OBJECT(appsrc), DROPPING_KEY, nullptr);
+    }
+    return true;
+}
+
+StreamingServer::AppsrcList* StreamingServer::add_appsrcs(Mount& mount, const AppsrcList& added) noexcept
+{
+    // Takes ownership of the added appsrc references
+    std::lock_guard<std::mutex> guard(mount.update_mutex);
+    const AppsrcList* current = mount.appsrcs.load();
 
-    std::lock_guard<std::mutex> guard(streaming_server->m_media_mutex[media_idx]);
-    if (streaming_server->m_media_appsrc[media_idx] != nullptr)
+    auto* appsrcs = new AppsrcList();
+    appsrcs->reserve(((current != nullptr) ? current->size() : 0) + added.size());
+    if (current != nullptr)
     {
-        gst_object_unref(streaming_server->m_media_appsrc[media_idx]);
+        for (GstElement* element : *current)
+        {
+            appsrcs->push_back(GST_ELEMENT(gst_object_ref(element)));
+        }
+    }
+    appsrcs->insert(appsrcs->end(), added.begin(), added.end());
+
+    return publish_appsrcs(mount, appsrcs);
+}
+
+void StreamingServer::remove_appsrc(Mount& mount, GstElement* appsrc) noexcept
+{
+    AppsrcList* replaced = nullptr;
+    {
+        std::lock_guard<std::mutex> joining_guard(mount.joining_mutex);
+        auto joining = std::find(mount.joining_appsrcs.begin(), mount.joining_appsrcs.end(), appsrc);
+        if (joining != mount.joining_appsrcs.end())
+        {
+            gst_object_unref(*joining);
+            mount.joining_appsrcs.erase(joining);
+            mount.has_joining_appsrcs.store(!mount.joining_appsrcs.empty());
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(mount.update_mutex);
+        const AppsrcList* current = mount.appsrcs.load();
+        if ((current == nullptr) || (std::find(current->begin(), current->end(), appsrc) == current->end()))
+        {
+            return;
+        }
+
+        AppsrcList* appsrcs = nullptr;
+        if (current->size() > 1)
+        {
+            appsrcs = new AppsrcList();
+            appsrcs->reserve(current->size() - 1);
+            for (GstElement* element : *current)
+            {
+                if (element != appsrc)
+                {
+                    appsrcs->push_back(GST_ELEMENT(gst_object_ref(element)));
+                }
+            }
+        }
+
+        replaced = publish_appsrcs(mount, appsrcs);
+    }
+
+    retire_appsrcs(mount, replaced);
+}
+
+void StreamingServer::clear_appsrcs(Mount& mount) noexcept
+{
+    AppsrcList* replaced = nullptr;
+    {
+        std::lock_guard<std::mutex> joining_guard(mount.joining_mutex);
+        for (GstElement* appsrc : mount.joining_appsrcs)
+        {
+            gst_object_unref(appsrc);
+        }
+        mount.joining_appsrcs.clear();
+        mount.has_joining_appsrcs.store(false);
+
+        std::lock_guard<std::mutex> guard(mount.update_mutex);
+        replaced = publish_appsrcs(mount, nullptr);
+    }
+
+    retire_appsrcs(mount, replaced);
+}
+
+StreamingServer::AppsrcList* StreamingServer::publish_appsrcs(Mount& mount, AppsrcList* appsrcs) noexcept
+{
+    // Takes ownership of the list, called with the update mutex held. The
+    // replaced list is returned to be retired once the mutexes are released.
+    mount.media.set((appsrcs != nullptr) ? static_cast<gint64>(appsrcs->size()) : 0);
+    return mount.appsrcs.exchange(appsrcs);
+}
+
+void StreamingServer::retire_appsrcs(Mount& mount, AppsrcList* appsrcs) noexcept
+{
+    if (appsrcs == nullptr)
+    {
+        return;
+    }
+
+    // The list is already unpublished, so once the reader count drops to
+    // zero no streaming thread can still use it. Readers hold it for
+    // non-blocking pushes only, so this grace period is short. No mutex of
+    // the mount is held meanwhile, the streaming thread taking them to admit
+    // new media.
+    while (mount.readers.load() != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    for (GstElement* appsrc : *appsrcs)
+    {
+        gst_object_unref(appsrc);
+    }
+    delete appsrcs;
+}
+
+void StreamingServer::cache_buffer(Mount& mount, GstBuffer* buffer) noexcept
+{
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+        clear_gop_cache(mount);
+        update_parameter_sets(mount, buffer);
+    }
+    else if (mount.gop_cache.empty())
+    {
+        // Waiting for the first keyframe
+        return;
+    }
+    else if (mount.gop_cache.size() >= MAX_GOP_CACHE_SIZE)
+    {
+        clear_gop_cache(mount);
+        return;
+    }
+
+    mount.gop_cache.push_back(gst_buffer_ref(buffer));
+}
+
+void StreamingServer::clear_gop_cache(Mount& mount) noexcept
+{
+    for (GstBuffer* buffer : mount.gop_cache)
+    {
+        gst_buffer_unref(buffer);
+    }
+    mount.gop_cache.clear();
+}
+
+void StreamingServer::collect_receiver_reports(GstRTSPMedia* media, ReceiverReport& report) noexcept
+{
+    GstRTSPStream* stream = gst_rtsp_media_get_stream(media, 0);
+    if (stream == nullptr)
+    {
+        return;
+    }
+
+    GObject* rtp_session = gst_rtsp_stream_get_rtpsession(stream);
+    if (rtp_session == nullptr)
+    {
+        return;
+    }
+
+    GstStructure* stats = nullptr;
+    g_object_get(rtp_session, "stats", &stats, nullptr);
+    g_object_unref(rtp_session);
+    if (stats == nullptr)
+    {
+        return;
+    }
+
+    // Receivers are the remote sources, each holding the last report block
+    // it sent about the stream
+    const GValue* source_stats = gst_structure_get_value(stats, "source-stats");
+    auto* sources = (source_stats != nullptr) ? static_cast<GValueArray*>(g_value_get_boxed(source_stats)) : nullptr;
+    for (guint i = 0; (sources != nullptr) && (i < sources->n_values); ++i)
+    {
+        const GstStructure* source = gst_value_get_structure(&sources->values[i]);
+        gboolean internal = FALSE;
+        gboolean have_rb = FALSE;
+        guint fraction_lost = 0;
+        guint jitter = 0;
+        if ((source == nullptr) || !gst_structure_get_boolean(source, "internal", &internal) || internal ||
+            !gst_structure_get_boolean(source, "have-rb", &have_rb) || !have_rb ||
+            !gst_structure_get_uint(source, "rb-fractionlost", &fraction_lost) ||
+            !gst_structure_get_uint(source, "rb-jitter", &jitter))
+        {
+            continue;
+        }
+
+        // The lost fraction is a fixed point number with 8 fractional bits
+        report.loss = std::max(report.loss, fraction_lost / 256.0);
+        report.jitter = std::max(report.jitter, jitter / RTP_CLOCK_RATE_IN_KHZ);
+        report.valid = true;
+    }
+    gst_structure_free(stats);
+}
+
+void StreamingServer::adapt_bitrate(unsigned int mount_idx, const ReceiverReport& report) noexcept
+{
+    Mount& mount = m_mounts[mount_idx];
+    BitrateAdaptation& adaptation = mount.adaptation;
+    if (adaptation.min_bitrate >= adaptation.max_bitrate)
+    {
+        return;
+    }
+
+    unsigned int bitrate = adaptation.bitrate;
+    gint64 now = g_get_monotonic_time();
+    if (!report.valid)
+    {
+        // Without receivers, the next ones start from the configured bitrate
+        adaptation.has_reports = false;
+        bitrate = adaptation.initial_bitrate;
+    }
+    else
+    {
+        if (adaptation.has_reports)
+        {
+            adaptation.loss += ADAPTATION_SMOOTHING * (report.loss - adaptation.loss);
+            adaptation.jitter += ADAPTATION_SMOOTHING * (report.jitter - adaptation.jitter);
+        }
+        else
+        {
+            adaptation.has_reports = true;
+            adaptation.loss = report.loss;
+            adaptation.jitter = report.jitter;
+        }
+
+        if ((adaptation.loss > HIGH_LOSS) || (adaptation.jitter > HIGH_JITTER))
+        {
+            if (now - adaptation.last_change >= DECREASE_INTERVAL)
+            {
+                bitrate = std::max(adaptation.min_bitrate, bitrate - bitrate * DECREASE_PERCENT / 100);
+            }
+        }
+        else if ((adaptation.loss < LOW_LOSS) && (adaptation.jitter < LOW_JITTER))
+        {
+            if (now - adaptation.last_change >= INCREASE_INTERVAL)
+            {
+                bitrate = std::min(adaptation.max_bitrate, bitrate + std::max(bitrate * INCREASE_PERCENT / 100, 1U));
+            }
+        }
     }
-    streaming_server->m_media_appsrc[media_idx] = entry_point;
+
+    if (bitrate == adaptation.bitrate)
+    {
+        return;
+    }
+
+    if (!mount.controller->set_bitrate(mount.stream_idx, bitrate))
+    {
+        g_printerr("WARNING: cannot change bitrate of mount %s\n", mount.path.c_str());
+        return;
+    }
+
+    g_print("Mount %s bitrate changed to %u kbit/s (loss %.1f%%, jitter %.1f ms)\n", mount.path.c_str(), bitrate,
+            adaptation.loss * 100.0, adaptation.jitter);
+    adaptation.bitrate = bitrate;
+    adaptation.last_change = now;
 }
 
-bool StreamingServer::create_server(const char* port) noexcept
+bool StreamingServer::create_server(const char* port, const Configuration& configuration) noexcept
 {
     assert(m_server == nullptr);
-    assert(m_server_source == 0);
-    assert(m_loop == nullptr);
-    assert(m_loop_timeout == 0);
+    assert(m_server_source == nullptr);
     assert(port != nullptr);
     assert(*port != 0);
 
     GstRTSPServer* server = gst_rtsp_server_new();
     gst_rtsp_server_set_service(server, port);
 
+    // Requests of each client are handled from a pool thread, so that a slow
+    // client does not delay the others nor the server context
+    GstRTSPThreadPool* thread_pool = gst_rtsp_server_get_thread_pool(server);
+    gst_rtsp_thread_pool_set_max_threads(thread_pool, static_cast<gint>(configuration.server_threads));
+    g_object_unref(thread_pool);
+
     GstRTSPMountPoints* mounts = gst_rtsp_server_get_mount_points(server);
     if (mounts == nullptr)
     {
@@ -70,34 +769,85 @@ bool StreamingServer::create_server(const char* port) noexcept
         return false;
     }
 
-    char buff[9]; // until "/video99", just in case // NOLINT
-    for (unsigned int i = 0; i < NB_MEDIA; ++i)
+    // Multicast mounts share the same address pool, each media stream
+    // acquiring its own group and port pair
+    GstRTSPAddressPool* address_pool = nullptr;
+    for (const RenditionConfiguration& rendition : configuration.renditions)
+    {
+        if (rendition.multicast)
+        {
+            address_pool = create_address_pool(configuration.multicast);
+            if (address_pool == nullptr)
+            {
+                g_object_unref(mounts);
+                g_object_unref(server);
+                return false;
+            }
+            break;
+        }
+    }
+
+    const auto nb_renditions = static_cast<unsigned int>(configuration.renditions.size());
+    char buff[17]; // until "/video4294967295", just in case // NOLINT
+    for (unsigned int i = 0; i < m_nb_mounts; ++i)
     {
+        const RenditionConfiguration& rendition = configuration.renditions[i % nb_renditions];
         GstRTSPMediaFactory* media_factory = gst_rtsp_media_factory_new();
-        g_object_set_data(G_OBJECT(media_factory), MEDIA_IDX_KEY, reinterpret_cast<gpointer>(static_cast<guintptr>(i)));
+        g_object_set_data(G_OBJECT(media_factory), MOUNT_IDX_KEY, reinterpret_cast<gpointer>(static_cast<guintptr>(i)));
 
-        gst_rtsp_media_factory_set_launch(media_factory, MEDIA_FACTORY_BIN_DESC);
+        gchar* launch = g_strdup_printf(MEDIA_FACTORY_BIN_DESC, static_cast<guint64>(rendition.queue_size) * 1024,
+                                        static_cast<guint64>(rendition.queue_duration) * GST_MSECOND,
+                                        rendition.framerate);
+        gst_rtsp_media_factory_set_launch(media_factory, launch);
+        g_free(launch);
         gst_rtsp_media_factory_set_shared(media_factory, TRUE);
 
+        // Unicast stays available for clients that cannot join the group
+        if (rendition.multicast)
+        {
+            gst_rtsp_media_factory_set_address_pool(media_factory, address_pool);
+            auto protocols = static_cast<GstRTSPLowerTrans>(GST_RTSP_LOWER_TRANS_UDP_MCAST | GST_RTSP_LOWER_TRANS_UDP |
+                                                            GST_RTSP_LOWER_TRANS_TCP);
+            gst_rtsp_media_factory_set_protocols(media_factory, protocols);
+        }
+
         if (g_signal_connect(media_factory, "media-configure",
                              reinterpret_cast<GCallback>(StreamingServer::on_media_configure), this) == 0)
         {
             g_printerr("ERROR: cannot connect signal to media factory #%u\n", i);
             g_object_unref(media_factory);
+            if (address_pool != nullptr)
+            {
+                g_object_unref(address_pool);
+            }
             g_object_unref(mounts);
             g_object_unref(server);
             return false;
         }
 
-        g_snprintf(buff, sizeof(buff), "/video%u", i);
-        gst_rtsp_mount_points_add_factory(mounts, buff, media_factory);
+        // The first camera stays reachable at the single camera paths, with
+        // media of its own which join the same mount
+        if (i < nb_renditions)
+        {
+            g_snprintf(buff, sizeof(buff), "/video%u", i);
+            gst_rtsp_mount_points_add_factory(mounts, buff, GST_RTSP_MEDIA_FACTORY(g_object_ref(media_factory)));
+        }
+
+        const Mount& mount = m_mounts[i];
+        gst_rtsp_mount_points_add_factory(mounts, mount.path.c_str(), media_factory);
+        g_print("Mount %s configured for %s delivery\n", mount.path.c_str(),
+                rendition.multicast ? "multicast" : "unicast");
     }
     g_object_unref(mounts);
+    if (address_pool != nullptr)
+    {
+        g_object_unref(address_pool);
+    }
 
-    m_server_source = gst_rtsp_server_attach(server, nullptr);
-    if (m_server_source == 0)
+    if (g_signal_connect(server, "client-connected", reinterpret_cast<GCallback>(StreamingServer::on_client_connected),
+                         this) == 0)
     {
-        g_printerr("ERROR: cannot attach RTSP server to main context\n");
+        g_printerr("ERROR: cannot connect signal to RTSP server\n");
         g_object_unref(server);
         return false;
     }
@@ -106,84 +856,165 @@ bool StreamingServer::create_server(const char* port) noexcept
     return true;
 }
 
-bool StreamingServer::configure(const char* port) noexcept
+GSource* StreamingServer::attach_timeout(guint interval_in_seconds, GSourceFunc function) noexcept
 {
-    if (m_loop != nullptr)
+    GSource* source = g_timeout_source_new_seconds(interval_in_seconds);
+    g_source_set_callback(source, function, this, nullptr);
+    g_source_attach(source, m_context);
+    return source;
+}
+
+bool StreamingServer::configure(const Configuration& configuration, const StreamControllers& stream_controllers,
+                                GMainContext* context) noexcept
+{
+    assert(context != nullptr);
+    assert(stream_controllers.size() == configuration.cameras.size());
+
+    if (m_server != nullptr)
     {
         return false;
     }
 
-    if ((port == nullptr) || (*port == 0))
+    const char* port = configuration.port.empty() ? DEFAULT_RTSP_PORT : configuration.port.c_str();
+
+    // Mounts must exist before any media can be configured by a client
+    // Mounts are indexed as the encoded streams pushed by the cameras
+    const auto nb_renditions = static_cast<unsigned int>(configuration.renditions.size());
+    m_nb_mounts = static_cast<unsigned int>(configuration.cameras.size()) * nb_renditions;
+    m_mounts = std::make_unique<Mount[]>(m_nb_mounts);
+    for (unsigned int i = 0; i < m_nb_mounts; ++i)
     {
-        port = DEFAULT_RTSP_PORT;
+        Mount& mount = m_mounts[i];
+        mount.gop_cache.reserve(MAX_GOP_CACHE_SIZE);
+
+        gchar* path = g_strdup_printf("/cam%u/video%u", i / nb_renditions, i % nb_renditions);
+        mount.path = path;
+        g_free(path);
+        mount.controller = stream_controllers[i / nb_renditions];
+        mount.stream_idx = i % nb_renditions;
+
+        gchar* labels = g_strdup_printf("mount=\"%s\"", mount.path.c_str());
+        mount.buffers.publish("rtspcam_server_buffers_total", "Encoded buffers pushed to the media of a mount", labels);
+        mount.push_failures.publish("rtspcam_server_push_failures_total", "Buffers refused by a media appsrc", labels);
+        mount.gop_replays.publish("rtspcam_server_gop_replays_total", "Cached GOP replayed to joining media", labels);
+        mount.dropped_buffers.publish("rtspcam_server_dropped_buffers_total",
+                                      "Buffers dropped by a media over its queue budget", labels);
+        mount.overflows.publish("rtspcam_server_queue_overflows_total",
+                                "Media dropping frames until the next keyframe", labels);
+        mount.media.publish("rtspcam_server_media", "Live media of a mount", labels);
+        mount.latency.publish("rtspcam_server_latency_seconds", "Delay between the capture and the RTP payloading",
+                              labels);
+        g_free(labels);
+
+        const RenditionConfiguration& rendition = configuration.renditions[mount.stream_idx];
+        mount.adaptation.initial_bitrate = rendition.bitrate;
+        mount.adaptation.min_bitrate = rendition.bitrate_min;
+        mount.adaptation.max_bitrate = rendition.bitrate_max;
+        mount.adaptation.bitrate = rendition.bitrate;
+        m_adaptive_bitrate = m_adaptive_bitrate || (rendition.bitrate_min < rendition.bitrate_max);
     }
+    m_capture_time_sei = configuration.capture_time_sei;
+    m_context = context;
 
-    if (!create_server(port))
+    if (!create_server(port, configuration))
     {
+        m_mounts.reset();
+        m_nb_mounts = 0;
         return false;
     }
 
-    m_loop = g_main_loop_new(nullptr, FALSE);
-    m_loop_timeout = g_timeout_add_seconds(SESSIONS_CLEANUP_TIMEOUT_IN_SECONDS,
-                                           reinterpret_cast<GSourceFunc>(on_sessions_cleanup), this);
     g_print("Server configured at rtsp://127.0.0.1:%s\n", port);
     return true;
 }
 
 bool StreamingServer::start() noexcept
 {
-    if (m_loop != nullptr)
+    if (m_server == nullptr)
+    {
+        return false;
+    }
+
+    if (m_server_source != nullptr)
     {
-        g_print("Server started\n");
-        g_main_loop_run(m_loop);
         return true;
     }
 
-    return false;
+    GError* error = nullptr;
+    m_server_source = gst_rtsp_server_create_source(m_server, nullptr, &error);
+    if (m_server_source == nullptr)
+    {
+        g_printerr("ERROR: cannot create RTSP server source (%s)\n",
+                   (error != nullptr) ? error->message : "unspecified error");
+        g_clear_error(&error);
+        return false;
+    }
+    g_source_attach(m_server_source, m_context);
+
+    m_cleanup_source =
+        attach_timeout(SESSIONS_CLEANUP_TIMEOUT_IN_SECONDS, reinterpret_cast<GSourceFunc>(on_sessions_cleanup));
+    if (m_adaptive_bitrate)
+    {
+        m_adaptation_source =
+            attach_timeout(ADAPTATION_PERIOD_IN_SECONDS, reinterpret_cast<GSourceFunc>(on_bitrate_adaptation));
+    }
+
+    g_print("Server started\n");
+    return true;
 }
 
 void StreamingServer::stop() noexcept
 {
-    for (unsigned int i = 0; i < NB_MEDIA; ++i)
+    for (unsigned int i = 0; i < m_nb_mounts; ++i)
     {
-        std::lock_guard<std::mutex> guard(m_media_mutex[i]);
-        if (m_media_appsrc[i] != nullptr)
+        clear_appsrcs(m_mounts[i]);
+    }
+
+    // Sources are destroyed from any thread, the server context possibly
+    // running until they are
+    for (GSource** source : {&m_cleanup_source, &m_adaptation_source, &m_server_source})
+    {
+        if (*source != nullptr)
         {
-            gst_object_unref(m_media_appsrc[i]);
-            m_media_appsrc[i] = nullptr;
+            g_source_destroy(*source);
+            g_source_unref(*source);
+            *source = nullptr;
         }
     }
 
-    if (m_loop_timeout > 0)
+    if (m_server != nullptr)
     {
-        g_source_remove(m_loop_timeout);
-        m_loop_timeout = 0;
+        g_object_unref(m_server);
+        m_server = nullptr;
+        g_print("Server stopped\n");
     }
+}
 
-    if (m_loop != nullptr)
+bool StreamingServer::push_caps(unsigned int stream_idx, GstCaps* caps) noexcept
+{
+    if ((caps == nullptr) || (stream_idx >= m_nb_mounts))
     {
-        g_main_loop_quit(m_loop);
-        g_main_loop_unref(m_loop);
-        m_loop = nullptr;
+        return false;
     }
 
-    if (m_server_source > 0)
+    Mount& mount = m_mounts[stream_idx];
     {
-        g_source_remove(m_server_source);
-        m_server_source = 0;
-        g_print("Server stopped\n");
+        std::lock_guard<std::mutex> guard(mount.caps_mutex);
+        gst_caps_replace(&mount.caps, caps);
     }
 
-    if (m_server != nullptr)
+    // Live media follow caps changes (e.g. after a rendition resize), the
+    // caps being serialized with the buffers by appsrc
+    mount.readers.fetch_add(1);
+    const AppsrcList* appsrcs = mount.appsrcs.load();
+    if (appsrcs != nullptr)
     {
-        g_object_unref(m_server);
-        m_server = nullptr;
+        for (GstElement* appsrc : *appsrcs)
+        {
+            gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+        }
     }
-}
+    mount.readers.fetch_sub(1);
 
-bool StreamingServer::push_caps(unsigned int /*stream_idx*/, GstCaps* /*caps*/) noexcept
-{
-    // Nothing to do here as we already know the caps
     return true;
 }
 
@@ -194,41 +1025,66 @@ bool StreamingServer::push_buffer(unsigned int stream_idx, GstBuffer* buffer) no
         return false;
     }
 
-    GstElement* appsrc = nullptr;
-    if (stream_idx < NB_MEDIA)
+    if (stream_idx >= m_nb_mounts)
     {
-        std::lock_guard<std::mutex> guard(m_media_mutex[stream_idx]);
-        if (m_media_appsrc[stream_idx] != nullptr)
-        {
-            appsrc = GST_ELEMENT(gst_object_ref(m_media_appsrc[stream_idx]));
-        }
+        return false;
+    }
+
+    // New media need the replay of the last GOP, unless this buffer starts
+    // a new one
+    Mount& mount = m_mounts[stream_idx];
+    if (mount.has_joining_appsrcs.load())
+    {
+        admit_joining_appsrcs(mount, GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT));
     }
+    cache_buffer(mount, buffer);
 
-    if (appsrc == nullptr)
+    // No lock nor reference on this path: registering as a reader (before
+    // loading the pointer, both sequentially consistent) prevents the
+    // published list from being released until the reader leaves
+    mount.readers.fetch_add(1);
+    const AppsrcList* appsrcs = mount.appsrcs.load();
+    if (appsrcs == nullptr)
     {
+        mount.readers.fetch_sub(1);
         return false;
     }
 
-    // Invalidate buffer pts and dts to enable appsrc retimestamping
-    // on current running-time (do-timestamp=true).
-    // We can directly retimestamp all incoming buffers on pipeline
-    // running-time because they are pushed synchronously to the RTSP
-    // media pipeline (sync=true in EncodingPipeline fakesink configurations).
-    buffer = gst_buffer_copy(buffer);
-    GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
-    GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+    // Each pool is only used by the streaming thread of its encoded stream.
+    // The capture time SEI is inserted once for all media, in the shell only
+    buffer = mount.buffer_pool.wrap(buffer, m_capture_time_sei ? insert_capture_time_sei : nullptr);
 
-    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
-    if (ret == GST_FLOW_EOS)
+    // All media share the same shell, only its reference count grows
+    bool success = true;
+    GstElement* eos_appsrc = nullptr;
+    for (GstElement* appsrc : *appsrcs)
     {
-        std::lock_guard<std::mutex> guard(m_media_mutex[stream_idx]);
-        if (m_media_appsrc[stream_idx] == appsrc)
+        if (!within_budget(mount, appsrc, buffer))
+        {
+            continue;
+        }
+
+        GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_ref(buffer));
+        if ((ret == GST_FLOW_EOS) && (eos_appsrc == nullptr))
         {
-            gst_object_unref(m_media_appsrc[stream_idx]);
-            m_media_appsrc[stream_idx] = nullptr;
+            eos_appsrc = GST_ELEMENT(gst_object_ref(appsrc));
         }
+        if (ret != GST_FLOW_OK)
+        {
+            mount.push_failures.add();
+            success = false;
+        }
+    }
+    mount.readers.fetch_sub(1);
+    mount.buffers.add();
+    gst_buffer_unref(buffer);
+
+    // Media normally leave on unprepare, this only covers an early EOS
+    if (eos_appsrc != nullptr)
+    {
+        remove_appsrc(mount, eos_appsrc);
+        gst_object_unref(eos_appsrc);
     }
 
-    gst_object_unref(appsrc);
-    return (ret == GST_FLOW_OK);
+    return success;
 }
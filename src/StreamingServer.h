@@ -1,9 +1,17 @@
 #pragma once
 
+#include "BufferShellPool.h"
+#include "Configuration.h"
 #include "IStreamConsumer.h"
+#include "IStreamController.h"
+#include "Metrics.h"
 
+#include <atomic>
 #include <gst/rtsp-server/rtsp-server.h>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 class StreamingServer final : public IStreamConsumer
 {
@@ -20,7 +28,14 @@ class StreamingServer final : public IStreamConsumer
         stop();
     }
 
-    bool configure(const char* port = nullptr) noexcept;
+    using StreamControllers = std::vector<IStreamController*>;
+
+    // The RTSP server and its periodic tasks are dispatched from the given
+    // context, while clients are served by the threads of its pool.
+    // Encoded streams are controlled through the controller of their camera
+    // (one per configured camera).
+    bool configure(const Configuration& configuration, const StreamControllers& stream_controllers,
+                   GMainContext* context) noexcept;
     bool start() noexcept;
     void stop() noexcept;
 
@@ -28,18 +43,136 @@ class StreamingServer final : public IStreamConsumer
     bool push_buffer(unsigned int stream_idx, GstBuffer* buffer) noexcept override;
 
   private:
-    static constexpr unsigned int NB_MEDIA = 2;
+    // Referenced entry points of the live media of a mount
+    using AppsrcList = std::vector<GstElement*>;
+
+    // Worst RTCP receiver report of a mount over an adaptation period
+    struct ReceiverReport
+    {
+        bool valid = false;
+        double loss = 0.0;   // fraction of lost packets
+        double jitter = 0.0; // interarrival jitter, in ms
+    };
+
+    // Encoder bitrate control of a mount, only used from the main context.
+    // The smoothed receiver statistics move the bitrate between its bounds:
+    // down quickly when above the high thresholds, up slowly when below the
+    // low ones, and not at all in between.
+    struct BitrateAdaptation
+    {
+        unsigned int initial_bitrate = 0;
+        unsigned int min_bitrate = 0;
+        unsigned int max_bitrate = 0;
+        unsigned int bitrate = 0;
+        bool has_reports = false;
+        double loss = 0.0;
+        double jitter = 0.0;
+        gint64 last_change = 0;
+    };
+
+    // One mount per rendition of each camera, each of them possibly
+    // serving several media. The list of media appsrc is copied on write and
+    // published RCU-style: the streaming thread only registers itself as a
+    // reader around its use, and a replaced list is released once no reader
+    // may still use it (see retire_appsrcs).
+    // New media first wait in the joining list until the streaming thread
+    // replays them the last GOP, so that they can start decoding at once.
+    // Each media queues its rendition within a budget, dropping whole GOP
+    // ends when over it (see within_budget).
+    struct Mount
+    {
+        Mount() = default;
+        Mount(Mount&&) = delete;
+        Mount& operator=(Mount&&) = delete;
+        Mount(const Mount&) = delete;
+        Mount& operator=(const Mount&) = delete;
+        ~Mount();
+
+        // Encoded stream of the mount, as known by its camera controller
+        std::string path;
+        IStreamController* controller = nullptr;
+        unsigned int stream_idx = 0;
+
+        std::mutex update_mutex;
+        std::atomic<AppsrcList*> appsrcs{nullptr};
+        std::atomic<unsigned int> readers{0};
+        BufferShellPool buffer_pool;
+
+        std::mutex joining_mutex;
+        AppsrcList joining_appsrcs;
+        std::atomic<bool> has_joining_appsrcs{false};
+
+        // Buffers since the last keyframe, only used by the streaming thread
+        std::vector<GstBuffer*> gop_cache;
+
+        // Encoder caps and SDP parameter sets of the stream, applied to new
+        // media so that they can be described without waiting for a keyframe
+        std::mutex caps_mutex;
+        GstCaps* caps = nullptr;
+        gchar* sprop_parameter_sets = nullptr;
+
+        Counter buffers;
+        Counter push_failures;
+        Counter gop_replays;
+        Counter dropped_buffers;
+        Counter overflows;
+        Gauge media;
+        Histogram latency;
+
+        BitrateAdaptation adaptation;
+    };
+
+    // Held by a configured media (as object data) until it is detached from
+    // its mount, whichever of unprepare, NULL target state or finalization
+    // comes first
+    struct MediaAttachment
+    {
+        Mount* mount = nullptr;
+        GstElement* entry_point = nullptr;
+    };
+
     static gboolean on_sessions_cleanup(StreamingServer* streaming_server) noexcept;
+    static gboolean on_bitrate_adaptation(StreamingServer* streaming_server) noexcept;
     static void on_media_configure(GstRTSPMediaFactory* factory, GstRTSPMedia* media,
                                    StreamingServer* streaming_server) noexcept;
+    static void on_media_unprepared(GstRTSPMedia* media, StreamingServer* streaming_server) noexcept;
+    static void on_media_target_state(GstRTSPMedia* media, gint state, StreamingServer* streaming_server) noexcept;
+    static GstPadProbeReturn on_payloaded_data(GstPad* pad, GstPadProbeInfo* info, Mount* mount) noexcept;
+    static void on_client_connected(GstRTSPServer* server, GstRTSPClient* client,
+                                    StreamingServer* streaming_server) noexcept;
+    static void on_play_request(GstRTSPClient* client, GstRTSPContext* context,
+                                StreamingServer* streaming_server) noexcept;
+
+    static void detach_media(MediaAttachment* attachment) noexcept;
+    static void share_stream_time(const Mount& mount, GstElement* media_bin) noexcept;
+    static GstElement* get_entry_point(GstRTSPMedia* media) noexcept;
+    static void apply_stream_caps(Mount& mount, GstRTSPMedia* media, GstElement* entry_point) noexcept;
+    static void update_parameter_sets(Mount& mount, GstBuffer* keyframe) noexcept;
+    static void join_appsrc(Mount& mount, GstElement* appsrc) noexcept;
+    static void admit_joining_appsrcs(Mount& mount, bool replay) noexcept;
+    static bool within_budget(Mount& mount, GstElement* appsrc, GstBuffer* buffer) noexcept;
+    static AppsrcList* add_appsrcs(Mount& mount, const AppsrcList& added) noexcept;
+    static void remove_appsrc(Mount& mount, GstElement* appsrc) noexcept;
+    static void clear_appsrcs(Mount& mount) noexcept;
+    static AppsrcList* publish_appsrcs(Mount& mount, AppsrcList* appsrcs) noexcept;
+    static void retire_appsrcs(Mount& mount, AppsrcList* appsrcs) noexcept;
+    static void cache_buffer(Mount& mount, GstBuffer* buffer) noexcept;
+    static void clear_gop_cache(Mount& mount) noexcept;
+    static void collect_receiver_reports(GstRTSPMedia* media, ReceiverReport& report) noexcept;
+
+    void adapt_bitrate(unsigned int mount_idx, const ReceiverReport& report) noexcept;
 
-    bool create_server(const char* port) noexcept;
+    bool create_server(const char* port, const Configuration& configuration) noexcept;
+    GSource* attach_timeout(guint interval_in_seconds, GSourceFunc function) noexcept;
 
     GstRTSPServer* m_server = nullptr;
-    guint m_server_source = 0;
-    GMainLoop* m_loop = nullptr;
-    guint m_loop_timeout = 0;
+    GMainContext* m_context = nullptr;
+    GSource* m_server_source = nullptr;
+    GSource* m_cleanup_source = nullptr;
+    GSource* m_adaptation_source = nullptr;
+    bool m_adaptive_bitrate = false;
 
-    std::mutex m_media_mutex[NB_MEDIA];
-    GstElement* m_media_appsrc[NB_MEDIA] = {nullptr};
+    bool m_capture_time_sei = false;
+    std::unique_ptr<Mount[]> m_mounts;
+    unsigned int m_nb_mounts = 0;
 };
@@ -1,28 +1,10 @@
 #include "CameraManager.h"
+#include "StartupTimeline.h"
 
 #include <glib-unix.h>
 
 namespace
 {
-gboolean on_take_screenshot(CameraManager* manager)
-{
-    manager->take_screenshot();
-    return G_SOURCE_CONTINUE;
-}
-
-gboolean on_switch_recording(CameraManager* manager)
-{
-    if (manager->is_recording())
-    {
-        manager->stop_recording();
-    }
-    else
-    {
-        manager->start_recording();
-    }
-    return G_SOURCE_CONTINUE;
-}
-
 gboolean on_quit(CameraManager* manager)
 {
     g_print("\n");
@@ -33,16 +15,24 @@ gboolean on_quit(CameraManager* manager)
 
 int main(int argc, char* argv[])
 {
+    start_startup_timeline();
     gst_init(&argc, &argv);
+    mark_startup_milestone(StartupMilestone::GST_INITIALIZED);
+
+    // Optional configuration file as first argument, defaults otherwise
+    Configuration configuration;
+    if ((argc > 1) && !load_configuration(argv[1], configuration))
+    {
+        return -3;
+    }
 
     CameraManager manager;
-    if (!manager.init())
+    if (!manager.init(configuration))
     {
         return -1;
     }
 
-    g_unix_signal_add(SIGUSR1, reinterpret_cast<GSourceFunc>(on_take_screenshot), &manager);
-    g_unix_signal_add(SIGUSR2, reinterpret_cast<GSourceFunc>(on_switch_recording), &manager);
+    // Screenshots and recordings are requested on the control socket
     g_unix_signal_add(SIGINT, reinterpret_cast<GSourceFunc>(on_quit), &manager);
     if (!manager.run_and_wait())
     {
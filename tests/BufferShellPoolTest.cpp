@@ -0,0 +1,145 @@
+#include "BufferShellPool.h"
+#include "CaptureTimeMeta.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace
+{
+constexpr unsigned int NB_SHELLS = 16; // BufferShellPool::NB_SHELLS
+
+GstBuffer* create_access_unit(GstClockTime pts, bool keyframe)
+{
+    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, 1024, nullptr);
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DTS(buffer) = pts;
+    GST_BUFFER_DURATION(buffer) = 33 * GST_MSECOND;
+    if (!keyframe)
+    {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    set_capture_time(buffer, 42 * GST_SECOND);
+    return buffer;
+}
+
+bool mark_shell(GstBuffer* shell)
+{
+    GST_BUFFER_OFFSET(shell) = 1;
+    return true;
+}
+} // namespace
+
+TEST(BufferShellPoolTest, WrapSharesMemoryAndMetadata)
+{
+    BufferShellPool pool;
+    GstBuffer* buffer = create_access_unit(GST_SECOND, false);
+
+    GstBuffer* shell = pool.wrap(buffer);
+    ASSERT_NE(shell, nullptr);
+    EXPECT_NE(shell, buffer);
+    ASSERT_EQ(gst_buffer_n_memory(shell), 1U);
+    EXPECT_EQ(gst_buffer_peek_memory(shell, 0), gst_buffer_peek_memory(buffer, 0));
+    EXPECT_EQ(GST_BUFFER_PTS(shell), GST_SECOND);
+    EXPECT_EQ(GST_BUFFER_DTS(shell), GST_SECOND);
+    EXPECT_EQ(GST_BUFFER_DURATION(shell), 33 * GST_MSECOND);
+    EXPECT_TRUE(GST_BUFFER_FLAG_IS_SET(shell, GST_BUFFER_FLAG_DELTA_UNIT));
+    EXPECT_EQ(get_capture_time(shell), 42 * GST_SECOND);
+
+    gst_buffer_unref(shell);
+    gst_buffer_unref(buffer);
+}
+
+TEST(BufferShellPoolTest, ReleasedShellsAreRecycled)
+{
+    BufferShellPool pool;
+    GstBuffer* buffer = create_access_unit(0, true);
+
+    std::vector<GstBuffer*> shells;
+    for (unsigned int i = 0; i < NB_SHELLS; ++i)
+    {
+        GstBuffer* shell = pool.wrap(buffer);
+        shells.push_back(shell);
+        gst_buffer_unref(shell);
+    }
+
+    // Once released by the consumer, the shells are handed out again in turn
+    // without any new buffer
+    for (unsigned int i = 0; i < 2 * NB_SHELLS; ++i)
+    {
+        GstBuffer* shell = pool.wrap(buffer);
+        EXPECT_EQ(shell, shells[i % NB_SHELLS]);
+        gst_buffer_unref(shell);
+    }
+
+    gst_buffer_unref(buffer);
+}
+
+TEST(BufferShellPoolTest, RecycledShellTakesNewMetadata)
+{
+    BufferShellPool pool;
+    GstBuffer* keyframe = create_access_unit(GST_SECOND, true);
+    GstBuffer* delta = create_access_unit(2 * GST_SECOND, false);
+    remove_capture_time(delta);
+
+    for (unsigned int i = 0; i < NB_SHELLS; ++i)
+    {
+        gst_buffer_unref(pool.wrap(delta));
+    }
+
+    GstBuffer* shell = pool.wrap(keyframe);
+    EXPECT_EQ(GST_BUFFER_PTS(shell), GST_SECOND);
+    EXPECT_FALSE(GST_BUFFER_FLAG_IS_SET(shell, GST_BUFFER_FLAG_DELTA_UNIT));
+    EXPECT_EQ(get_capture_time(shell), 42 * GST_SECOND);
+    EXPECT_EQ(gst_buffer_peek_memory(shell, 0), gst_buffer_peek_memory(keyframe, 0));
+    gst_buffer_unref(shell);
+
+    // The capture time of a previous frame must not leak into the next one
+    shell = pool.wrap(delta);
+    EXPECT_EQ(GST_BUFFER_PTS(shell), 2 * GST_SECOND);
+    EXPECT_FALSE(GST_CLOCK_TIME_IS_VALID(get_capture_time(shell)));
+    gst_buffer_unref(shell);
+
+    gst_buffer_unref(delta);
+    gst_buffer_unref(keyframe);
+}
+
+TEST(BufferShellPoolTest, FallsBackOnCopyWhenAllShellsAreInUse)
+{
+    BufferShellPool pool;
+    GstBuffer* buffer = create_access_unit(GST_SECOND, false);
+
+    std::vector<GstBuffer*> shells;
+    for (unsigned int i = 0; i < NB_SHELLS; ++i)
+    {
+        shells.push_back(pool.wrap(buffer));
+    }
+
+    GstBuffer* copy = pool.wrap(buffer);
+    for (GstBuffer* shell : shells)
+    {
+        EXPECT_NE(copy, shell);
+    }
+    EXPECT_EQ(GST_MINI_OBJECT_REFCOUNT_VALUE(copy), 1);
+    EXPECT_EQ(GST_BUFFER_PTS(copy), GST_SECOND);
+    EXPECT_EQ(get_capture_time(copy), 42 * GST_SECOND);
+    gst_buffer_unref(copy);
+
+    for (GstBuffer* shell : shells)
+    {
+        gst_buffer_unref(shell);
+    }
+    gst_buffer_unref(buffer);
+}
+
+TEST(BufferShellPoolTest, HookIsCalledOnTheShellOnly)
+{
+    BufferShellPool pool;
+    GstBuffer* buffer = create_access_unit(0, true);
+
+    GstBuffer* shell = pool.wrap(buffer, mark_shell);
+    EXPECT_EQ(GST_BUFFER_OFFSET(shell), 1U);
+    EXPECT_NE(GST_BUFFER_OFFSET(buffer), 1U);
+
+    gst_buffer_unref(shell);
+    gst_buffer_unref(buffer);
+}
@@ -0,0 +1,221 @@
+#include "CaptureTimeMeta.h"
+
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace
+{
+using Bytes = std::vector<guint8>;
+
+constexpr guint8 CAPTURE_TIME_UUID[16] = {0x7a, 0x3c, 0x51, 0x0e, 0x92, 0x4b, 0x4d, 0x1f,
+                                          0xa8, 0x36, 0x5e, 0xc2, 0x10, 0x9d, 0x6b, 0xf4};
+// Start code, SEI NAL header, user data unregistered payload type and size
+const Bytes SEI_HEADER = {0x00, 0x00, 0x00, 0x01, 0x06, 0x05, 0x18};
+
+const Bytes AUD = {0x00, 0x00, 0x00, 0x01, 0x09, 0x10};
+const Bytes SPS = {0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x1f};
+const Bytes PPS = {0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80};
+const Bytes IDR_SLICE = {0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x21};
+const Bytes SLICE = {0x00, 0x00, 0x01, 0x41, 0x9a, 0x00, 0x00, 0x03, 0x01};
+
+Bytes concat(std::initializer_list<Bytes> parts)
+{
+    Bytes bytes;
+    for (const Bytes& part : parts)
+    {
+        bytes.insert(bytes.end(), part.begin(), part.end());
+    }
+    return bytes;
+}
+
+GstBuffer* create_access_unit(std::initializer_list<Bytes> memories)
+{
+    GstBuffer* buffer = gst_buffer_new();
+    for (const Bytes& bytes : memories)
+    {
+        gpointer data = g_memdup2(bytes.data(), bytes.size());
+        gst_buffer_append_memory(buffer, gst_memory_new_wrapped(static_cast<GstMemoryFlags>(0), data, bytes.size(),
+                                                                0, bytes.size(), data, g_free));
+    }
+    return buffer;
+}
+
+Bytes get_bytes(GstBuffer* buffer)
+{
+    GstMapInfo map;
+    EXPECT_TRUE(gst_buffer_map(buffer, &map, GST_MAP_READ));
+    Bytes bytes(map.data, map.data + map.size);
+    gst_buffer_unmap(buffer, &map);
+    return bytes;
+}
+
+Bytes get_bytes(GstMemory* memory)
+{
+    GstMapInfo map;
+    EXPECT_TRUE(gst_memory_map(memory, &map, GST_MAP_READ));
+    Bytes bytes(map.data, map.data + map.size);
+    gst_memory_unmap(memory, &map);
+    return bytes;
+}
+
+// Whether the escaped bytes hold a 00 00 0x sequence (x <= 3)
+bool has_start_code_emulation(const Bytes& bytes)
+{
+    for (size_t i = 0; i + 2 < bytes.size(); ++i)
+    {
+        if ((bytes[i] == 0) && (bytes[i + 1] == 0) && (bytes[i + 2] <= 3))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Capture time of an SEI NAL unit, checking its layout and escaping
+::testing::AssertionResult parse_sei(const Bytes& nal, guint64& wall_clock_time)
+{
+    if ((nal.size() < SEI_HEADER.size() + 1) || !std::equal(SEI_HEADER.begin(), SEI_HEADER.end(), nal.begin()))
+    {
+        return ::testing::AssertionFailure() << "invalid SEI header";
+    }
+    if (nal.back() != 0x80)
+    {
+        return ::testing::AssertionFailure() << "missing RBSP stop bit";
+    }
+
+    Bytes escaped(nal.begin() + static_cast<std::ptrdiff_t>(SEI_HEADER.size()), nal.end() - 1);
+    if (has_start_code_emulation(escaped))
+    {
+        return ::testing::AssertionFailure() << "start code emulation in the payload";
+    }
+
+    Bytes payload;
+    unsigned int nb_zeros = 0;
+    for (guint8 byte : escaped)
+    {
+        if ((nb_zeros == 2) && (byte == 3))
+        {
+            nb_zeros = 0;
+            continue;
+        }
+        payload.push_back(byte);
+        nb_zeros = (byte == 0) ? nb_zeros + 1 : 0;
+    }
+
+    if ((payload.size() != sizeof(CAPTURE_TIME_UUID) + 8) ||
+        !std::equal(std::begin(CAPTURE_TIME_UUID), std::end(CAPTURE_TIME_UUID), payload.begin()))
+    {
+        return ::testing::AssertionFailure() << "invalid SEI payload";
+    }
+
+    wall_clock_time = 0;
+    for (size_t i = sizeof(CAPTURE_TIME_UUID); i < payload.size(); ++i)
+    {
+        wall_clock_time = (wall_clock_time << 8) | payload[i];
+    }
+    return ::testing::AssertionSuccess();
+}
+} // namespace
+
+TEST(CaptureTimeMetaTest, SeiCarriesWallClockTime)
+{
+    // Times whose bytes hold 00 00 0x sequences, within the time and across
+    // the end of the payload
+    const guint64 times[] = {0x0000010000000203, 0x0000000300000000, 0x0102030400000001, 0x0006234d1e7c2000,
+                             0x1234567800000000, G_MAXUINT64};
+    for (guint64 time : times)
+    {
+        GstMemory* sei = create_wall_clock_time_sei(time);
+        ASSERT_NE(sei, nullptr);
+        guint64 parsed_time = 0;
+        EXPECT_TRUE(parse_sei(get_bytes(sei), parsed_time)) << std::hex << time;
+        EXPECT_EQ(parsed_time, time);
+        gst_memory_unref(sei);
+    }
+}
+
+TEST(CaptureTimeMetaTest, SeiEscapesEveryZeroPair)
+{
+    GstMemory* sei = create_wall_clock_time_sei(0);
+    Bytes nal = get_bytes(sei);
+    gst_memory_unref(sei);
+
+    Bytes expected = concat({SEI_HEADER, Bytes(std::begin(CAPTURE_TIME_UUID), std::end(CAPTURE_TIME_UUID)),
+                             {0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x80}});
+    EXPECT_EQ(nal, expected);
+}
+
+TEST(CaptureTimeMetaTest, SeiIsInsertedBeforeFirstSlice)
+{
+    GstBuffer* buffer = create_access_unit({concat({AUD, SPS, PPS, IDR_SLICE})});
+    set_capture_time(buffer, gst_util_get_timestamp());
+    auto now = static_cast<guint64>(g_get_real_time());
+
+    ASSERT_TRUE(insert_capture_time_sei(buffer));
+    Bytes bytes = get_bytes(buffer);
+    Bytes prefix = concat({AUD, SPS, PPS});
+    ASSERT_GT(bytes.size(), prefix.size() + IDR_SLICE.size());
+    EXPECT_TRUE(std::equal(prefix.begin(), prefix.end(), bytes.begin()));
+    EXPECT_TRUE(std::equal(IDR_SLICE.rbegin(), IDR_SLICE.rend(), bytes.rbegin()));
+
+    Bytes sei(bytes.begin() + static_cast<std::ptrdiff_t>(prefix.size()),
+              bytes.end() - static_cast<std::ptrdiff_t>(IDR_SLICE.size()));
+    guint64 wall_clock_time = 0;
+    EXPECT_TRUE(parse_sei(sei, wall_clock_time));
+    EXPECT_LE(wall_clock_time, now + G_USEC_PER_SEC);
+    EXPECT_GE(wall_clock_time + G_USEC_PER_SEC, now);
+    gst_buffer_unref(buffer);
+}
+
+TEST(CaptureTimeMetaTest, SeiIsInsertedBeforeThreeByteStartCode)
+{
+    GstBuffer* buffer = create_access_unit({concat({AUD, SLICE})});
+    set_capture_time(buffer, gst_util_get_timestamp());
+
+    ASSERT_TRUE(insert_capture_time_sei(buffer));
+    Bytes bytes = get_bytes(buffer);
+    EXPECT_TRUE(std::equal(AUD.begin(), AUD.end(), bytes.begin()));
+    EXPECT_TRUE(std::equal(SLICE.rbegin(), SLICE.rend(), bytes.rbegin()));
+
+    Bytes sei(bytes.begin() + static_cast<std::ptrdiff_t>(AUD.size()),
+              bytes.end() - static_cast<std::ptrdiff_t>(SLICE.size()));
+    guint64 wall_clock_time = 0;
+    EXPECT_TRUE(parse_sei(sei, wall_clock_time));
+    gst_buffer_unref(buffer);
+}
+
+TEST(CaptureTimeMetaTest, SeiSplitsTheMemoryOfTheSlice)
+{
+    GstBuffer* buffer = create_access_unit({concat({AUD, SPS}), concat({PPS, IDR_SLICE})});
+    set_capture_time(buffer, gst_util_get_timestamp());
+    GstMemory* slice_memory = gst_memory_ref(gst_buffer_peek_memory(buffer, 1));
+
+    ASSERT_TRUE(insert_capture_time_sei(buffer));
+    ASSERT_EQ(gst_buffer_n_memory(buffer), 4U);
+    EXPECT_EQ(get_bytes(gst_buffer_peek_memory(buffer, 0)), concat({AUD, SPS}));
+    EXPECT_EQ(get_bytes(gst_buffer_peek_memory(buffer, 1)), PPS);
+    EXPECT_EQ(get_bytes(gst_buffer_peek_memory(buffer, 3)), IDR_SLICE);
+
+    // Shared with the memory of the encoder, not copied
+    EXPECT_EQ(gst_buffer_peek_memory(buffer, 3)->parent, slice_memory);
+
+    guint64 wall_clock_time = 0;
+    EXPECT_TRUE(parse_sei(get_bytes(gst_buffer_peek_memory(buffer, 2)), wall_clock_time));
+    gst_memory_unref(slice_memory);
+    gst_buffer_unref(buffer);
+}
+
+TEST(CaptureTimeMetaTest, SeiNeedsCaptureTimeAndSlice)
+{
+    GstBuffer* buffer = create_access_unit({concat({AUD, SPS, PPS, IDR_SLICE})});
+    EXPECT_FALSE(insert_capture_time_sei(buffer));
+    EXPECT_EQ(gst_buffer_n_memory(buffer), 1U);
+    gst_buffer_unref(buffer);
+
+    buffer = create_access_unit({concat({AUD, SPS, PPS})});
+    set_capture_time(buffer, gst_util_get_timestamp());
+    EXPECT_FALSE(insert_capture_time_sei(buffer));
+    EXPECT_EQ(get_bytes(buffer), concat({AUD, SPS, PPS}));
+    gst_buffer_unref(buffer);
+}
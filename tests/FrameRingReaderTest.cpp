@@ -0,0 +1,336 @@
+#include "FrameRingReader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr uint32_t NB_SLOTS = 4;
+constexpr uint32_t SLOT_SIZE = 256;
+
+// Name of a shared memory object unique to the running test
+std::string get_ring_name()
+{
+    return std::string("rtsp-cam-test-") + std::to_string(getpid()) + "-" +
+           ::testing::UnitTest::GetInstance()->current_test_info()->name();
+}
+
+// Producer side of the ring, written after FrameExporter from FrameRing.h
+// only
+class RingWriter final
+{
+  public:
+    explicit RingWriter(const std::string& name, uint32_t nb_slots = NB_SLOTS, uint32_t magic = FRAME_RING_MAGIC)
+        : m_path("/" + name), m_size(frame_ring_size(nb_slots, SLOT_SIZE))
+    {
+        shm_unlink(m_path.c_str());
+        int fd = shm_open(m_path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        void* mapping = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(m_size)) == 0)
+        {
+            mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return;
+        }
+
+        m_header = static_cast<FrameRingHeader*>(mapping);
+        m_header->version = FRAME_RING_VERSION;
+        m_header->nb_slots = nb_slots;
+        m_header->slot_size = SLOT_SIZE;
+        std::atomic_thread_fence(std::memory_order_release);
+        m_header->magic = magic;
+    }
+
+    RingWriter(RingWriter&&) = delete;
+    RingWriter& operator=(RingWriter&&) = delete;
+    RingWriter(const RingWriter&) = delete;
+    RingWriter& operator=(const RingWriter&) = delete;
+
+    ~RingWriter()
+    {
+        if (m_header != nullptr)
+        {
+            munmap(m_header, m_size);
+        }
+        shm_unlink(m_path.c_str());
+    }
+
+    bool is_open() const
+    {
+        return (m_header != nullptr);
+    }
+
+    void set_caps(const char* caps)
+    {
+        uint32_t sequence = m_header->caps_sequence.load(std::memory_order_relaxed);
+        m_header->caps_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        strncpy(m_header->caps, caps, FRAME_RING_CAPS_SIZE - 1);
+        m_header->caps_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Frame filled with the given value, returning its number
+    uint64_t write(uint8_t value, uint32_t size = SLOT_SIZE)
+    {
+        uint64_t frame = begin_write();
+        FrameSlotHeader* slot = frame_ring_slot(m_header, frame);
+        slot->pts = frame * 1000;
+        slot->size = size;
+        slot->caps_sequence = m_header->caps_sequence.load(std::memory_order_relaxed);
+        memset(frame_ring_slot_data(slot), value, size);
+        end_write(frame);
+        return frame;
+    }
+
+    // The slot of the next frame is left being written until end_write
+    uint64_t begin_write()
+    {
+        uint64_t frame = ++m_last_frame;
+        frame_ring_slot(m_header, frame)->sequence.store(2 * frame - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return frame;
+    }
+
+    void end_write(uint64_t frame)
+    {
+        frame_ring_slot(m_header, frame)->sequence.store(2 * frame, std::memory_order_release);
+        m_header->last_frame.store(frame, std::memory_order_release);
+    }
+
+    void close_ring()
+    {
+        m_header->closed.store(1, std::memory_order_release);
+    }
+
+  private:
+    std::string m_path;
+    size_t m_size = 0;
+    FrameRingHeader* m_header = nullptr;
+    uint64_t m_last_frame = 0;
+};
+
+bool is_filled_with(const FrameRingReader::Frame& frame, uint8_t value)
+{
+    for (size_t i = 0; i < frame.size; ++i)
+    {
+        if (frame.data[i] != value)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+TEST(FrameRingReaderTest, OpenFailsWithoutRing)
+{
+    FrameRingReader reader;
+    EXPECT_FALSE(reader.open(get_ring_name().c_str()));
+    EXPECT_EQ(errno, ENOENT);
+    EXPECT_TRUE(reader.is_closed());
+
+    FrameRingReader::Frame frame;
+    EXPECT_FALSE(reader.next_frame(frame));
+}
+
+TEST(FrameRingReaderTest, OpenRejectsUnknownRing)
+{
+    RingWriter writer(get_ring_name(), NB_SLOTS, 0);
+    ASSERT_TRUE(writer.is_open());
+
+    FrameRingReader reader;
+    EXPECT_FALSE(reader.open(get_ring_name().c_str()));
+    EXPECT_EQ(errno, EPROTO);
+}
+
+TEST(FrameRingReaderTest, ReadsNewFramesInOrder)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    writer.write(1);
+
+    // Frames written before the ring is opened are not returned
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+    FrameRingReader::Frame frame;
+    EXPECT_FALSE(reader.next_frame(frame));
+
+    writer.write(2, 100);
+    writer.write(3);
+    ASSERT_TRUE(reader.next_frame(frame));
+    EXPECT_EQ(frame.number, 2U);
+    EXPECT_EQ(frame.pts, 2000U);
+    EXPECT_EQ(frame.size, 100U);
+    EXPECT_TRUE(is_filled_with(frame, 2));
+    EXPECT_TRUE(reader.is_valid(frame));
+
+    ASSERT_TRUE(reader.next_frame(frame));
+    EXPECT_EQ(frame.number, 3U);
+    EXPECT_EQ(frame.size, SLOT_SIZE);
+    EXPECT_TRUE(is_filled_with(frame, 3));
+
+    EXPECT_FALSE(reader.next_frame(frame));
+    EXPECT_EQ(reader.lost_frames(), 0U);
+}
+
+TEST(FrameRingReaderTest, SkipsOverwrittenFrames)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+
+    for (uint8_t i = 1; i <= 10; ++i)
+    {
+        writer.write(i);
+    }
+
+    // The slot of the oldest frame is the next one to be written
+    FrameRingReader::Frame frame;
+    for (uint64_t number = 10 - NB_SLOTS + 2; number <= 10; ++number)
+    {
+        ASSERT_TRUE(reader.next_frame(frame));
+        EXPECT_EQ(frame.number, number);
+        EXPECT_TRUE(is_filled_with(frame, static_cast<uint8_t>(number)));
+    }
+    EXPECT_FALSE(reader.next_frame(frame));
+    EXPECT_EQ(reader.lost_frames(), 10U - NB_SLOTS + 1);
+}
+
+TEST(FrameRingReaderTest, SkipsFrameBeingWritten)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+
+    for (uint8_t i = 1; i <= NB_SLOTS; ++i)
+    {
+        writer.write(i);
+    }
+
+    // Frame 1 slot is being rewritten, its previous frame being lost
+    writer.begin_write();
+    FrameRingReader::Frame frame;
+    ASSERT_TRUE(reader.next_frame(frame));
+    EXPECT_EQ(frame.number, 2U);
+    EXPECT_EQ(reader.lost_frames(), 1U);
+}
+
+TEST(FrameRingReaderTest, FrameIsInvalidOnceOverwritten)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+
+    writer.write(1);
+    FrameRingReader::Frame frame;
+    ASSERT_TRUE(reader.next_frame(frame));
+
+    for (uint8_t i = 2; i < NB_SLOTS + 1; ++i)
+    {
+        writer.write(i);
+    }
+    EXPECT_TRUE(reader.is_valid(frame));
+
+    uint64_t overwriting = writer.begin_write();
+    EXPECT_FALSE(reader.is_valid(frame));
+    writer.end_write(overwriting);
+    EXPECT_FALSE(reader.is_valid(frame));
+}
+
+TEST(FrameRingReaderTest, ReadsCapsOfTheirSequence)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+
+    writer.set_caps("video/x-raw,format=I420,width=640,height=480");
+    writer.write(1);
+    FrameRingReader::Frame frame;
+    ASSERT_TRUE(reader.next_frame(frame));
+
+    std::string caps;
+    ASSERT_TRUE(reader.read_caps(frame.caps_sequence, caps));
+    EXPECT_EQ(caps, "video/x-raw,format=I420,width=640,height=480");
+    EXPECT_FALSE(reader.read_caps(frame.caps_sequence + 1, caps));
+
+    writer.set_caps("video/x-raw,format=I420,width=320,height=240");
+    EXPECT_FALSE(reader.read_caps(frame.caps_sequence, caps));
+}
+
+TEST(FrameRingReaderTest, ReportsClosedRing)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+    EXPECT_FALSE(reader.is_closed());
+
+    writer.close_ring();
+    EXPECT_TRUE(reader.is_closed());
+}
+
+TEST(FrameRingReaderTest, ValidFramesAreNeverTorn)
+{
+    RingWriter writer(get_ring_name());
+    ASSERT_TRUE(writer.is_open());
+    FrameRingReader reader;
+    ASSERT_TRUE(reader.open(get_ring_name().c_str()));
+
+    // The producer never waits for the reader, which copies the frames and
+    // only keeps the ones still valid once copied
+    constexpr unsigned int NB_FRAMES = 20000;
+    std::thread producer([&writer]() {
+        for (unsigned int i = 1; i <= NB_FRAMES; ++i)
+        {
+            writer.write(static_cast<uint8_t>(i));
+        }
+    });
+
+    uint64_t last_number = 0;
+    unsigned int nb_read = 0;
+    std::vector<uint8_t> copy(SLOT_SIZE);
+    while (last_number < NB_FRAMES)
+    {
+        FrameRingReader::Frame frame;
+        if (!reader.next_frame(frame))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        EXPECT_GT(frame.number, last_number);
+        last_number = frame.number;
+        memcpy(copy.data(), frame.data, frame.size);
+        if (!reader.is_valid(frame))
+        {
+            continue;
+        }
+
+        ++nb_read;
+        EXPECT_EQ(frame.size, SLOT_SIZE);
+        EXPECT_EQ(copy[0], static_cast<uint8_t>(frame.number));
+        EXPECT_EQ(copy[SLOT_SIZE - 1], static_cast<uint8_t>(frame.number));
+    }
+    producer.join();
+
+    EXPECT_GT(nb_read, 0U);
+    EXPECT_LE(nb_read + reader.lost_frames(), NB_FRAMES);
+}
@@ -0,0 +1,257 @@
+#include "MotionDetector.h"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Sampled on a grid of 80x60 luma samples
+constexpr gint FRAME_WIDTH = 160;
+constexpr gint FRAME_HEIGHT = 120;
+constexpr guint8 BACKGROUND = 0x80;
+constexpr guint8 BLOCK_LUMA = 0x20;
+constexpr unsigned int BLOCK_Y = 32;
+// Moved by its own size, a large block changes 2 * 16 * 16 samples (106
+// permille), a small one 2 * 6 * 6 samples (15 permille)
+constexpr unsigned int LARGE_BLOCK = 32;
+constexpr unsigned int SMALL_BLOCK = 12;
+
+const GstVideoFormat FORMATS[] = {GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_YUY2,
+                                  GST_VIDEO_FORMAT_GRAY8};
+
+MotionConfiguration create_configuration(unsigned int post_roll = 0)
+{
+    MotionConfiguration configuration;
+    configuration.enabled = true;
+    configuration.pixel_threshold = 24;
+    configuration.start_permille = 20;
+    configuration.stop_permille = 10;
+    configuration.start_frames = 3;
+    configuration.post_roll = post_roll;
+    return configuration;
+}
+
+// Camera filming a dark square block on a gray background, the block being
+// moved or held still from frame to frame. Frames carry a video meta, so
+// that they can be laid out with padded strides.
+class TestCamera final
+{
+  public:
+    explicit TestCamera(GstVideoFormat format, const MotionConfiguration& configuration = create_configuration(),
+                        guint padding = 0)
+    {
+        m_detector.configure(configuration, [this](bool motion) { m_events.push_back(motion); });
+
+        gst_video_info_set_format(&m_info, format, FRAME_WIDTH, FRAME_HEIGHT);
+        GstCaps* caps = gst_video_info_to_caps(&m_info);
+        m_configured = m_detector.push_caps(0, caps);
+        gst_caps_unref(caps);
+
+        if (padding > 0)
+        {
+            GstVideoAlignment alignment;
+            gst_video_alignment_reset(&alignment);
+            alignment.padding_right = padding;
+            gst_video_info_align(&m_info, &alignment);
+        }
+    }
+
+    TestCamera(TestCamera&&) = delete;
+    TestCamera& operator=(TestCamera&&) = delete;
+    TestCamera(const TestCamera&) = delete;
+    TestCamera& operator=(const TestCamera&) = delete;
+
+    ~TestCamera() = default;
+
+    bool is_configured() const noexcept
+    {
+        return m_configured;
+    }
+
+    // Frames with the block of the given size moved by its size each time
+    bool move(unsigned int block_size, unsigned int nb_frames)
+    {
+        bool pushed = true;
+        for (unsigned int i = 0; i < nb_frames; ++i)
+        {
+            m_block_x = (m_block_x + block_size) % (FRAME_WIDTH - block_size);
+            m_block_size = block_size;
+            pushed = push_frame() && pushed;
+        }
+        return pushed;
+    }
+
+    // Frames identical to the last one
+    bool hold(unsigned int nb_frames)
+    {
+        bool pushed = true;
+        for (unsigned int i = 0; i < nb_frames; ++i)
+        {
+            pushed = push_frame() && pushed;
+        }
+        return pushed;
+    }
+
+    const std::vector<bool>& events() const noexcept
+    {
+        return m_events;
+    }
+
+  private:
+    bool push_frame()
+    {
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&m_info), nullptr);
+        gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_INFO_FORMAT(&m_info),
+                                       FRAME_WIDTH, FRAME_HEIGHT, GST_VIDEO_INFO_N_PLANES(&m_info), m_info.offset,
+                                       m_info.stride);
+
+        GstVideoFrame frame;
+        if (!gst_video_frame_map(&frame, &m_info, buffer, GST_MAP_WRITE))
+        {
+            gst_buffer_unref(buffer);
+            return false;
+        }
+        for (guint c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS(&frame); ++c)
+        {
+            auto* data = static_cast<guint8*>(GST_VIDEO_FRAME_COMP_DATA(&frame, c));
+            const auto stride = static_cast<size_t>(GST_VIDEO_FRAME_COMP_STRIDE(&frame, c));
+            const auto pixel_stride = static_cast<size_t>(GST_VIDEO_FRAME_COMP_PSTRIDE(&frame, c));
+            const auto width = static_cast<unsigned int>(GST_VIDEO_FRAME_COMP_WIDTH(&frame, c));
+            const auto height = static_cast<unsigned int>(GST_VIDEO_FRAME_COMP_HEIGHT(&frame, c));
+            for (unsigned int y = 0; y < height; ++y)
+            {
+                for (unsigned int x = 0; x < width; ++x)
+                {
+                    bool in_block = (c == 0) && (x >= m_block_x) && (x < m_block_x + m_block_size) &&
+                                    (y >= BLOCK_Y) && (y < BLOCK_Y + m_block_size);
+                    data[y * stride + x * pixel_stride] = in_block ? BLOCK_LUMA : BACKGROUND;
+                }
+            }
+        }
+        gst_video_frame_unmap(&frame);
+
+        bool pushed = m_detector.push_buffer(0, buffer);
+        gst_buffer_unref(buffer);
+        return pushed;
+    }
+
+    MotionDetector m_detector;
+    GstVideoInfo m_info = {};
+    bool m_configured = false;
+    unsigned int m_block_x = 0;
+    unsigned int m_block_size = 0;
+    std::vector<bool> m_events;
+};
+} // namespace
+
+TEST(MotionDetectorTest, MovingBlockStartsAndEndsMotion)
+{
+    for (GstVideoFormat format : FORMATS)
+    {
+        SCOPED_TRACE(gst_video_format_to_string(format));
+        TestCamera camera(format);
+        ASSERT_TRUE(camera.is_configured());
+
+        // The first frame has nothing to be compared to
+        ASSERT_TRUE(camera.move(LARGE_BLOCK, 3));
+        EXPECT_TRUE(camera.events().empty());
+        ASSERT_TRUE(camera.move(LARGE_BLOCK, 1));
+        EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+        ASSERT_TRUE(camera.move(LARGE_BLOCK, 5));
+        EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+
+        ASSERT_TRUE(camera.hold(1));
+        EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+        ASSERT_TRUE(camera.hold(5));
+        EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+    }
+}
+
+TEST(MotionDetectorTest, PaddedStridesAreSampled)
+{
+    // Semi-planar and packed luma, with rows longer than the frame width
+    for (GstVideoFormat format : {GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_I420})
+    {
+        SCOPED_TRACE(gst_video_format_to_string(format));
+        TestCamera camera(format, create_configuration(), 24);
+        ASSERT_TRUE(camera.is_configured());
+
+        ASSERT_TRUE(camera.move(LARGE_BLOCK, 4));
+        ASSERT_TRUE(camera.hold(1));
+        EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+    }
+}
+
+TEST(MotionDetectorTest, MotionStartsAfterStartFramesInARow)
+{
+    TestCamera camera(GST_VIDEO_FORMAT_I420);
+    ASSERT_TRUE(camera.is_configured());
+
+    // Changes below start-permille never start motion
+    ASSERT_TRUE(camera.move(SMALL_BLOCK, 10));
+    EXPECT_TRUE(camera.events().empty());
+
+    // Two moving frames, then a still one resetting the count
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 2));
+    ASSERT_TRUE(camera.hold(1));
+    EXPECT_TRUE(camera.events().empty());
+
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 2));
+    EXPECT_TRUE(camera.events().empty());
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 1));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+}
+
+TEST(MotionDetectorTest, MotionLastsWhileAboveStopPermille)
+{
+    TestCamera camera(GST_VIDEO_FORMAT_NV12);
+    ASSERT_TRUE(camera.is_configured());
+
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 4));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+
+    // Between stop-permille and start-permille
+    ASSERT_TRUE(camera.move(SMALL_BLOCK, 10));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+
+    ASSERT_TRUE(camera.hold(1));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+
+    // Started again after start-frames moving frames
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 2));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 1));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true, false, true}));
+}
+
+TEST(MotionDetectorTest, MotionEndsAfterPostRoll)
+{
+    TestCamera camera(GST_VIDEO_FORMAT_GRAY8, create_configuration(1));
+    ASSERT_TRUE(camera.is_configured());
+
+    ASSERT_TRUE(camera.move(LARGE_BLOCK, 4));
+    ASSERT_TRUE(camera.hold(10));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    ASSERT_TRUE(camera.hold(1));
+    EXPECT_EQ(camera.events(), std::vector<bool>({true, false}));
+}
+
+TEST(MotionDetectorTest, RejectsFramesWithoutLuma)
+{
+    MotionDetector detector;
+    detector.configure(create_configuration(), nullptr);
+
+    GstVideoInfo info;
+    gst_video_info_set_format(&info, GST_VIDEO_FORMAT_RGB, FRAME_WIDTH, FRAME_HEIGHT);
+    GstCaps* caps = gst_video_info_to_caps(&info);
+    EXPECT_FALSE(detector.push_caps(0, caps));
+    gst_caps_unref(caps);
+
+    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&info), nullptr);
+    EXPECT_FALSE(detector.push_buffer(0, buffer));
+    gst_buffer_unref(buffer);
+}
@@ -0,0 +1,126 @@
+#include "MotionKernel.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Frames differing by -30, -20, -10, 0, 10, 20 and 30 in turn, around
+// varying values. The size is not a multiple of any vector width, so that
+// the scalar tails are exercised too.
+constexpr size_t GOLDEN_FRAME_SIZE = 7 * 1000 + 3;
+
+struct GoldenFrames
+{
+    GoldenFrames() : current(GOLDEN_FRAME_SIZE), previous(GOLDEN_FRAME_SIZE)
+    {
+        for (size_t i = 0; i < GOLDEN_FRAME_SIZE; ++i)
+        {
+            int value = 100 + static_cast<int>(i % 50);
+            int difference = static_cast<int>(i % 7) * 10 - 30;
+            previous[i] = static_cast<uint8_t>(value);
+            current[i] = static_cast<uint8_t>(value + difference);
+        }
+    }
+
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> previous;
+};
+
+// Deterministic pseudo-random samples (LCG)
+std::vector<uint8_t> create_noise(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> samples(size);
+    for (uint8_t& sample : samples)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        sample = static_cast<uint8_t>(seed >> 24);
+    }
+    return samples;
+}
+} // namespace
+
+TEST(MotionKernelTest, ScalarImplementationComesLast)
+{
+    std::vector<MotionKernelImplementation> implementations = motion_kernel_implementations();
+    ASSERT_FALSE(implementations.empty());
+    EXPECT_EQ(std::string(implementations.back().name), "scalar");
+    EXPECT_EQ(std::string(motion_kernel_name()), implementations.front().name);
+}
+
+TEST(MotionKernelTest, MatchesGoldenCounts)
+{
+    const GoldenFrames frames;
+    const struct
+    {
+        uint8_t threshold;
+        size_t count;
+    } golden_counts[] = {{0, 6003}, {9, 6003}, {10, 4002}, {15, 4002}, {29, 2001}, {30, 0}, {255, 0}};
+
+    for (const MotionKernelImplementation& implementation : motion_kernel_implementations())
+    {
+        SCOPED_TRACE(implementation.name);
+        for (const auto& golden : golden_counts)
+        {
+            SCOPED_TRACE(golden.threshold);
+            EXPECT_EQ(implementation.count_changed_samples(frames.current.data(), frames.previous.data(),
+                                                           GOLDEN_FRAME_SIZE, golden.threshold),
+                      golden.count);
+            // The difference is absolute
+            EXPECT_EQ(implementation.count_changed_samples(frames.previous.data(), frames.current.data(),
+                                                           GOLDEN_FRAME_SIZE, golden.threshold),
+                      golden.count);
+        }
+    }
+}
+
+TEST(MotionKernelTest, HandlesFullRangeDifferences)
+{
+    // Unsigned samples, whose differences must not wrap or be compared as
+    // signed bytes
+    const std::vector<uint8_t> black(1000, 0);
+    const std::vector<uint8_t> white(1000, 255);
+    for (const MotionKernelImplementation& implementation : motion_kernel_implementations())
+    {
+        SCOPED_TRACE(implementation.name);
+        EXPECT_EQ(implementation.count_changed_samples(white.data(), black.data(), white.size(), 254), 1000U);
+        EXPECT_EQ(implementation.count_changed_samples(black.data(), white.data(), white.size(), 254), 1000U);
+        EXPECT_EQ(implementation.count_changed_samples(black.data(), white.data(), white.size(), 127), 1000U);
+        EXPECT_EQ(implementation.count_changed_samples(white.data(), black.data(), white.size(), 255), 0U);
+        EXPECT_EQ(implementation.count_changed_samples(white.data(), white.data(), white.size(), 0), 0U);
+    }
+}
+
+TEST(MotionKernelTest, MatchesScalarOnAnySizeAndAlignment)
+{
+    const std::vector<uint8_t> current = create_noise(256, 1);
+    const std::vector<uint8_t> previous = create_noise(256, 2);
+    std::vector<MotionKernelImplementation> implementations = motion_kernel_implementations();
+    const MotionKernelImplementation& scalar = implementations.back();
+
+    for (const MotionKernelImplementation& implementation : implementations)
+    {
+        SCOPED_TRACE(implementation.name);
+        for (size_t offset = 0; offset < 4; ++offset)
+        {
+            for (size_t size = 0; size <= 100; ++size)
+            {
+                for (uint8_t threshold : {0, 32, 128})
+                {
+                    EXPECT_EQ(implementation.count_changed_samples(current.data() + offset, previous.data() + offset,
+                                                                   size, threshold),
+                              scalar.count_changed_samples(current.data() + offset, previous.data() + offset, size,
+                                                           threshold))
+                        << "size " << size << ", offset " << offset << ", threshold " << unsigned(threshold);
+                }
+            }
+        }
+    }
+}
+
+TEST(MotionKernelTest, SelectedImplementationIsUsed)
+{
+    const GoldenFrames frames;
+    EXPECT_EQ(count_changed_samples(frames.current.data(), frames.previous.data(), GOLDEN_FRAME_SIZE, 15), 4002U);
+}
@@ -0,0 +1,186 @@
+#include "PreRecordBuffer.h"
+
+#include <gtest/gtest.h>
+
+namespace
+{
+// Access unit filled with its marker byte, so that copies can be told apart
+GstBuffer* create_access_unit(gsize size, guint8 marker, GstClockTime timestamp, bool keyframe)
+{
+    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, size, nullptr);
+    gst_buffer_memset(buffer, 0, marker, size);
+    GST_BUFFER_PTS(buffer) = timestamp;
+    GST_BUFFER_DTS(buffer) = timestamp;
+    GST_BUFFER_DURATION(buffer) = 33 * GST_MSECOND;
+    if (!keyframe)
+    {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    return buffer;
+}
+
+void push(PreRecordBuffer& ring, gsize size, guint8 marker, GstClockTime timestamp, bool keyframe)
+{
+    GstBuffer* buffer = create_access_unit(size, marker, timestamp, keyframe);
+    ring.push(buffer);
+    gst_buffer_unref(buffer);
+}
+
+// Marker of the idx-th oldest access unit, checking that its whole data was
+// kept (0 if not)
+guint8 marker_at(const PreRecordBuffer& ring, unsigned int idx)
+{
+    GstBuffer* buffer = ring.copy_access_unit(idx);
+    GstMapInfo map;
+    guint8 marker = 0;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        marker = (map.size > 0) ? map.data[0] : 0;
+        for (gsize i = 0; i < map.size; ++i)
+        {
+            if (map.data[i] != marker)
+            {
+                marker = 0;
+                break;
+            }
+        }
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_buffer_unref(buffer);
+    return marker;
+}
+} // namespace
+
+TEST(PreRecordBufferTest, StartsWithAKeyframe)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(1024, 16, GST_CLOCK_TIME_NONE));
+
+    push(ring, 10, 1, 0, false);
+    EXPECT_TRUE(ring.is_empty());
+
+    push(ring, 10, 2, GST_SECOND, true);
+    push(ring, 10, 3, 2 * GST_SECOND, false);
+    ASSERT_EQ(ring.size(), 2U);
+    EXPECT_EQ(marker_at(ring, 0), 2);
+    EXPECT_EQ(marker_at(ring, 1), 3);
+}
+
+TEST(PreRecordBufferTest, CopyKeepsTimestampsAndFlags)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(1024, 16, GST_CLOCK_TIME_NONE));
+    push(ring, 10, 1, GST_SECOND, true);
+    push(ring, 20, 2, 2 * GST_SECOND, false);
+
+    GstBuffer* keyframe = ring.copy_access_unit(0);
+    EXPECT_EQ(GST_BUFFER_PTS(keyframe), GST_SECOND);
+    EXPECT_EQ(GST_BUFFER_DTS(keyframe), GST_SECOND);
+    EXPECT_EQ(GST_BUFFER_DURATION(keyframe), 33 * GST_MSECOND);
+    EXPECT_FALSE(GST_BUFFER_FLAG_IS_SET(keyframe, GST_BUFFER_FLAG_DELTA_UNIT));
+    gst_buffer_unref(keyframe);
+
+    GstBuffer* delta = ring.copy_access_unit(1);
+    EXPECT_EQ(gst_buffer_get_size(delta), 20U);
+    EXPECT_EQ(GST_BUFFER_PTS(delta), 2 * GST_SECOND);
+    EXPECT_TRUE(GST_BUFFER_FLAG_IS_SET(delta, GST_BUFFER_FLAG_DELTA_UNIT));
+    gst_buffer_unref(delta);
+}
+
+TEST(PreRecordBufferTest, EvictsOldestGopWhenOutOfAccessUnits)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(1024, 4, GST_CLOCK_TIME_NONE));
+    push(ring, 10, 1, 0, true);
+    push(ring, 10, 2, 1, false);
+    push(ring, 10, 3, 2, false);
+    push(ring, 10, 4, 3, true);
+    EXPECT_EQ(ring.oldest_number(), 0U);
+
+    // The whole first GOP goes, not only its keyframe
+    push(ring, 10, 5, 4, false);
+    ASSERT_EQ(ring.size(), 2U);
+    EXPECT_EQ(marker_at(ring, 0), 4);
+    EXPECT_EQ(marker_at(ring, 1), 5);
+    EXPECT_EQ(ring.oldest_number(), 3U);
+}
+
+TEST(PreRecordBufferTest, WrapsAroundTheSlab)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(100, 16, GST_CLOCK_TIME_NONE));
+    push(ring, 30, 1, 0, true);
+    push(ring, 30, 2, 1, false);
+    push(ring, 30, 3, 2, true);
+
+    // Only 10 bytes left at the end of the slab: the first GOP is evicted and
+    // the access unit is written at its beginning, before the tail
+    push(ring, 30, 4, 3, false);
+    ASSERT_EQ(ring.size(), 2U);
+    EXPECT_EQ(marker_at(ring, 0), 3);
+    EXPECT_EQ(marker_at(ring, 1), 4);
+
+    push(ring, 20, 5, 4, false);
+    ASSERT_EQ(ring.size(), 3U);
+    EXPECT_EQ(marker_at(ring, 0), 3);
+    EXPECT_EQ(marker_at(ring, 2), 5);
+}
+
+TEST(PreRecordBufferTest, DropsDeltaUnitWhenItsGopIsEvicted)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(100, 16, GST_CLOCK_TIME_NONE));
+    push(ring, 40, 1, 0, true);
+    push(ring, 40, 2, 1, false);
+
+    // Room for it is only made by evicting its own GOP, leaving it without
+    // its reference frames
+    push(ring, 40, 3, 2, false);
+    EXPECT_TRUE(ring.is_empty());
+
+    push(ring, 40, 4, 3, true);
+    ASSERT_EQ(ring.size(), 1U);
+    EXPECT_EQ(marker_at(ring, 0), 4);
+}
+
+TEST(PreRecordBufferTest, KeyframeReplacesWholeSlab)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(100, 16, GST_CLOCK_TIME_NONE));
+    push(ring, 40, 1, 0, true);
+    push(ring, 40, 2, 1, false);
+    push(ring, 40, 3, 2, true);
+
+    ASSERT_EQ(ring.size(), 1U);
+    EXPECT_EQ(marker_at(ring, 0), 3);
+}
+
+TEST(PreRecordBufferTest, OversizedAccessUnitClearsRing)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(100, 16, GST_CLOCK_TIME_NONE));
+    push(ring, 40, 1, 0, true);
+    push(ring, 200, 2, 1, false);
+    EXPECT_TRUE(ring.is_empty());
+
+    // Following delta units would reference the dropped one
+    push(ring, 10, 3, 2, false);
+    EXPECT_TRUE(ring.is_empty());
+}
+
+TEST(PreRecordBufferTest, TrimsToDurationOnGopBoundaries)
+{
+    PreRecordBuffer ring;
+    ASSERT_TRUE(ring.allocate(1024, 16, GST_SECOND));
+    push(ring, 10, 1, 0, true);
+    push(ring, 10, 2, 500 * GST_MSECOND, false);
+    push(ring, 10, 3, GST_SECOND, true);
+    push(ring, 10, 4, 1500 * GST_MSECOND, false);
+    ASSERT_EQ(ring.size(), 4U);
+
+    // The second GOP alone covers the duration once the third one starts
+    push(ring, 10, 5, 2 * GST_SECOND, true);
+    ASSERT_EQ(ring.size(), 3U);
+    EXPECT_EQ(marker_at(ring, 0), 3);
+    EXPECT_EQ(marker_at(ring, 2), 5);
+}
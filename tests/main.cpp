@@ -0,0 +1,11 @@
+#include <gst/gst.h>
+#include <gtest/gtest.h>
+
+// Pure C++ tests run the same way, GStreamer being only initialized for
+// the ones using buffers and metas
+int main(int argc, char** argv)
+{
+    gst_init(&argc, &argv);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}